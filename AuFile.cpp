@@ -0,0 +1,116 @@
+//
+// Reading AU sound file headers.
+//
+
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include "AuFile.hpp"
+#include "G711.hpp"
+
+//
+// Swap the endianness of an 4-byte integer.
+//
+static uint32_t swap32(uint32_t a)
+{
+    return (a << 24) | ((a << 8) & 0x00ff0000) | ((a >> 8) & 0x0000ff00) | (a >> 24);
+}
+
+bool readAuHeader(int fd, AuHeader &header)
+{
+    unsigned char in[sizeof(AuHeader)];
+    memset(&header, 0, sizeof(header));
+    if(pread(fd, in, sizeof(in), 0) != sizeof(in))
+        return false;
+    return decodeAuHeader(in, header);
+}
+
+bool decodeAuHeader(const unsigned char in[], AuHeader &header)
+{
+    memcpy(&header, in, sizeof(header));
+
+    //
+    // The data in the AU file header is stored in big-endian byte ordering.
+    // If we're on a little-endian machine, we need to reorder the bytes.
+    // While other arrangements (e.g. middle-endian) are also technically
+    // possible, we do not support them, since they are relatively rare.
+    //
+    if(header.magic == AU_MAGIC)
+        return true;
+    if(header.magic != swap32(AU_MAGIC))
+        return false;
+    header.magic = AU_MAGIC;
+    header.header_size = swap32(header.header_size);
+    header.nsamples = swap32(header.nsamples);
+    header.encoding = swap32(header.encoding);
+    header.sample_rate = swap32(header.sample_rate);
+    header.nchannels = swap32(header.nchannels);
+    return true;
+}
+
+bool readAuSamples(int fd, const AuHeader &header, std::vector<short> &samples)
+{
+    if(header.nchannels != 1 || (header.encoding != AU_ENCODING_MULAW &&
+                                 header.encoding != AU_ENCODING_PCM8 &&
+                                 header.encoding != AU_ENCODING_PCM16))
+        return false;
+
+    // The data size may be ~0 for "unknown"; read to the end of the file
+    // then.
+    std::vector<unsigned char> data;
+    unsigned char buf[65536];
+    off_t offset = header.header_size;
+    while(data.size() < header.nsamples)
+    {
+        size_t want = header.nsamples - data.size();
+        ssize_t n = pread(fd, buf, want < sizeof(buf) ? want : sizeof(buf), offset);
+        if(n < 0)
+            return false;
+        if(n == 0)
+            break;
+        data.insert(data.end(), buf, buf + n);
+        offset += n;
+    }
+
+    if(header.encoding == AU_ENCODING_PCM16)
+    {
+        samples.resize(data.size() / 2);
+        for(size_t ii = 0; ii < samples.size(); ii++)
+            samples[ii] = (short)(data[2 * ii] << 8 | data[2 * ii + 1]);
+    }
+    else if(header.encoding == AU_ENCODING_PCM8)
+    {
+        samples.resize(data.size());
+        for(size_t ii = 0; ii < samples.size(); ii++)
+            samples[ii] = (short)((signed char)data[ii] << 8);
+    }
+    else
+    {
+        samples.resize(data.size());
+        if(!data.empty())
+            ulawDecode(&data[0], data.size(), &samples[0]);
+    }
+    return true;
+}
+
+void encodeAuHeader(const AuHeader &header, unsigned char out[])
+{
+    const uint32_t fields[] = { header.magic, header.header_size, header.nsamples,
+                                header.encoding, header.sample_rate, header.nchannels };
+    for(unsigned ii = 0; ii < sizeof(fields) / sizeof(fields[0]); ii++)
+    {
+        out[4 * ii] = fields[ii] >> 24;
+        out[4 * ii + 1] = fields[ii] >> 16;
+        out[4 * ii + 2] = fields[ii] >> 8;
+        out[4 * ii + 3] = fields[ii];
+    }
+}
+
+std::string auHeaderToString(const AuHeader &h)
+{
+    std::stringstream ss;
+    ss << h.header_size << " header bytes, " <<
+        h.nsamples << " samples, encoding type: " << h.encoding << ", "
+        << h.sample_rate << "Hz, " << h.nchannels << " channels";
+    return ss.str();
+}
@@ -0,0 +1,54 @@
+#ifndef AU_FILE
+#define AU_FILE
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+//
+// The string ".snd" in big-endian byte ordering.  This identifies the file as
+// an AU sound file.
+//
+const uint32_t AU_MAGIC = 0x2e736e64;
+
+// The AU encodings we deal with.
+const uint32_t AU_ENCODING_MULAW = 1;
+const uint32_t AU_ENCODING_PCM8 = 2;
+const uint32_t AU_ENCODING_PCM16 = 3;
+
+// The header at the start of an AU file.  The fields are stored big-endian
+// in the file; readAuHeader converts them to the byte order of the machine.
+struct AuHeader
+{
+    uint32_t magic;
+    uint32_t header_size;
+    // The size of the audio data in bytes (which is the number of samples
+    // for 8-bit mono files).
+    uint32_t nsamples;
+    uint32_t encoding;
+    uint32_t sample_rate;
+    uint32_t nchannels;
+};
+
+// Read the header at the start of the file open on fd.  Returns false if
+// the file is too short or is not an AU file; in the latter case magic
+// holds the first four bytes as read.
+bool readAuHeader(int fd, AuHeader &header);
+
+// The same, for the sizeof(AuHeader) bytes at in, e.g. from a pipe.
+bool decodeAuHeader(const unsigned char in[], AuHeader &header);
+
+// Read all the audio of the file open on fd, with header as read by
+// readAuHeader, as 16-bit samples.  8-bit PCM is shifted up by 8 bits, as
+// detect-au does, and mu-law decoded.  Returns false for other encodings,
+// more than one channel, or a read error.
+bool readAuSamples(int fd, const AuHeader &header, std::vector<short> &samples);
+
+// The header as stored at the start of a file: sizeof(AuHeader) bytes,
+// big-endian.
+void encodeAuHeader(const AuHeader &header, unsigned char out[]);
+
+// A one-line description of header, for humans.
+std::string auHeaderToString(const AuHeader &header);
+
+#endif
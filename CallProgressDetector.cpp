@@ -0,0 +1,257 @@
+//
+// Call progress and fax tone detection, sharing the DTMF detector's
+// normalization and Goertzel filter.
+//
+
+#include <cstring>
+#include "CallProgressDetector.hpp"
+#include "Goertzel.hpp"
+
+// The number of batches (of 102 samples at 8KHz) in ms milliseconds.
+#define BATCHES(ms) ((ms) * 8 / 102)
+
+const unsigned CallProgressDetector::BINS;
+const unsigned CallProgressDetector::CADENCES;
+
+// Computed like DtmfDetector::CONSTANTS: 32768 * cos(2 * pi * f / 8000).
+// The SIT frequencies come in pairs that are too far apart to share a bin.
+const INT16 CallProgressDetector::CONSTANTS[BINS] = {
+    31538,  // 0: 350Hz, dial tone
+    30831,  // 1: 440Hz, dial tone, ringback
+    30467,  // 2: 480Hz, ringback, busy
+    28959,  // 3: 620Hz, busy
+    24681,  // 4: 914Hz, SIT first segment
+    23442,  // 5: 985Hz, SIT first segment
+    15537,  // 6: 1371Hz, SIT second segment
+    14208,  // 7: 1429Hz, SIT second segment
+    5710,   // 8: 1777Hz, SIT third segment
+    21281,  // 9: 1100Hz, fax CNG
+    -2571   // 10: 2100Hz, fax CED / answer tone
+};
+
+// The North American cadences (continuous tones have maxOn == 0).
+const CallProgressDetector::Rule CallProgressDetector::RULES[CADENCES] = {
+    // type                 tone           cycles  on                          off
+    { DTMF_EVENT_DIAL_TONE, TONE_DIAL,     0, BATCHES(1000), 0,             0, 0 },
+    { DTMF_EVENT_BUSY,      TONE_BUSY,     2, BATCHES(400),  BATCHES(600),  BATCHES(400), BATCHES(600) },
+    { DTMF_EVENT_REORDER,   TONE_BUSY,     2, BATCHES(200),  BATCHES(320),  BATCHES(180), BATCHES(320) },
+    { DTMF_EVENT_RINGBACK,  TONE_RINGBACK, 0, BATCHES(1600), BATCHES(2400), 0, 0 },
+    { DTMF_EVENT_FAX_CNG,   TONE_CNG,      0, BATCHES(400),  BATCHES(650),  0, 0 },
+    { DTMF_EVENT_FAX_CED,   TONE_CED,      0, BATCHES(500),  0,             0, 0 }
+};
+
+// Each SIT segment lasts 274 or 380ms.
+static const unsigned SIT_MIN = BATCHES(200);
+static const unsigned SIT_MAX = BATCHES(450);
+
+// The fraction of the batch's energy (in 1/256) a bin must hold for a
+// single tone, for each tone of a pair, and for both tones of a pair
+// together.
+static const INT32 SINGLE_SHARE = 179;  // 70%
+static const INT32 PAIR_SHARE = 38;     // 15%
+static const INT32 PAIR_TOTAL = 141;    // 55%
+// Ringback must have little energy at 350 and 620Hz, so that it is not
+// mistaken for the neighbouring dial tone and busy pairs.
+static const INT32 STRAY_SHARE = 26;    // 10%
+
+CallProgressDetector::CallProgressDetector()
+{
+    reset();
+}
+
+void CallProgressDetector::reset()
+{
+    memset(cadences, 0, sizeof(cadences));
+    sitStart = 0;
+    sitRun = 0;
+    sitSegment = TONE_NONE;
+    sitGap = 0;
+}
+
+CallProgressDetector::Tone CallProgressDetector::classify(const INT16 internalArray[], UINT32 count)
+{
+    INT32 M[BINS + 1];
+    uint64_t energy = 0;
+    unsigned ii;
+
+    goertzel_filter(CONSTANTS[0], CONSTANTS[1], internalArray, &M[0], &M[1], count);
+    goertzel_filter(CONSTANTS[2], CONSTANTS[3], internalArray, &M[2], &M[3], count);
+    goertzel_filter(CONSTANTS[4], CONSTANTS[5], internalArray, &M[4], &M[5], count);
+    goertzel_filter(CONSTANTS[6], CONSTANTS[7], internalArray, &M[6], &M[7], count);
+    goertzel_filter(CONSTANTS[8], CONSTANTS[9], internalArray, &M[8], &M[9], count);
+    // There is an odd number of bins; the second output is not used.
+    goertzel_filter(CONSTANTS[10], CONSTANTS[10], internalArray, &M[10], &M[11], count);
+
+    for(ii = 0; ii < count; ii++)
+        energy += internalArray[ii] * internalArray[ii];
+
+    // A sine wave of amplitude A has an energy of count*A*A/2 over the
+    // batch, and goertzel_filter gives it a magnitude of
+    // (A*count/2)**2 / 2**20, since it drops 10 bits from each state
+    // variable.  So full is the magnitude of a bin holding all the energy
+    // of the batch, and M[ii] * 256 / full the bin's share in 1/256.
+    int64_t full = static_cast<int64_t>((energy * count) >> 21);
+    if(full == 0)
+        return TONE_NONE;
+    int64_t share[BINS];
+    for(ii = 0; ii < BINS; ii++)
+        share[ii] = M[ii] > 0 ? static_cast<int64_t>(M[ii]) * 256 : 0;
+
+    // All the tests are of the form share >= threshold * full, to avoid
+    // divisions.
+#define AT_LEAST(s, threshold) ((s) >= (threshold) * full)
+#define PAIR(a, b) (AT_LEAST(share[a], PAIR_SHARE) && AT_LEAST(share[b], PAIR_SHARE) \
+                    && AT_LEAST(share[a] + share[b], PAIR_TOTAL))
+    if(PAIR(2, 3))
+        return TONE_BUSY;
+    if(PAIR(0, 1))
+        return TONE_DIAL;
+    if(PAIR(1, 2) && !AT_LEAST(share[0], STRAY_SHARE) && !AT_LEAST(share[3], STRAY_SHARE))
+        return TONE_RINGBACK;
+    if(AT_LEAST(share[9], SINGLE_SHARE))
+        return TONE_CNG;
+    if(AT_LEAST(share[10], SINGLE_SHARE))
+        return TONE_CED;
+    if(AT_LEAST(share[4], SINGLE_SHARE) || AT_LEAST(share[5], SINGLE_SHARE))
+        return TONE_SIT_LOW;
+    if(AT_LEAST(share[6], SINGLE_SHARE) || AT_LEAST(share[7], SINGLE_SHARE))
+        return TONE_SIT_MID;
+    if(AT_LEAST(share[8], SINGLE_SHARE))
+        return TONE_SIT_HIGH;
+#undef PAIR
+#undef AT_LEAST
+    return TONE_NONE;
+}
+
+void CallProgressDetector::process(const INT16 internalArray[], UINT32 count, uint64_t sample,
+                                   DtmfEventSink *sink, UINT32 channel)
+{
+    Tone tone = internalArray ? classify(internalArray, count) : TONE_NONE;
+    for(unsigned ii = 0; ii < CADENCES; ii++)
+        step(cadences[ii], RULES[ii], tone == RULES[ii].tone, sample, count, sink, channel);
+    stepSit(tone, sample, count, sink, channel);
+}
+
+// Publish an event of type that started at sample.
+static void publish(DtmfEventSink *sink, UINT32 channel, unsigned char type, uint64_t sample)
+{
+    if(!sink)
+        return;
+    DtmfEvent event;
+    event.sample = sample;
+    event.channel = channel;
+    event.digit = 0;
+    event.type = type;
+    sink->dtmfEvent(event);
+}
+
+void CallProgressDetector::step(Cadence &cadence, const Rule &rule, bool on, uint64_t sample,
+                                UINT32 count, DtmfEventSink *sink, UINT32 channel)
+{
+    if(on == (cadence.on != 0))
+    {
+        if(cadence.run < 0xffff)
+            cadence.run++;
+        cadence.flip = 0;
+        // A continuous tone is published as soon as it has lasted long
+        // enough.
+        if(on && rule.maxOn == 0 && !cadence.reported && cadence.run >= rule.minOn)
+        {
+            publish(sink, channel, rule.type, cadence.start);
+            cadence.reported = 1;
+        }
+        return;
+    }
+    // Wait for a second batch before ending the period.
+    if(++cadence.flip < 2)
+    {
+        if(cadence.run < 0xffff)
+            cadence.run++;
+        return;
+    }
+
+    // The period ended one batch ago.
+    UINT16 period = cadence.run - 1;
+    uint64_t periodStart = sample - count;
+    if(cadence.on)
+    {
+        cadence.lastOn = period;
+        if(rule.maxOn == 0)
+        {
+            cadence.reported = 0;
+        }
+        else if(rule.cycles == 0)
+        {
+            // A single burst is published when it ends.
+            if(period >= rule.minOn && period <= rule.maxOn)
+                publish(sink, channel, rule.type, cadence.start);
+        }
+    }
+    else
+    {
+        if(rule.cycles > 0)
+        {
+            if(cadence.lastOn >= rule.minOn && cadence.lastOn <= rule.maxOn
+               && period >= rule.minOff && period <= rule.maxOff)
+            {
+                if(cadence.cycles < 255)
+                    cadence.cycles++;
+            }
+            else
+            {
+                cadence.cycles = 0;
+                cadence.reported = 0;
+            }
+            if(cadence.cycles >= rule.cycles && !cadence.reported)
+            {
+                publish(sink, channel, rule.type, cadence.start);
+                cadence.reported = 1;
+            }
+        }
+        // A new pattern starts with this on period.
+        if(cadence.cycles == 0)
+            cadence.start = periodStart;
+    }
+    cadence.on = on;
+    cadence.run = 2;
+    cadence.flip = 0;
+}
+
+void CallProgressDetector::stepSit(Tone tone, uint64_t sample, UINT32 count,
+                                   DtmfEventSink *sink, UINT32 channel)
+{
+    bool sit = tone == TONE_SIT_LOW || tone == TONE_SIT_MID || tone == TONE_SIT_HIGH;
+    if(sit && tone == sitSegment)
+    {
+        if(sitRun < 0xffff)
+            sitRun++;
+        sitGap = 0;
+        return;
+    }
+    if(!sit)
+    {
+        // Tolerate a batch straddling two segments.
+        if(sitSegment != TONE_NONE && ++sitGap > 2)
+        {
+            // The last segment is over: the third one completes the SIT.
+            if(sitSegment == TONE_SIT_HIGH && sitRun >= SIT_MIN && sitRun <= SIT_MAX)
+                publish(sink, channel, DTMF_EVENT_SIT, sitStart);
+            sitSegment = TONE_NONE;
+        }
+        return;
+    }
+
+    // A new segment: it must follow the previous one in order.
+    bool good = sitSegment != TONE_NONE && sitRun >= SIT_MIN && sitRun <= SIT_MAX
+                && tone == sitSegment + 1;
+    if(tone == TONE_SIT_LOW)
+        sitStart = sample;
+    else if(!good)
+    {
+        sitSegment = TONE_NONE;
+        return;
+    }
+    sitSegment = tone;
+    sitRun = 1;
+    sitGap = 0;
+}
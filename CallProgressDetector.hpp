@@ -0,0 +1,112 @@
+#ifndef CALL_PROGRESS_DETECTOR
+#define CALL_PROGRESS_DETECTOR
+
+#include <stdint.h>
+#include "types_cpp.hpp"
+#include "DtmfEventQueue.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int32     INT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int16     INT16;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint16    UINT16;
+
+// Detects call progress tones (North American dial tone, busy, reorder,
+// ringback and SIT) and fax tones (CNG and CED/ANS) in a channel, alongside
+// the DTMF detection.
+//
+// Attach one to a DtmfDetector with setCallProgress.  The detector then
+// hands over each batch after normalizing it, so the tones are looked for
+// in the same samples the DTMF filters ran on.  Each batch is classified
+// by the strongest of a few extra Goertzel bins, and cadence state
+// machines turn the sequence of classes into events, published to the
+// detector's event sink next to the push buttons.
+//
+// The object holds the cadence state of a single channel.
+class CallProgressDetector
+{
+public:
+    // The class of a single batch.
+    enum Tone
+    {
+        TONE_NONE = 0,
+        TONE_DIAL,      // 350 + 440Hz
+        TONE_BUSY,      // 480 + 620Hz (busy and reorder)
+        TONE_RINGBACK,  // 440 + 480Hz
+        TONE_CNG,       // 1100Hz
+        TONE_CED,       // 2100Hz
+        TONE_SIT_LOW,   // 913.8 or 985.2Hz
+        TONE_SIT_MID,   // 1370.6 or 1428.5Hz
+        TONE_SIT_HIGH   // 1776.7Hz
+    };
+
+    CallProgressDetector();
+
+    // Forget everything seen so far.
+    void reset();
+
+    // Process a batch.  internalArray holds the normalized samples of the
+    // batch, or is 0 for a silent batch.  sample is the position of the
+    // batch in the channel's audio.
+    void process(const INT16 internalArray[], UINT32 count, uint64_t sample,
+                 DtmfEventSink *sink, UINT32 channel);
+
+    // Classify a single batch of normalized samples.
+    static Tone classify(const INT16 internalArray[], UINT32 count);
+
+private:
+    // The number of frequencies we look at.
+    static const unsigned BINS = 11;
+    static const INT16 CONSTANTS[BINS];
+
+    // What a cadence state machine looks for.  All durations are in
+    // batches.  A machine either looks for a continuous tone (maxOn == 0),
+    // for a single burst (cycles == 0) or for repeated on/off cycles.
+    struct Rule
+    {
+        unsigned char type;     // the DtmfEventType to publish
+        unsigned char tone;     // the Tone it follows
+        unsigned char cycles;
+        UINT16 minOn, maxOn;
+        UINT16 minOff, maxOff;
+    };
+    static const unsigned CADENCES = 6;
+    static const Rule RULES[CADENCES];
+
+    // The state of a cadence state machine.
+    struct Cadence
+    {
+        // Where the current pattern started.
+        uint64_t start;
+        // The length of the current on or off period so far.
+        UINT16 run;
+        // The length of the last on period.
+        UINT16 lastOn;
+        // Set while the tone is on.
+        unsigned char on;
+        // The number of consecutive batches disagreeing with on.  A period
+        // ends only once two batches in a row disagree, so that a single
+        // misclassified batch does not break it.
+        unsigned char flip;
+        // The number of good on/off cycles seen in a row.
+        unsigned char cycles;
+        // Set once the pattern has been published.
+        unsigned char reported;
+    };
+    Cadence cadences[CADENCES];
+
+    // SIT is three segments in a row, each at a higher frequency.
+    uint64_t sitStart;
+    UINT16 sitRun;
+    // The segment we are in (a Tone), or TONE_NONE.
+    unsigned char sitSegment;
+    // The number of batches since the last SIT segment ended.
+    unsigned char sitGap;
+
+    void step(Cadence &cadence, const Rule &rule, bool on, uint64_t sample,
+              UINT32 count, DtmfEventSink *sink, UINT32 channel);
+    void stepSit(Tone tone, uint64_t sample, UINT32 count,
+                 DtmfEventSink *sink, UINT32 channel);
+};
+
+#endif
@@ -0,0 +1,122 @@
+//
+// Read-ahead of a file region on a separate thread.
+//
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ChunkReader.hpp"
+
+ChunkReader::ChunkReader(int fd_, uint64_t offset_, uint64_t length_, size_t chunkSize_, unsigned depth_)
+    : fd(fd_), offset(offset_), length(length_), chunkSize(chunkSize_ ? chunkSize_ : 1),
+      depth(depth_ ? depth_ : 1), buffers(0), sizes(0), filled(0), released(0),
+      finished(false), stopping(false), error(0)
+{
+}
+
+ChunkReader::~ChunkReader()
+{
+    if(thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        releasedCond.notify_one();
+        thread.join();
+    }
+    if(buffers)
+        munmap(buffers, chunkSize * depth);
+    delete[] sizes;
+}
+
+bool ChunkReader::start()
+{
+    // The buffers are page-aligned and reused for every chunk, so the
+    // kernel can copy straight into pages that are already mapped.
+    void *mem = mmap(0, chunkSize * depth, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+        return false;
+    buffers = static_cast<char *>(mem);
+    sizes = new size_t[depth];
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+    thread = std::thread(&ChunkReader::run, this);
+    return true;
+}
+
+void ChunkReader::run()
+{
+    uint64_t position = offset;
+    uint64_t end = offset + length;
+    for(uint64_t n = 0; ; n++)
+    {
+        {
+            // Wait for a free buffer.
+            std::unique_lock<std::mutex> lock(mutex);
+            while(n - released >= depth && !stopping)
+                releasedCond.wait(lock);
+            if(stopping)
+                return;
+        }
+
+        char *buffer = buffers + (n % depth) * chunkSize;
+        size_t want = end - position < chunkSize ? end - position : chunkSize;
+        size_t got = 0;
+        int failure = 0;
+        while(got < want)
+        {
+            ssize_t r = pread(fd, buffer + got, want - got, position + got);
+            if(r < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                failure = errno;
+                break;
+            }
+            if(r == 0)
+                break;
+            got += r;
+        }
+        position += got;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(failure)
+            error = failure;
+        if(got > 0 && !failure)
+        {
+            sizes[n % depth] = got;
+            filled = n + 1;
+        }
+        if(got < chunkSize || failure)
+        {
+            finished = true;
+            filledCond.notify_one();
+            return;
+        }
+        filledCond.notify_one();
+    }
+}
+
+bool ChunkReader::next(Chunk &chunk)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(filled == released && !finished)
+        filledCond.wait(lock);
+    if(filled == released)
+        return false;
+    unsigned index = released % depth;
+    chunk.data = buffers + index * chunkSize;
+    chunk.size = sizes[index];
+    chunk.offset = offset + released * chunkSize;
+    return true;
+}
+
+void ChunkReader::release()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        released++;
+    }
+    releasedCond.notify_one();
+}
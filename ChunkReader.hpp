@@ -0,0 +1,91 @@
+#ifndef CHUNK_READER
+#define CHUNK_READER
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <stddef.h>
+#include <stdint.h>
+
+// Reads a region of a file in large chunks on a thread of its own, so that
+// the I/O overlaps with whatever the caller does with the previous chunks.
+//
+// The chunks are read into a fixed set of depth buffers, allocated once up
+// front: at most depth chunks are ever in memory.  When all of them are
+// filled and not yet released by the caller, the reader thread waits.
+//
+//  ChunkReader reader(fd, offset, length);
+//  if(!reader.start()) ...
+//  ChunkReader::Chunk chunk;
+//  while(reader.next(chunk))
+//  {
+//      ... use chunk.data[0 .. chunk.size) ...
+//      reader.release();
+//  }
+//  if(reader.getError()) ...
+//
+// next and release must be called from a single thread.
+class ChunkReader
+{
+public:
+    struct Chunk
+    {
+        const char *data;
+        // Always chunkSize, except for the last chunk.
+        size_t size;
+        // The position of data in the file.
+        uint64_t offset;
+    };
+
+    // Read length bytes of the file open on fd, from offset on, or up to
+    // the end of the file if it is shorter.
+    ChunkReader(int fd, uint64_t offset, uint64_t length,
+                size_t chunkSize=1 << 20, unsigned depth=3);
+    ~ChunkReader();
+
+    // Allocate the buffers and start reading.  Returns false if the
+    // buffers could not be allocated.
+    bool start();
+
+    // Wait for the next chunk.  Returns false once the whole region has
+    // been returned, or a read failed.  The previous chunk must have been
+    // released.
+    bool next(Chunk &chunk);
+    // Hand the chunk returned by next back to the reader thread.
+    void release();
+
+    // The errno of the read that failed, or 0.
+    int getError() const
+    {
+        return error;
+    }
+private:
+    int fd;
+    uint64_t offset;
+    uint64_t length;
+    size_t chunkSize;
+    unsigned depth;
+
+    char *buffers;
+    // The number of bytes read into each buffer.
+    size_t *sizes;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable filledCond;
+    std::condition_variable releasedCond;
+    // Chunks are numbered from 0; chunk n is read into buffer n % depth.
+    // Guarded by mutex.
+    uint64_t filled;
+    uint64_t released;
+    bool finished;
+    bool stopping;
+    int error;
+
+    void run();
+
+    // Not copyable
+    ChunkReader(const ChunkReader &);
+    ChunkReader &operator=(const ChunkReader &);
+};
+
+#endif
@@ -0,0 +1,442 @@
+//
+// The on-disk digit index: segment files, and queries over a directory of
+// them.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "DigitIndex.hpp"
+
+static const char INDEX_MAGIC[8] = { 'D', 'T', 'M', 'F', 'I', 'D', 'X', '1' };
+static const UINT32 INDEX_VERSION = 1;
+static const char SYMBOLS[] = "0123456789*#ABCD";
+
+static_assert(sizeof(DigitIndexSegment::Header) == 72, "the header is part of the file format");
+static_assert(sizeof(DigitIndexSegment::Record) == 48, "the records are part of the file format");
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+int DigitIndexSegment::symbol(char digit)
+{
+    const char *p = digit ? strchr(SYMBOLS, digit) : 0;
+    return p ? static_cast<int>(p - SYMBOLS) : -1;
+}
+
+DigitIndexSegment::DigitIndexSegment()
+    : fd(-1), mapping(MAP_FAILED), mappingBytes(0)
+{
+}
+
+DigitIndexSegment::~DigitIndexSegment()
+{
+    if(mapping != MAP_FAILED)
+        munmap(mapping, mappingBytes);
+    if(fd >= 0)
+        close(fd);
+}
+
+DigitIndexSegment *DigitIndexSegment::open(const std::string &path, bool writable)
+{
+    int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    if(fd < 0)
+        return 0;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        close(fd);
+        return 0;
+    }
+    DigitIndexSegment *segment = new DigitIndexSegment();
+    segment->fileName_ = path;
+    segment->fd = fd;
+    segment->mappingBytes = st.st_size;
+    segment->mapping = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(segment->mapping == MAP_FAILED)
+    {
+        delete segment;
+        return 0;
+    }
+
+    // Check everything the accessors rely on once, here.
+    const char *base = static_cast<const char *>(segment->mapping);
+    const Header *h = reinterpret_cast<const Header *>(base);
+    const uint64_t bytes = st.st_size;
+    bool ok = memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && h->version == INDEX_VERSION
+        && h->bytes == bytes
+        && h->recordsOffset == alignUp(sizeof(Header))
+        && h->eventsOffset == h->recordsOffset + sizeof(Record) * (uint64_t)h->recordings
+        && h->gramsOffset == h->eventsOffset + 8 * h->events
+        && h->pathsOffset == h->gramsOffset + 8 * (uint64_t)(GRAMS + 1)
+        && h->pathsOffset <= h->postingsOffset && h->postingsOffset <= bytes;
+    if(ok)
+    {
+        segment->header = h;
+        segment->records = reinterpret_cast<const Record *>(base + h->recordsOffset);
+        segment->events_ = reinterpret_cast<const uint64_t *>(base + h->eventsOffset);
+        segment->grams = reinterpret_cast<const uint64_t *>(base + h->gramsOffset);
+        segment->paths = base + h->pathsOffset;
+        segment->postingData = reinterpret_cast<const unsigned char *>(base + h->postingsOffset);
+        const uint64_t pathBytes = h->postingsOffset - h->pathsOffset;
+        for(UINT32 ii = 0; ok && ii < h->recordings; ii++)
+        {
+            const Record &r = segment->records[ii];
+            ok = (uint64_t)r.pathOffset + r.pathLength <= pathBytes
+                && (uint64_t)r.firstEvent + r.events <= h->events
+                && (ii == 0 || r.mtime >= segment->records[ii - 1].mtime);
+        }
+        for(UINT32 ii = 0; ok && ii < GRAMS; ii++)
+            ok = segment->grams[ii] <= segment->grams[ii + 1];
+        ok = ok && segment->grams[GRAMS] <= bytes - h->postingsOffset;
+    }
+    if(!ok)
+    {
+        delete segment;
+        return 0;
+    }
+    return segment;
+}
+
+bool DigitIndexSegment::markDeleted(UINT32 index)
+{
+    UINT32 flags = records[index].flags | DELETED;
+    off_t offset = header->recordsOffset + sizeof(Record) * (uint64_t)index + offsetof(Record, flags);
+    return pwrite(fd, &flags, sizeof(flags), offset) == sizeof(flags);
+}
+
+UINT32 DigitIndexSegment::lowerBound(int64_t mtime) const
+{
+    UINT32 lo = 0, hi = header->recordings;
+    while(lo < hi)
+    {
+        UINT32 mid = lo + (hi - lo) / 2;
+        if(records[mid].mtime < mtime)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void DigitIndexSegment::postings(UINT32 gram, UINT32 begin, UINT32 end, std::vector<UINT32> &out) const
+{
+    const unsigned char *p = postingData + grams[gram];
+    const unsigned char *stop = postingData + grams[gram + 1];
+    uint64_t recording = 0;
+    bool first = true;
+    while(p < stop)
+    {
+        uint64_t delta = 0;
+        for(unsigned shift = 0; p < stop && shift < 64; shift += 7)
+        {
+            unsigned char byte = *p++;
+            delta |= (uint64_t)(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                break;
+        }
+        recording = first ? delta : recording + delta;
+        first = false;
+        if(recording >= end)
+            break;
+        if(recording >= begin)
+            out.push_back(static_cast<UINT32>(recording));
+    }
+}
+
+void DigitIndexWriter::add(const std::string &path, int64_t mtime, uint64_t size, uint64_t samples,
+                           const std::vector<uint64_t> &events)
+{
+    Entry entry;
+    entry.path = path;
+    entry.mtime = mtime;
+    entry.size = size;
+    entry.samples = samples;
+    entry.events = events;
+    entries.push_back(entry);
+}
+
+void DigitIndexWriter::add(const DigitIndexSegment &segment, UINT32 index)
+{
+    const DigitIndexSegment::Record &r = segment.record(index);
+    const uint64_t *events = segment.events(index);
+    add(segment.path(index), r.mtime, r.size, r.samples, std::vector<uint64_t>(events, events + r.events));
+}
+
+static void putVarint(std::vector<unsigned char> &out, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+static bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while(size > 0)
+    {
+        ssize_t n = ::write(fd, p, size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool DigitIndexWriter::write(const std::string &path)
+{
+    std::vector<const Entry *> sorted(entries.size());
+    for(size_t ii = 0; ii < entries.size(); ii++)
+        sorted[ii] = &entries[ii];
+    std::sort(sorted.begin(), sorted.end(), [](const Entry *a, const Entry *b) {
+        return a->mtime != b->mtime ? a->mtime < b->mtime : a->path < b->path;
+    });
+
+    typedef DigitIndexSegment::Record Record;
+    const UINT32 GRAMS = DigitIndexSegment::GRAMS;
+    std::vector<Record> records(sorted.size());
+    std::vector<uint64_t> events;
+    std::string paths;
+    std::vector<std::vector<UINT32> > lists(GRAMS);
+    std::vector<UINT32> seen(GRAMS, 0);
+    for(UINT32 ii = 0; ii < sorted.size(); ii++)
+    {
+        const Entry &e = *sorted[ii];
+        if(paths.size() + e.path.size() > 0xffffffffu || events.size() + e.events.size() > 0xffffffffu)
+        {
+            errno = EFBIG;
+            return false;
+        }
+        Record &r = records[ii];
+        memset(&r, 0, sizeof(r));
+        r.mtime = e.mtime;
+        r.size = e.size;
+        r.samples = e.samples;
+        r.pathOffset = paths.size();
+        r.pathLength = e.path.size();
+        r.firstEvent = events.size();
+        r.events = e.events.size();
+        paths += e.path;
+        events.insert(events.end(), e.events.begin(), e.events.end());
+
+        // The trigrams of the recording, once each.  seen holds the last
+        // recording (plus one) each trigram was added for.
+        int a = -1, b = -1;
+        for(size_t jj = 0; jj < e.events.size(); jj++)
+        {
+            int c = DigitIndexSegment::symbol(DigitIndexSegment::eventDigit(e.events[jj]));
+            if(a >= 0 && b >= 0 && c >= 0)
+            {
+                UINT32 gram = (a << 8) | (b << 4) | c;
+                if(seen[gram] != ii + 1)
+                {
+                    seen[gram] = ii + 1;
+                    lists[gram].push_back(ii);
+                }
+            }
+            a = b;
+            b = c;
+        }
+    }
+
+    std::vector<uint64_t> grams(GRAMS + 1);
+    std::vector<unsigned char> postings;
+    for(UINT32 gram = 0; gram < GRAMS; gram++)
+    {
+        grams[gram] = postings.size();
+        for(size_t jj = 0; jj < lists[gram].size(); jj++)
+            putVarint(postings, jj == 0 ? lists[gram][jj] : lists[gram][jj] - lists[gram][jj - 1]);
+    }
+    grams[GRAMS] = postings.size();
+
+    DigitIndexSegment::Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.recordings = records.size();
+    header.events = events.size();
+    header.recordsOffset = alignUp(sizeof(header));
+    header.eventsOffset = header.recordsOffset + sizeof(Record) * records.size();
+    header.gramsOffset = header.eventsOffset + 8 * events.size();
+    header.pathsOffset = header.gramsOffset + 8 * grams.size();
+    header.postingsOffset = header.pathsOffset + paths.size();
+    header.bytes = header.postingsOffset + postings.size();
+
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    bool ok = writeAll(fd, &header, sizeof(header))
+        && writeAll(fd, records.empty() ? 0 : &records[0], sizeof(Record) * records.size())
+        && writeAll(fd, events.empty() ? 0 : &events[0], 8 * events.size())
+        && writeAll(fd, &grams[0], 8 * grams.size())
+        && writeAll(fd, paths.data(), paths.size())
+        && writeAll(fd, postings.empty() ? 0 : &postings[0], postings.size())
+        && fsync(fd) == 0;
+    int error = errno;
+    close(fd);
+    if(ok && rename(temporary.c_str(), path.c_str()) == 0)
+        return true;
+    error = ok ? errno : error;
+    unlink(temporary.c_str());
+    errno = error;
+    return false;
+}
+
+//
+// Segments are named seg-NNNNNN.idx, numbered in the order they were
+// written.
+//
+static bool segmentNumber(const char *name, unsigned long &number)
+{
+    char tail[8];
+    return sscanf(name, "seg-%lu%7s", &number, tail) == 2 && strcmp(tail, ".idx") == 0;
+}
+
+DigitIndex::~DigitIndex()
+{
+    for(size_t ii = 0; ii < segments_.size(); ii++)
+        delete segments_[ii];
+}
+
+bool DigitIndex::open(const std::string &directory_, bool writable)
+{
+    directory = directory_;
+    DIR *dir = opendir(directory.c_str());
+    if(!dir)
+        return false;
+    std::vector<std::pair<unsigned long, std::string> > names;
+    for(struct dirent *entry; (entry = readdir(dir)) != 0; )
+    {
+        unsigned long number;
+        if(segmentNumber(entry->d_name, number))
+            names.push_back(std::make_pair(number, std::string(entry->d_name)));
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for(size_t ii = 0; ii < names.size(); ii++)
+    {
+        DigitIndexSegment *segment = DigitIndexSegment::open(directory + "/" + names[ii].second, writable);
+        if(segment)
+            segments_.push_back(segment);
+    }
+    return true;
+}
+
+std::string DigitIndex::nextSegmentPath() const
+{
+    unsigned long next = 0;
+    for(size_t ii = 0; ii < segments_.size(); ii++)
+    {
+        const std::string &name = segments_[ii]->fileName();
+        unsigned long number;
+        if(segmentNumber(name.c_str() + name.rfind('/') + 1, number) && number >= next)
+            next = number + 1;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/seg-%06lu.idx", next);
+    return directory + name;
+}
+
+long DigitIndex::search(const std::string &pattern, int64_t from, int64_t to, uint64_t maxSpan,
+                        std::vector<DigitIndexMatch> &matches) const
+{
+    if(pattern.empty())
+        return -1;
+    for(size_t ii = 0; ii < pattern.size(); ii++)
+        if(pattern[ii] != '?' && DigitIndexSegment::symbol(pattern[ii]) < 0)
+            return -1;
+
+    // The distinct trigrams of the pattern without a wildcard.  Each one
+    // narrows the recordings down; without any, every recording in the
+    // time range is scanned.
+    std::vector<UINT32> grams;
+    for(size_t ii = 0; ii + 2 < pattern.size(); ii++)
+    {
+        int a = DigitIndexSegment::symbol(pattern[ii]);
+        int b = DigitIndexSegment::symbol(pattern[ii + 1]);
+        int c = DigitIndexSegment::symbol(pattern[ii + 2]);
+        if(a >= 0 && b >= 0 && c >= 0)
+            grams.push_back((a << 8) | (b << 4) | c);
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+    long searched = 0;
+    std::vector<UINT32> candidates, list, both;
+    for(size_t s = 0; s < segments_.size(); s++)
+    {
+        const DigitIndexSegment &segment = *segments_[s];
+        UINT32 begin = segment.lowerBound(from);
+        UINT32 end = segment.lowerBound(to);
+        candidates.clear();
+        if(grams.empty())
+        {
+            for(UINT32 ii = begin; ii < end; ii++)
+                candidates.push_back(ii);
+        }
+        else
+        {
+            // Intersect the shortest lists first.
+            std::vector<std::pair<uint64_t, UINT32> > order;
+            for(size_t ii = 0; ii < grams.size(); ii++)
+                order.push_back(std::make_pair(segment.postingBytes(grams[ii]), grams[ii]));
+            std::sort(order.begin(), order.end());
+            segment.postings(order[0].second, begin, end, candidates);
+            for(size_t ii = 1; ii < order.size() && !candidates.empty(); ii++)
+            {
+                list.clear();
+                segment.postings(order[ii].second, candidates.front(), candidates.back() + 1, list);
+                both.clear();
+                std::set_intersection(candidates.begin(), candidates.end(), list.begin(), list.end(),
+                                      std::back_inserter(both));
+                candidates.swap(both);
+            }
+        }
+
+        for(size_t ii = 0; ii < candidates.size(); ii++)
+        {
+            UINT32 index = candidates[ii];
+            if(segment.deleted(index))
+                continue;
+            searched++;
+            const uint64_t *events = segment.events(index);
+            const UINT32 count = segment.record(index).events;
+            for(UINT32 start = 0; start + pattern.size() <= count; start++)
+            {
+                size_t jj = 0;
+                while(jj < pattern.size()
+                      && (pattern[jj] == '?' || pattern[jj] == DigitIndexSegment::eventDigit(events[start + jj])))
+                    jj++;
+                if(jj < pattern.size())
+                    continue;
+                uint64_t span = DigitIndexSegment::eventSample(events[start + pattern.size() - 1])
+                    - DigitIndexSegment::eventSample(events[start]);
+                if(maxSpan && span > maxSpan)
+                    continue;
+                DigitIndexMatch match;
+                match.segment = &segment;
+                match.record = index;
+                match.event = start;
+                matches.push_back(match);
+            }
+        }
+    }
+    return searched;
+}
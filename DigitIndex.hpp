@@ -0,0 +1,221 @@
+#ifndef DIGIT_INDEX
+#define DIGIT_INDEX
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+
+// An on-disk index of the push buttons detected in an archive of
+// recordings, so that digit sequences can be looked up without running the
+// detector again (see dtmf-index and dtmf-query).
+//
+// An index is a directory of segment files.  A segment is written once,
+// by DigitIndexWriter, and renamed into place; after that only the deleted
+// flags of its recordings change, when a recording is indexed again.  The
+// segment is read through a read-only mapping:
+//
+//   Header
+//   Record[recordings]     sorted by modification time, then path
+//   uint64_t events[]      (sample << 8) | push button, for each recording
+//                          in turn
+//   uint64_t grams[4097]   where the postings of each trigram start, and
+//                          where the last one ends
+//   char paths[]
+//   postings               for each trigram, the recordings in which it
+//                          occurs, ascending, as LEB128 deltas
+//
+// A trigram is three successive push buttons of a recording, each as its
+// DigitIndexSegment::symbol.  Values are in the byte order of the machine
+// that wrote the segment; a segment from another byte order is rejected.
+class DigitIndexSegment
+{
+public:
+    struct Header
+    {
+        char magic[8];
+        UINT32 version;
+        UINT32 recordings;
+        uint64_t events;
+        uint64_t recordsOffset;
+        uint64_t eventsOffset;
+        uint64_t gramsOffset;
+        uint64_t pathsOffset;
+        uint64_t postingsOffset;
+        uint64_t bytes;
+    };
+
+    struct Record
+    {
+        // Seconds since the epoch.
+        int64_t mtime;
+        // The file size in bytes, and its number of samples.
+        uint64_t size;
+        uint64_t samples;
+        UINT32 pathOffset;
+        UINT32 pathLength;
+        UINT32 firstEvent;
+        UINT32 events;
+        UINT32 flags;
+        UINT32 reserved;
+    };
+
+    // Record::flags
+    static const UINT32 DELETED = 1;
+    // The number of distinct trigrams.
+    static const UINT32 GRAMS = 16 * 16 * 16;
+
+    // Map the segment at path.  Open it writable to be able to
+    // markDeleted.  Returns 0 if it cannot be read or is not a segment
+    // this version understands.
+    static DigitIndexSegment *open(const std::string &path, bool writable=false);
+    ~DigitIndexSegment();
+
+    const std::string &fileName() const
+    {
+        return fileName_;
+    }
+    UINT32 recordings() const
+    {
+        return header->recordings;
+    }
+    const Record &record(UINT32 index) const
+    {
+        return records[index];
+    }
+    std::string path(UINT32 index) const
+    {
+        return std::string(paths + records[index].pathOffset, records[index].pathLength);
+    }
+    // The events of recording index (Record::events of them).
+    const uint64_t *events(UINT32 index) const
+    {
+        return events_ + records[index].firstEvent;
+    }
+    static uint64_t eventSample(uint64_t event)
+    {
+        return event >> 8;
+    }
+    static char eventDigit(uint64_t event)
+    {
+        return static_cast<char>(event & 0xff);
+    }
+    bool deleted(UINT32 index) const
+    {
+        return (records[index].flags & DELETED) != 0;
+    }
+    // Flag recording index as superseded by a later segment.  Visible
+    // through every mapping of the segment straight away.
+    bool markDeleted(UINT32 index);
+
+    // The first recording modified at or after mtime.
+    UINT32 lowerBound(int64_t mtime) const;
+    // Append the recordings in [begin, end) containing trigram gram to out.
+    void postings(UINT32 gram, UINT32 begin, UINT32 end, std::vector<UINT32> &out) const;
+    // The encoded size of the postings of gram, to order the lists of a
+    // query by.
+    uint64_t postingBytes(UINT32 gram) const
+    {
+        return grams[gram + 1] - grams[gram];
+    }
+
+    // The position of push button digit in "0123456789*#ABCD", or -1.
+    static int symbol(char digit);
+
+private:
+    std::string fileName_;
+    int fd;
+    void *mapping;
+    size_t mappingBytes;
+    const Header *header;
+    const Record *records;
+    const uint64_t *events_;
+    const uint64_t *grams;
+    const char *paths;
+    const unsigned char *postingData;
+
+    DigitIndexSegment();
+
+    // Not copyable
+    DigitIndexSegment(const DigitIndexSegment &);
+    DigitIndexSegment &operator=(const DigitIndexSegment &);
+};
+
+// Collects recordings and writes them out as a segment.
+class DigitIndexWriter
+{
+    struct Entry
+    {
+        std::string path;
+        int64_t mtime;
+        uint64_t size;
+        uint64_t samples;
+        std::vector<uint64_t> events;
+    };
+    std::vector<Entry> entries;
+public:
+    // events as in DigitIndexSegment::events, in order.
+    void add(const std::string &path, int64_t mtime, uint64_t size, uint64_t samples,
+             const std::vector<uint64_t> &events);
+    // Copy recording index of segment.
+    void add(const DigitIndexSegment &segment, UINT32 index);
+    UINT32 recordings() const
+    {
+        return entries.size();
+    }
+    // Write the segment to path, through a temporary file renamed into
+    // place, so that readers never see part of it.  Returns false, with
+    // errno set, on failure.
+    bool write(const std::string &path);
+};
+
+// A match of a query: where the pattern starts in a recording.
+struct DigitIndexMatch
+{
+    const DigitIndexSegment *segment;
+    UINT32 record;
+    // The first matching event of the recording.
+    UINT32 event;
+};
+
+// All the segments of an index directory.
+class DigitIndex
+{
+    std::string directory;
+    std::vector<DigitIndexSegment *> segments_;
+public:
+    DigitIndex()
+    {
+    }
+    ~DigitIndex();
+
+    // Open the segments in directory.  Segments that cannot be read are
+    // skipped.  Returns false if the directory cannot be listed.
+    bool open(const std::string &directory_, bool writable=false);
+
+    const std::vector<DigitIndexSegment *> &segments() const
+    {
+        return segments_;
+    }
+    // The name of a new segment, after all the existing ones.
+    std::string nextSegmentPath() const;
+
+    // Find every occurrence of pattern, a string of push buttons in which
+    // '?' stands for any one, in the live recordings modified in [from,
+    // to), spanning at most maxSpan samples from the start of its first
+    // push button to the start of its last (0 for any span).  Returns the
+    // number of recordings searched, or -1 if pattern is not valid.
+    long search(const std::string &pattern, int64_t from, int64_t to, uint64_t maxSpan,
+                std::vector<DigitIndexMatch> &matches) const;
+
+private:
+    // Not copyable
+    DigitIndex(const DigitIndex &);
+    DigitIndex &operator=(const DigitIndex &);
+};
+
+#endif
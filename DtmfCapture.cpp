@@ -0,0 +1,269 @@
+//
+// Per-channel capture rings, and the arena they live in.
+//
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "AuFile.hpp"
+#include "DtmfCapture.hpp"
+#include "DtmfDetector.hpp"
+
+static const UINT32 RATE = 8000;
+static const UINT32 SAMPLES = DtmfDetector::batchSamples();
+
+DtmfCapture::DtmfCapture()
+    : samples(0), capacity(0), decisions(0), decisionCapacity(0), channel_(0), start(0),
+      written(0), writing(0), decided(0), inUse(false)
+{
+}
+
+void DtmfCapture::begin(uint64_t position, UINT32 channel)
+{
+    channel_ = channel;
+    start = position;
+    written.store(position, std::memory_order_release);
+    writing.store(position, std::memory_order_release);
+    // The batch under way at position is the next one decided.
+    decided.store(position / SAMPLES, std::memory_order_release);
+}
+
+void DtmfCapture::copySamples(INT16 out[], const INT16 in[], UINT32 count)
+{
+    memcpy(out, in, count * sizeof(INT16));
+}
+
+void DtmfCapture::decision(uint64_t sample, char button)
+{
+    uint64_t batch = sample / SAMPLES;
+    decisions[batch % decisionCapacity] = button;
+    decided.store(batch + 1, std::memory_order_release);
+}
+
+bool DtmfCapture::dump(const char *path) const
+{
+    // Copy the rings, then drop whatever may have been overwritten while
+    // we were at it: the detection thread does not wait for us.
+    uint64_t end = written.load(std::memory_order_acquire);
+    uint64_t batchEnd = decided.load(std::memory_order_acquire);
+    std::vector<INT16> ring(samples, samples + capacity);
+    std::string ringDecisions(decisions, decisionCapacity);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t overwritten = writing.load(std::memory_order_relaxed);
+    // The decision after the last one published may be half way in.
+    uint64_t batchOverwritten = decided.load(std::memory_order_relaxed) + 1;
+
+    uint64_t first = end > start + capacity ? end - capacity : start;
+    if(overwritten > first + capacity)
+        first = overwritten - capacity;
+    if(first > end)
+        first = end;
+    uint64_t batch = start / SAMPLES;
+    if(batchOverwritten > batch + decisionCapacity)
+        batch = batchOverwritten - decisionCapacity;
+    // Only the batches that overlap the samples kept.
+    if(batch < first / SAMPLES)
+        batch = first / SAMPLES;
+    if(batch > batchEnd)
+        batch = batchEnd;
+
+    char text[128];
+    snprintf(text, sizeof(text), "channel=%u sample=%llu batch=%u first=%llu decisions=",
+             channel_, (unsigned long long)first, SAMPLES, (unsigned long long)(batch * SAMPLES));
+    std::string annotation = text;
+    for(uint64_t b = batch; b < batchEnd; b++)
+        annotation += ringDecisions[b % decisionCapacity];
+    // NUL-terminated, and padded so that the audio is aligned.
+    annotation.resize((annotation.size() + 8) & ~(size_t)7, 0);
+
+    UINT32 count = static_cast<UINT32>(end - first);
+    AuHeader header;
+    header.magic = AU_MAGIC;
+    header.header_size = sizeof(AuHeader) + annotation.size();
+    header.nsamples = count * sizeof(INT16);
+    header.encoding = AU_ENCODING_PCM16;
+    header.sample_rate = RATE;
+    header.nchannels = 1;
+    std::vector<unsigned char> out(header.header_size + header.nsamples);
+    encodeAuHeader(header, &out[0]);
+    memcpy(&out[sizeof(AuHeader)], annotation.data(), annotation.size());
+    unsigned char *audio = &out[header.header_size];
+    for(UINT32 ii = 0; ii < count; ii++)
+    {
+        INT16 sample = ring[(first + ii) % capacity];
+        audio[2 * ii] = static_cast<UINT16>(sample) >> 8;
+        audio[2 * ii + 1] = static_cast<unsigned char>(sample);
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    size_t done = 0;
+    while(done < out.size())
+    {
+        ssize_t n = write(fd, &out[done], out.size() - done);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return false;
+        }
+        done += n;
+    }
+    return close(fd) == 0;
+}
+
+// Each capture takes a slot of the slab: the object, its samples and its
+// decisions, each starting on a cache line of its own.
+static size_t roundUp(size_t bytes)
+{
+    return (bytes + DTMF_CACHE_LINE - 1) & ~(size_t)(DTMF_CACHE_LINE - 1);
+}
+
+static UINT32 decisionsFor(UINT32 seconds)
+{
+    // One more than fit, for the batch that straddles the oldest sample.
+    return seconds * RATE / SAMPLES + 2;
+}
+
+static size_t slotBytes(UINT32 seconds)
+{
+    return roundUp(sizeof(DtmfCapture)) + roundUp(seconds * RATE * sizeof(INT16))
+        + roundUp(decisionsFor(seconds));
+}
+
+size_t DtmfCaptureArena::bytesFor(UINT32 channels, UINT32 seconds)
+{
+    return slotBytes(seconds) * channels;
+}
+
+DtmfCaptureArena::DtmfCaptureArena(UINT32 channels, UINT32 seconds)
+    : slab(0), slabBytes(0), stride(slotBytes(seconds)), freeList(0),
+      freeCount(0), capacity_(channels)
+{
+    assert(seconds > 0);
+    slabBytes = bytesFor(channels, seconds);
+    if(slabBytes == 0)
+        slabBytes = 1;
+    // As for DtmfDetectorPool, the kernel only hands out the pages as they
+    // get touched.
+    void *mem = mmap(0, slabBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+        throw std::bad_alloc();
+    slab = static_cast<char *>(mem);
+
+    freeList = new UINT32 [channels];
+    for(UINT32 ii = 0; ii < channels; ii++)
+    {
+        char *slot = slab + ii * stride;
+        DtmfCapture *capture = new (slot) DtmfCapture();
+        capture->samples = reinterpret_cast<INT16 *>(slot + roundUp(sizeof(DtmfCapture)));
+        capture->capacity = seconds * RATE;
+        capture->decisions = slot + roundUp(sizeof(DtmfCapture)) + roundUp(seconds * RATE * sizeof(INT16));
+        capture->decisionCapacity = decisionsFor(seconds);
+        freeList[ii] = channels - ii - 1;
+    }
+    freeCount = channels;
+}
+
+DtmfCaptureArena::~DtmfCaptureArena()
+{
+    for(UINT32 ii = 0; ii < capacity_; ii++)
+        reinterpret_cast<DtmfCapture *>(slab + ii * stride)->~DtmfCapture();
+    munmap(slab, slabBytes);
+    delete [] freeList;
+}
+
+DtmfCapture *DtmfCaptureArena::acquire()
+{
+    if(freeCount == 0)
+        return 0;
+    DtmfCapture *capture = reinterpret_cast<DtmfCapture *>(slab + freeList[--freeCount] * stride);
+    capture->begin(0, 0);
+    capture->inUse.store(true, std::memory_order_release);
+    return capture;
+}
+
+void DtmfCaptureArena::release(DtmfCapture *capture)
+{
+    size_t offset = reinterpret_cast<char *>(capture) - slab;
+    assert(offset % stride == 0 && offset / stride < capacity_);
+    assert(freeCount < capacity_);
+    capture->inUse.store(false, std::memory_order_release);
+    freeList[freeCount++] = static_cast<UINT32>(offset / stride);
+}
+
+UINT32 DtmfCaptureArena::dumpAll(const char *directory) const
+{
+    UINT32 dumped = 0;
+    time_t now = time(0);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char when[32];
+    strftime(when, sizeof(when), "%Y%m%dT%H%M%S", &tm);
+    for(UINT32 ii = 0; ii < capacity_; ii++)
+    {
+        const DtmfCapture *capture = reinterpret_cast<const DtmfCapture *>(slab + ii * stride);
+        if(!capture->inUse.load(std::memory_order_acquire))
+            continue;
+        // The slot keeps the name unique when channels are numbered
+        // per bank.
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/capture-%s-%u-%u.au", directory, when, capture->channel(), ii);
+        if(capture->dump(path))
+            dumped++;
+    }
+    return dumped;
+}
+
+// As for DtmfProfile, the signal handler only writes to a pipe; a thread
+// waiting on the other end does the dumping.
+static const DtmfCaptureArena *signalArena = 0;
+static std::string signalDirectory;
+static int signalPipe[2] = {-1, -1};
+
+static void onSignal(int)
+{
+    char byte = 0;
+    ssize_t ignored = write(signalPipe[1], &byte, 1);
+    (void)ignored;
+}
+
+static void dumpOnSignals()
+{
+    char byte;
+    while(read(signalPipe[0], &byte, 1) == 1)
+    {
+        UINT32 dumped = signalArena->dumpAll(signalDirectory.c_str());
+        fprintf(stderr, "dtmf capture: %u channels dumped to %s\n", dumped, signalDirectory.c_str());
+    }
+}
+
+bool DtmfCaptureArena::dumpOnSignal(int signal, const char *directory)
+{
+    if(signalArena)
+        return false;
+    if(pipe(signalPipe) != 0)
+        return false;
+    signalArena = this;
+    signalDirectory = directory;
+    std::thread(dumpOnSignals).detach();
+    struct sigaction action = {};
+    action.sa_handler = onSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(signal, &action, 0) == 0;
+}
@@ -0,0 +1,138 @@
+#ifndef DTMF_CAPTURE
+#define DTMF_CAPTURE
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int16     INT16;
+
+// The last few seconds of a channel's audio, and the detector's decision
+// on each batch of it, kept so that a missed or phantom push button can be
+// replayed after the fact (see DtmfDetector::setCapture).
+//
+// Recording is a copy of the input into a ring and a byte per batch, so it
+// can stay on for every channel.  The captures live in a
+// DtmfCaptureArena.  A capture is written by the detection thread only,
+// and can be dumped from any thread while it is being written.
+class DtmfCapture
+{
+    friend class DtmfCaptureArena;
+
+    INT16 *samples;
+    UINT32 capacity;
+    // The decision on batch b is at decisions[b % decisionCapacity].
+    char *decisions;
+    UINT32 decisionCapacity;
+    UINT32 channel_;
+    // The position in the channel's audio (as DtmfDetector counts it) of
+    // the first sample recorded, of the end of the samples recorded, and
+    // the number of the batch after the last one decided.  writing is the
+    // end of the samples being recorded, so that a dump knows which it may
+    // have caught half written.
+    uint64_t start;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> writing;
+    std::atomic<uint64_t> decided;
+    // Whether the capture is acquired from its arena.
+    std::atomic<bool> inUse;
+
+    DtmfCapture();
+
+    // Not copyable
+    DtmfCapture(const DtmfCapture &);
+    DtmfCapture &operator=(const DtmfCapture &);
+public:
+    // Start over at position (in samples) of channel's audio.
+    void begin(uint64_t position, UINT32 channel);
+    // Append count samples.
+    void record(const INT16 in[], UINT32 count)
+    {
+        uint64_t w = written.load(std::memory_order_relaxed);
+        UINT32 at = static_cast<UINT32>(w % capacity);
+        if(count > capacity)
+        {
+            in += count - capacity;
+            w += count - capacity;
+            at = static_cast<UINT32>(w % capacity);
+            count = capacity;
+        }
+        UINT32 first = count < capacity - at ? count : capacity - at;
+        writing.store(w + count, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        copySamples(samples + at, in, first);
+        copySamples(samples, in + first, count - first);
+        written.store(w + count, std::memory_order_release);
+    }
+    // The decision on the batch at position sample: a push button, or ' '.
+    void decision(uint64_t sample, char button);
+
+    UINT32 channel() const
+    {
+        return channel_;
+    }
+    // The most samples kept.
+    UINT32 capacitySamples() const
+    {
+        return capacity;
+    }
+
+    // Write what is kept to path as a 16-bit PCM AU file.  The decisions
+    // go in the header's annotation, as text: the position of the first
+    // sample, then one character per batch.  Returns false, with errno
+    // set, on failure.
+    bool dump(const char *path) const;
+
+private:
+    static void copySamples(INT16 out[], const INT16 in[], UINT32 count);
+};
+
+// The captures of a whole fleet of channels, in one allocation made up
+// front, so that recording never touches the heap and the memory it takes
+// is known from the start: bytesFor(channels, seconds).
+//
+// Like DtmfDetectorPool, acquire and release are not thread-safe.
+class DtmfCaptureArena
+{
+    char *slab;
+    size_t slabBytes;
+    // The bytes of each capture's slot in slab.
+    size_t stride;
+    UINT32 *freeList;
+    UINT32 freeCount;
+    UINT32 capacity_;
+
+    // Not copyable
+    DtmfCaptureArena(const DtmfCaptureArena &);
+    DtmfCaptureArena &operator=(const DtmfCaptureArena &);
+public:
+    // Room for channels captures of seconds of audio each.
+    DtmfCaptureArena(UINT32 channels, UINT32 seconds);
+    ~DtmfCaptureArena();
+
+    // The bytes an arena of channels captures of seconds each takes.
+    static size_t bytesFor(UINT32 channels, UINT32 seconds);
+
+    // Returns 0 if all the captures are in use.
+    DtmfCapture *acquire();
+    void release(DtmfCapture *capture);
+
+    UINT32 capacity() const
+    {
+        return capacity_;
+    }
+
+    // Dump every capture in use into directory, as
+    // capture-<time>-<channel>-<slot>.au.  Returns the number written.
+    UINT32 dumpAll(const char *directory) const;
+    // Dump every capture in use into directory whenever the process gets
+    // signal (e.g. SIGUSR2).  The handler only wakes a thread, which does
+    // the writing.  One arena per process can do this, and it must then
+    // live as long as the process.
+    bool dumpOnSignal(int signal, const char *directory);
+};
+
+#endif
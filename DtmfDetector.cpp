@@ -6,77 +6,14 @@
  */
 
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
 #include "DtmfDetector.hpp"
-
-#if DEBUG
-#include <cstdio>
-#endif
-
-// This is the same function as in DtmfGenerator.cpp
-static inline INT32 MPY48SR(INT16 o16, INT32 o32)
-{
-    UINT32   Temp0;
-    INT32    Temp1;
-    Temp0 = (((UINT16)o32 * o16) + 0x4000) >> 15;
-    Temp1 = (INT16)(o32 >> 16) * o16;
-    return (Temp1 << 1) + Temp0;
-}
-
-// The Goertzel algorithm.
-// For a good description and walkthrough, see:
-// https://sites.google.com/site/hobbydebraj/home/goertzel-algorithm-dtmf-detection
-//
-// Koeff0           Coefficient for the first frequency.
-// Koeff1           Coefficient for the second frequency.
-// arraySamples     Input samples to process.  Must be COUNT elements long.
-// Magnitude0       Detected magnitude of the first frequency.
-// Magnitude1       Detected magnitude of the second frequency.
-// COUNT            The number of elements in arraySamples.  Always equal to
-//                  SAMPLES in practice.
-static void goertzel_filter(INT16 Koeff0, INT16 Koeff1, const INT16 arraySamples[], INT32 *Magnitude0, INT32 *Magnitude1, UINT32 COUNT)
-{
-    INT32 Temp0, Temp1;
-    UINT16 ii;
-    // Vk1_0    prev (first frequency)
-    // Vk2_0    prev_prev (first frequency)
-    //
-    // Vk1_1    prev (second frequency)
-    // Vk2_0    prev_prev (second frequency)
-    INT32 Vk1_0 = 0, Vk2_0 = 0, Vk1_1 = 0, Vk2_1 = 0;
-
-    // Iterate over all the input samples
-    // For each sample, process the two frequencies we're interested in:
-    // output = Input + 2*coeff*prev - prev_prev
-    // N.B. bit-shifting to the left achieves the multiplication by 2.
-    for(ii = 0; ii < COUNT; ++ii)
-    {
-        Temp0 = MPY48SR(Koeff0, Vk1_0 << 1) - Vk2_0 + arraySamples[ii],
-        Temp1 = MPY48SR(Koeff1, Vk1_1 << 1) - Vk2_1 + arraySamples[ii];
-        Vk2_0 = Vk1_0,
-        Vk2_1 = Vk1_1;
-        Vk1_0 = Temp0,
-        Vk1_1 = Temp1;
-    }
-
-    // Magnitude: prev_prev**prev_prev + prev*prev - coeff*prev*prev_prev
-
-    // TODO: what does shifting by 10 bits to the right achieve?  Probably to
-    // make room for the magnitude calculations.
-    Vk1_0 >>= 10,
-              Vk1_1 >>= 10,
-                        Vk2_0 >>= 10,
-                                  Vk2_1 >>= 10;
-    Temp0 = MPY48SR(Koeff0, Vk1_0 << 1),
-    Temp1 = MPY48SR(Koeff1, Vk1_1 << 1);
-    Temp0 = (INT16)Temp0 * (INT16)Vk2_0,
-    Temp1 = (INT16)Temp1 * (INT16)Vk2_1;
-    Temp0 = (INT16)Vk1_0 * (INT16)Vk1_0 + (INT16)Vk2_0 * (INT16)Vk2_0 - Temp0;
-    Temp1 = (INT16)Vk1_1 * (INT16)Vk1_1 + (INT16)Vk2_1 * (INT16)Vk2_1 - Temp1;
-    *Magnitude0 = Temp0,
-     *Magnitude1 = Temp1;
-    return;
-}
-
+#include "DtmfProfile.hpp"
+#include "DtmfState.hpp"
+#include "DtmfWorkerPool.hpp"
+#include "Goertzel.hpp"
 
 // This is a GSM function, for concrete processors she may be replaced
 // for same processor's optimized function (norm_l)
@@ -180,126 +117,573 @@ const INT16 DtmfDetector::CONSTANTS[COEFF_NUMBER] = {
     -22811, // 2980Hz, which is 2*1490Hz
     -30555  // 3529Hz, 3*1176Hz, 5*706Hz
 };
-INT32 DtmfDetector::powerThreshold = 328;
-INT32 DtmfDetector::dialTonesToOhersTones = 16;
-INT32 DtmfDetector::dialTonesToOhersDialTones = 6;
-const INT32 DtmfDetector::SAMPLES = 102;
+const INT32 DtmfDetector::SAMPLES;
+
+
+// The frequencies of the DTMF tones.
+static const double DTMF_FREQUENCIES[8] = { 697, 770, 852, 941, 1209, 1336, 1477, 1633 };
+
+const float *DtmfDetector::toneGains()
+{
+    // The bins are off by up to 33Hz, which is close to 3dB at 1209Hz.
+    struct Gains
+    {
+        float gains[8];
+        Gains()
+        {
+            for(unsigned ii = 0; ii < 8; ii++)
+            {
+                double bin = acos(CONSTANTS[ii] / 32768.0) / (2 * M_PI);
+                double offset = M_PI * (DTMF_FREQUENCIES[ii] / 8000 - bin);
+                double gain = sin(offset * SAMPLES) / (SAMPLES * sin(offset));
+                gains[ii] = static_cast<float>(gain * gain);
+            }
+        }
+    };
+    static const Gains gains;
+    return gains.gains;
+}
+const unsigned DtmfDetector::MF_FREQUENCIES;
+const INT16 DtmfDetector::MF_CONSTANTS[3][MF_FREQUENCIES] = {
+    // MF R1: 700, 900, 1100, 1300, 1500 and 1700Hz
+    { 27939, 24917, 21281, 17121, 12540, 7650 },
+    // MF R2 forward: 1380, 1500, 1620, 1740, 1860 and 1980Hz
+    { 15333, 12540, 9635, 6645, 3596, 515 },
+    // MF R2 backward: 1140, 1020, 900, 780, 660 and 540Hz
+    { 20488, 22804, 24917, 26809, 28463, 29865 }
+};
+// The number (1 to 15) of the signal made of frequencies i < j is
+// MF_PAIRS[i][j].  This is the R2 numbering; R1 digits follow it too.
+const unsigned char DtmfDetector::MF_PAIRS[MF_FREQUENCIES][MF_FREQUENCIES] = {
+    { 0, 1, 2, 4, 7, 11 },
+    { 0, 0, 3, 5, 8, 12 },
+    { 0, 0, 0, 6, 9, 13 },
+    { 0, 0, 0, 0, 10, 14 },
+    { 0, 0, 0, 0, 0, 15 },
+    { 0, 0, 0, 0, 0, 0 }
+};
+// How each signal number is reported.  For R1, 10 is the digit 0, KP is
+// 'K', ST is 'S', and ST', ST'' and ST''' are 'A', 'B' and 'C'.  R2
+// signals are reported as their number in hex.
+const char DtmfDetector::MF_SIGNALS[3][16] = {
+    { ' ', '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', 'C', 'A', 'K', 'B', 'S' },
+    { ' ', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' },
+    { ' ', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' }
+};
+// The push button of each row (0 to 3) and column (4 to 7) frequency.
+static const char BUTTONS[4][4] = {
+    { '1', '2', '3', 'A' },
+    { '4', '5', '6', 'B' },
+    { '7', '8', '9', 'C' },
+    { '*', '0', '#', 'D' }
+};
+
+// Whether a / b < threshold, with a / b truncated as C++ divides integers,
+// but without the division: the quotient is below the threshold exactly
+// when a is below threshold * b (or, for a negative quotient, at most
+// (threshold - 1) * b, since it is rounded up).  The products are taken
+// in 64 bits, so they cannot overflow.  b must not be 0.
+static inline bool quotientBelow(INT32 a, INT32 b, INT32 threshold)
+{
+    int64_t n = b < 0 ? -static_cast<int64_t>(a) : a;
+    int64_t d = b < 0 ? -static_cast<int64_t>(b) : b;
+    return n < threshold * d - (n < 0 ? d - 1 : 0);
+}
+
+// Keep the per-channel state small enough for 100k+ channels to stay cheap.
+static_assert(sizeof(DtmfDetector) <= 512, "DtmfDetector state too large");
 //--------------------------------------------------------------------
-DtmfDetector::DtmfDetector(INT32 frameSize_): frameSize(frameSize_)
+DtmfDetector::Scratch &DtmfDetector::threadScratch()
+{
+    static thread_local Scratch scratch;
+    return scratch;
+}
+DtmfDetector::LaneScratch &DtmfDetector::threadLaneScratch()
+{
+    static thread_local LaneScratch lanes;
+    return lanes;
+}
+//--------------------------------------------------------------------
+DtmfDetector::DtmfDetector(INT32 frameSize_)
+{
+    reset(frameSize_);
+}
+//---------------------------------------------------------------------
+DtmfDetector::~DtmfDetector()
+{
+}
+//---------------------------------------------------------------------
+void DtmfDetector::reset()
 {
-    // 
-    // This array is padded to keep the last batch, which is smaller
-    // than SAMPLES, from the previous call to dtmfDetecting.
-    //
-    pArraySamples = new INT16 [frameSize + SAMPLES];
-    internalArray = new INT16 [SAMPLES];
     frameCount = 0;
     prevDialButton = ' ';
     permissionFlag = 0;
+    indexForDialButtons = 0;
+    dialButtons[0] = 0;
+    sampleCount = 0;
+    eventSink = 0;
+    channel = 0;
+    traceSink = 0;
+    callProgress = 0;
+    capture = 0;
+    toneMeter = 0;
+    mode = MODE_DTMF;
+    configPublisher = &DtmfConfigPublisher::defaults();
 }
-//---------------------------------------------------------------------
-DtmfDetector::~DtmfDetector()
+
+void DtmfDetector::reset(INT32 frameSize_)
+{
+    frameSize = frameSize_;
+    reset();
+}
+
+// The snapshot format: "DS", a version, then the fields in the order
+// below.  Bump the version whenever it changes.
+static const unsigned char DETECTOR_STATE_VERSION = 1;
+const UINT32 DtmfDetector::STATE_BYTES;
+
+UINT32 DtmfDetector::saveState(unsigned char state[], UINT32 size) const
 {
-    delete [] pArraySamples;
-    delete [] internalArray;
+    DtmfStateWriter out(state, size);
+    out.put('D', 1);
+    out.put('S', 1);
+    out.put(DETECTOR_STATE_VERSION, 1);
+    out.put(frameSize, 4);
+    out.put(mode, 1);
+    out.put(static_cast<unsigned char>(prevDialButton), 1);
+    out.put(permissionFlag, 1);
+    out.put(sampleCount, 8);
+    // The dial buttons array: the index and the string, which may be
+    // longer (see zerosIndexDialButton).
+    UINT32 length = strlen(dialButtons);
+    out.put(indexForDialButtons, 1);
+    out.put(length, 1);
+    for(UINT32 ii = 0; ii < length; ii++)
+        out.put(static_cast<unsigned char>(dialButtons[ii]), 1);
+    out.put(frameCount, 1);
+    for(INT32 ii = 0; ii < frameCount; ii++)
+        out.put(static_cast<UINT16>(arraySamples[ii]), 2);
+    return out.finish();
+}
+
+bool DtmfDetector::restoreState(const unsigned char state[], UINT32 size)
+{
+    DtmfStateReader in(state, size);
+    if(in.get(1) != 'D' || in.get(1) != 'S' || in.get(1) != DETECTOR_STATE_VERSION)
+        return false;
+    INT32 frameSize_ = static_cast<INT32>(in.getSigned(4));
+    unsigned char mode_ = in.get(1);
+    char prevDialButton_ = static_cast<char>(in.get(1));
+    char permissionFlag_ = static_cast<char>(in.get(1));
+    uint64_t sampleCount_ = in.get(8);
+    INT16 index = in.get(1);
+    UINT32 length = in.get(1);
+    // A frame size of 0 is valid: the caller passes a count with each call
+    // (as the C interface does).
+    if(frameSize_ < 0 || mode_ > MODE_MF_R2_BACKWARD || index > 64 || length > 64)
+        return false;
+    char buttons[NUMBER_OF_BUTTONS];
+    for(UINT32 ii = 0; ii < length; ii++)
+        buttons[ii] = static_cast<char>(in.get(1));
+    buttons[length] = 0;
+    INT32 count = in.get(1);
+    if(count >= SAMPLES)
+        return false;
+    INT16 samples[SAMPLES];
+    for(INT32 ii = 0; ii < count; ii++)
+        samples[ii] = static_cast<INT16>(in.getSigned(2));
+    if(!in.finish())
+        return false;
+
+    frameSize = frameSize_;
+    mode = mode_;
+    prevDialButton = prevDialButton_;
+    permissionFlag = permissionFlag_;
+    sampleCount = sampleCount_;
+    indexForDialButtons = index;
+    memcpy(dialButtons, buttons, length + 1);
+    frameCount = count;
+    memcpy(arraySamples, samples, count * sizeof(INT16));
+    return true;
 }
 
 void DtmfDetector::dtmfDetecting(INT16 input_array[])
+{
+    if(capture)
+        capture->record(input_array, frameSize);
+    consume(input_array, frameSize);
+}
+
+void DtmfDetector::setCapture(DtmfCapture *capture_)
+{
+    capture = capture_;
+    if(capture)
+        capture->begin(sampleCount + frameCount, channel);
+}
+
+void DtmfDetector::consume(const INT16 input_array[], UINT32 count)
 {
     // ii                   Variable for iteration
+    // temp_index           Read index into input_array that corresponds to
+    //                      the current batch.
     // temp_dial_button     A tone detected in part of the input_array
     UINT32 ii;
+    UINT32 temp_index = 0;
     char temp_dial_button;
+    Scratch &scratch = threadScratch();
+    // Load the configuration once, so that the whole call sees the same
+    // thresholds even if a new configuration gets published meanwhile.
+    const DtmfDetectorConfig &config = *configPublisher->get();
+    DTMF_PROFILE_SCOPE(DTMF_STAGE_CALL);
+    DTMF_PROFILE_MARK();
+
+    // arraySamples holds the last batch from the previous call to this
+    // function.  Top it up from the input first.  Full batches are then
+    // processed straight out of input_array, without copying them.
+    if(frameCount > 0)
+    {
+        temp_index = SAMPLES - frameCount;
+        if(temp_index > count)
+            temp_index = count;
+        for(ii = 0; ii < temp_index; ii++)
+        {
+            arraySamples[frameCount + ii] = input_array[ii];
+        }
+        frameCount += temp_index;
+        DTMF_PROFILE_LAP(DTMF_STAGE_COPY);
+        // If don't have enough samples to process an entire batch, then
+        // don't do anything.
+        if(frameCount < SAMPLES)
+            return;
+    }
+
+    // Process samples while we still have enough for an entire
+    // batch.
+    while(frameCount == SAMPLES || count - temp_index >= SAMPLES)
+    {
+        // With enough batches at hand, filter LANES of them at once, then
+        // classify and register them one by one as usual.
+        if(frameCount != SAMPLES && mode == MODE_DTMF && count - temp_index >= LANES * SAMPLES)
+        {
+            LaneScratch &lanes = threadLaneScratch();
+            filterLanes(&input_array[temp_index], config, scratch, lanes);
+            temp_index += LANES * SAMPLES;
+            for(unsigned lane = 0; lane < LANES; lane++)
+                registerLane(lanes, lane, config, scratch);
+            continue;
+        }
+
+        const INT16 *batch;
+        if(frameCount == SAMPLES)
+        {
+            batch = arraySamples;
+            frameCount = 0;
+        }
+        else
+        {
+            batch = &input_array[temp_index];
+            temp_index += SAMPLES;
+        }
+
+        // Determine the tone present in the current batch
+        if(mode == MODE_DTMF)
+            temp_dial_button = DTMF_detection(batch, config, scratch);
+        else
+            temp_dial_button = MF_detection(batch, config, scratch);
+        registerBatch(temp_dial_button, scratch);
+        DTMF_PROFILE_LAP(DTMF_STAGE_REGISTER);
+    }
+
+    //
+    // We have some samples left to process, but it's not enough for an
+    // entire batch.  Keep these left-over samples and deal with them
+    // next time this function is called.
+    //
+    frameCount = count - temp_index;
+    for(ii = 0; ii < (UINT32)frameCount; ii++)
+    {
+        arraySamples[ii] = input_array[ii + temp_index];
+    }
+    DTMF_PROFILE_LAP(DTMF_STAGE_LEFTOVER);
+}
+
+void DtmfDetector::registerLane(const LaneScratch &lanes, unsigned lane, const DtmfDetectorConfig &config, Scratch &scratch)
+{
+    UINT32 ii;
+    if(lanes.silent[lane])
+    {
+        scratch.row = scratch.column = -1;
+        scratch.reason = DTMF_REJECT_SILENCE;
+        registerBatch(' ', scratch);
+        DTMF_PROFILE_LAP(DTMF_STAGE_REGISTER);
+        return;
+    }
+    for(ii = 0; ii < COEFF_NUMBER; ii++)
+        scratch.T[ii] = lanes.T[ii][lane];
+    scratch.shift = lanes.shift[lane];
+    // The call progress detector wants the normalized batch.
+    if(callProgress)
+        for(ii = 0; ii < (UINT32)SAMPLES; ii++)
+            scratch.internalArray[ii] = lanes.samples[ii][lane];
+    char temp_dial_button = classifyBatch(config, scratch);
+    DTMF_PROFILE_LAP(DTMF_STAGE_CLASSIFY);
+    registerBatch(temp_dial_button, scratch);
+    DTMF_PROFILE_LAP(DTMF_STAGE_REGISTER);
+}
 
-    // Copy the input array into the middle of pArraySamples.
-    // I think the first frameCount samples contain the last batch from the
-    // previous call to this function.
-    for(ii=0; ii < frameSize; ii++)
+void DtmfDetector::dtmfDetecting(const INT16 input_array[], UINT32 count, DtmfWorkerPool &pool)
+{
+    if(capture)
+        capture->record(input_array, count);
+    if(traceSink || callProgress || toneMeter || pool.size() < 2)
     {
-        pArraySamples[ii + frameCount] = input_array[ii];
+        consume(input_array, count);
+        return;
     }
+    Scratch &scratch = threadScratch();
+    const DtmfDetectorConfig &config = *configPublisher->get();
 
-    frameCount += frameSize;
-    // Read index into pArraySamples that corresponds to the current batch.
+    // Complete the batch left over from the previous call first.
     UINT32 temp_index = 0;
-    // If don't have enough samples to process an entire batch, then don't
-    // do anything.
-    if(frameCount >= SAMPLES)
+    if(frameCount > 0)
     {
-        // Process samples while we still have enough for an entire
-        // batch.
-        while(frameCount >= SAMPLES)
+        temp_index = SAMPLES - frameCount;
+        if(temp_index > count)
+            temp_index = count;
+        consume(input_array, temp_index);
+    }
+
+    // Decide the full batches in parallel, then register the decisions in
+    // order.  This is the only state that crosses from a batch to the next.
+    UINT32 batches = (count - temp_index) / SAMPLES;
+    if(batches > 0)
+    {
+        static thread_local std::vector<char> decisions;
+        decisions.resize(batches);
+        {
+            DTMF_PROFILE_SCOPE(DTMF_STAGE_PARALLEL);
+            pool.classify(*this, &input_array[temp_index], batches, config, &decisions[0]);
+        }
+        DTMF_PROFILE_MARK();
+        for(UINT32 ii = 0; ii < batches; ii++)
         {
-            // Determine the tone present in the current batch
-            temp_dial_button = DTMF_detection(&pArraySamples[temp_index]);
-
-            // Determine if we should register it as a new tone, or
-            // ignore it as a continuation of a previously 
-            // registered tone.  
-            //
-            // This seems buggy.  Consider a sequence of three
-            // tones, with each tone corresponding to the dominant
-            // tone in a batch of SAMPLES samples:
-            //
-            // SILENCE TONE_A TONE_B will get registered as TONE_B
-            //
-            // TONE_A will be ignored.
-            if(permissionFlag)
+            registerBatch(decisions[ii], scratch);
+            DTMF_PROFILE_LAP(DTMF_STAGE_REGISTER);
+        }
+        temp_index += batches * SAMPLES;
+    }
+
+    // Keep what is left for the next call.
+    consume(&input_array[temp_index], count - temp_index);
+}
+
+void DtmfDetector::classifyBatches(const INT16 samples[], UINT32 batches, const DtmfDetectorConfig &config, char decisions[]) const
+{
+    Scratch &scratch = threadScratch();
+    UINT32 batch = 0, ii;
+    DTMF_PROFILE_MARK();
+    if(mode == MODE_DTMF)
+    {
+        LaneScratch &lanes = threadLaneScratch();
+        for(; batch + LANES <= batches; batch += LANES)
+        {
+            filterLanes(&samples[batch * SAMPLES], config, scratch, lanes);
+            for(unsigned lane = 0; lane < LANES; lane++)
             {
-                if(temp_dial_button != ' ')
+                if(lanes.silent[lane])
                 {
-                    dialButtons[indexForDialButtons++] = temp_dial_button;
-                    // NUL-terminate the string.
-                    dialButtons[indexForDialButtons] = 0;
-                    // If we've gone out of bounds, wrap around.
-                    if(indexForDialButtons >= 64)
-                        indexForDialButtons = 0;
+                    decisions[batch + lane] = ' ';
+                    continue;
                 }
-                permissionFlag = 0;
+                for(ii = 0; ii < COEFF_NUMBER; ii++)
+                    scratch.T[ii] = lanes.T[ii][lane];
+                decisions[batch + lane] = classifyBatch(config, scratch);
+                DTMF_PROFILE_LAP(DTMF_STAGE_CLASSIFY);
             }
+        }
+    }
+    for(; batch < batches; batch++)
+    {
+        if(mode == MODE_DTMF)
+            decisions[batch] = DTMF_detection(&samples[batch * SAMPLES], config, scratch);
+        else
+            decisions[batch] = MF_detection(&samples[batch * SAMPLES], config, scratch);
+    }
+}
 
-            // If we've gone from silence to a tone, set the flag.
-            // The tone will be registered in the next iteration.
-            if((temp_dial_button != ' ') && (prevDialButton == ' '))
+void DtmfDetector::registerBatch(char temp_dial_button, Scratch &scratch)
+{
+    if(traceSink)
+        trace(temp_dial_button, scratch);
+    if(capture)
+        capture->decision(sampleCount, temp_dial_button);
+    if(toneMeter)
+        toneMeter->process(temp_dial_button, scratch.reason == DTMF_REJECT_SILENCE ? 0 : scratch.T,
+                           mode == MODE_DTMF ? COEFF_NUMBER : MF_FREQUENCIES, scratch.row, scratch.column,
+                           scratch.shift, mode == MODE_DTMF ? toneGains() : 0, sampleCount, channel);
+    // The call progress tones are looked for in the normalized batch.
+    if(callProgress)
+        callProgress->process(scratch.reason == DTMF_REJECT_SILENCE ? 0 : scratch.internalArray,
+                              SAMPLES, sampleCount, eventSink, channel);
+
+    // Determine if we should register it as a new tone, or
+    // ignore it as a continuation of a previously 
+    // registered tone.  
+    //
+    // This seems buggy.  Consider a sequence of three
+    // tones, with each tone corresponding to the dominant
+    // tone in a batch of SAMPLES samples:
+    //
+    // SILENCE TONE_A TONE_B will get registered as TONE_B
+    //
+    // TONE_A will be ignored.
+    if(permissionFlag)
+    {
+        if(temp_dial_button != ' ')
+        {
+            dialButtons[indexForDialButtons++] = temp_dial_button;
+            // NUL-terminate the string.
+            dialButtons[indexForDialButtons] = 0;
+            // If we've gone out of bounds, wrap around.
+            if(indexForDialButtons >= 64)
+                indexForDialButtons = 0;
+            // The tone started in the previous batch.
+            if(eventSink)
             {
-                permissionFlag = 1;
+                DtmfEvent event;
+                event.sample = sampleCount - SAMPLES;
+                event.channel = channel;
+                event.digit = temp_dial_button;
+                event.type = DTMF_EVENT_DIGIT;
+                eventSink->dtmfEvent(event);
             }
-
-            // Store the current tone.  In light of the above
-            // behaviour, all that really matters is whether it was
-            // a tone or silence.  Finally, move on to the next
-            // batch.
-            prevDialButton = temp_dial_button;
-
-            temp_index += SAMPLES;
-            frameCount -= SAMPLES;
         }
+        permissionFlag = 0;
+    }
 
-        //
-        // We have frameCount samples left to process, but it's not
-        // enough for an entire batch.  Shift these left-over
-        // samples to the beginning of our array and deal with them
-        // next time this function is called.
-        //
-        for(ii=0; ii < frameCount; ii++)
-        {
-            pArraySamples[ii] = pArraySamples[ii + temp_index];
-        }
+    // If we've gone from silence to a tone, set the flag.
+    // The tone will be registered in the next iteration.
+    if((temp_dial_button != ' ') && (prevDialButton == ' '))
+    {
+        permissionFlag = 1;
     }
 
+    // Store the current tone.  In light of the above
+    // behaviour, all that really matters is whether it was
+    // a tone or silence.  Finally, move on to the next
+    // batch.
+    prevDialButton = temp_dial_button;
+    sampleCount += SAMPLES;
+}
+
+void DtmfDetector::trace(char decision, const Scratch &scratch)
+{
+    DtmfTraceRecord record;
+    record.sample = sampleCount;
+    record.channel = channel;
+    // The magnitudes are not computed for silence.
+    if(scratch.reason == DTMF_REJECT_SILENCE)
+        memset(record.T, 0, sizeof(record.T));
+    else
+        memcpy(record.T, scratch.T, sizeof(record.T));
+    record.row = static_cast<signed char>(scratch.row);
+    record.column = static_cast<signed char>(scratch.column);
+    record.decision = decision;
+    record.reason = static_cast<unsigned char>(scratch.reason);
+    traceSink->dtmfTrace(record);
 }
 //-----------------------------------------------------------------
 // Detect a tone in a single batch of samples (SAMPLES elements).
-char DtmfDetector::DTMF_detection(INT16 short_array_samples[])
+char DtmfDetector::DTMF_detection(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const
+{
+    if(!filterBatch(short_array_samples, config, scratch))
+        return ' ';
+    char decision = classifyBatch(config, scratch);
+    DTMF_PROFILE_LAP(DTMF_STAGE_CLASSIFY);
+    return decision;
+}
+//-----------------------------------------------------------------
+// The first half of DTMF_detection: populate internalArray and T from a
+// single batch.  Returns false if the batch is silent, in which case
+// nothing is populated.
+bool DtmfDetector::filterBatch(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const
+{
+    INT32 *T = scratch.T;
+    INT16 *internalArray = scratch.internalArray;
+
+    if(!normalizeBatch(short_array_samples, config, scratch))
+        return false;
+
+    //Frequency detection
+    goertzel_filter(CONSTANTS[0], CONSTANTS[1], internalArray, &T[0], &T[1], SAMPLES);
+    goertzel_filter(CONSTANTS[2], CONSTANTS[3], internalArray, &T[2], &T[3], SAMPLES);
+    goertzel_filter(CONSTANTS[4], CONSTANTS[5], internalArray, &T[4], &T[5], SAMPLES);
+    goertzel_filter(CONSTANTS[6], CONSTANTS[7], internalArray, &T[6], &T[7], SAMPLES);
+    goertzel_filter(CONSTANTS[8], CONSTANTS[9], internalArray, &T[8], &T[9], SAMPLES);
+    goertzel_filter(CONSTANTS[10], CONSTANTS[11], internalArray, &T[10], &T[11], SAMPLES);
+    goertzel_filter(CONSTANTS[12], CONSTANTS[13], internalArray, &T[12], &T[13], SAMPLES);
+    goertzel_filter(CONSTANTS[14], CONSTANTS[15], internalArray, &T[14], &T[15], SAMPLES);
+    goertzel_filter(CONSTANTS[16], CONSTANTS[17], internalArray, &T[16], &T[17], SAMPLES);
+    DTMF_PROFILE_LAP(DTMF_STAGE_GOERTZEL);
+    return true;
+}
+//-----------------------------------------------------------------
+// goertzel_filter_lanes on DtmfDetector's lanes.  On x86-64 it is built for
+// AVX2 as well, and the version for the CPU at hand is picked at load time.
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+static void goertzel_filter_16(INT16 Koeff0, INT16 Koeff1, const INT16 arraySamples[][16], INT32 Magnitude0[], INT32 Magnitude1[], UINT32 COUNT)
+{
+    goertzel_filter_lanes<16>(Koeff0, Koeff1, arraySamples, Magnitude0, Magnitude1, COUNT);
+}
+//-----------------------------------------------------------------
+// filterBatch on LANES consecutive batches at once.
+void DtmfDetector::filterLanes(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch, LaneScratch &lanes) const
+{
+    const INT16 *batches[LANES];
+    for(unsigned lane = 0; lane < LANES; lane++)
+        batches[lane] = &short_array_samples[lane * SAMPLES];
+    filterLanes(batches, config, scratch, lanes);
+}
+//-----------------------------------------------------------------
+// filterBatch on LANES batches from anywhere at once.  Each batch is
+// normalized on its own, then the Goertzel filters run over all of them
+// side by side.  Silent batches are marked as such and filtered as zeros.
+void DtmfDetector::filterLanes(const INT16 *const batches[], const DtmfDetectorConfig &config, Scratch &scratch, LaneScratch &lanes) const
+{
+    static_assert(LANES == 16, "goertzel_filter_16 is for 16 lanes");
+    unsigned lane, ii;
+    bool silent = true;
+    for(lane = 0; lane < LANES; lane++)
+    {
+        lanes.silent[lane] = !normalizeBatch(batches[lane], config, scratch);
+        lanes.shift[lane] = scratch.shift;
+        for(ii = 0; ii < SAMPLES; ii++)
+            lanes.samples[ii][lane] = lanes.silent[lane] ? 0 : scratch.internalArray[ii];
+        silent = silent && lanes.silent[lane];
+        DTMF_PROFILE_LAP(DTMF_STAGE_COPY);
+    }
+    if(silent)
+        return;
+    for(ii = 0; ii < COEFF_NUMBER; ii += 2)
+        goertzel_filter_16(CONSTANTS[ii], CONSTANTS[ii + 1], lanes.samples, lanes.T[ii], lanes.T[ii + 1], SAMPLES);
+    DTMF_PROFILE_LAP(DTMF_STAGE_GOERTZEL_LANES);
+}
+//-----------------------------------------------------------------
+// The silence check and normalization, shared by all the modes: populate
+// internalArray from a single batch.  Returns false if the batch is
+// silent.
+bool DtmfDetector::normalizeBatch(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const
 {
+    INT32 *T = scratch.T;
+    INT16 *internalArray = scratch.internalArray;
     INT32 Dial=32, Sum;
-    char return_value=' ';
     unsigned ii;
     Sum = 0;
 
     // Dial         TODO: what is this?
     // Sum          Sum of the absolute values of samples in the batch.
-    // return_value The tone detected in this batch (can be silence).
     // ii           Iteration variable
 
     // Quick check for silence.
@@ -310,26 +694,37 @@ char DtmfDetector::DTMF_detection(INT16 short_array_samples[])
         else
             Sum -= short_array_samples[ii];
     }
-    Sum /= SAMPLES;
-    if(Sum < powerThreshold)
-        return ' ';
+    scratch.row = scratch.column = -1;
+    DTMF_PROFILE_LAP(DTMF_STAGE_SILENCE);
+    // The mean absolute value against the threshold, without dividing:
+    // Sum / SAMPLES < powerThreshold, as Sum is never negative.
+    if(Sum < static_cast<int64_t>(config.powerThreshold) * SAMPLES)
+    {
+        scratch.reason = DTMF_REJECT_SILENCE;
+        return false;
+    }
 
     //Normalization
-    // Iterate over each sample.  
-    // First, adjusting Dial to an appropriate value for the batch.
+    // First, adjusting Dial to an appropriate value for the batch: the
+    // smallest norm_l of its non-zero samples.  norm_l complements negative
+    // numbers and counts the leading zeros, so the smallest one is the
+    // norm_l of all the complemented samples ORed together (except that
+    // -1 complements to 0, and norm_l(-1) is 31).  This takes a single pass
+    // without branches, instead of a call to norm_l per sample.
+    INT32 Bits = 0, NonZero = 0;
     for(ii = 0; ii < SAMPLES; ii++)
     {
         T[0] = static_cast<INT32>(short_array_samples[ii]);
-        if(T[0] != 0)
-        {
-            if(Dial > norm_l(T[0]))
-            {
-                Dial = norm_l(T[0]);
-            }
-        }
+        Bits |= T[0] ^ (T[0] >> 31);
+        NonZero |= T[0];
     }
+    if(Bits)
+        Dial = norm_l(Bits);
+    else if(NonZero)
+        Dial = 31;
 
     Dial -= 16;
+    scratch.shift = Dial;
 
     // Next, utilize Dial for scaling and populate internalArray.
     for(ii = 0; ii < SAMPLES; ii++)
@@ -337,24 +732,22 @@ char DtmfDetector::DTMF_detection(INT16 short_array_samples[])
         T[0] = short_array_samples[ii];
         internalArray[ii] = static_cast<INT16>(T[0] << Dial);
     }
+    DTMF_PROFILE_LAP(DTMF_STAGE_NORMALIZE);
+    return true;
+}
+//-----------------------------------------------------------------
+// The second half of DTMF_detection: determine the tone from the
+// magnitudes in T.
+char DtmfDetector::classifyBatch(const DtmfDetectorConfig &config, Scratch &scratch) const
+{
+    const INT32 *T = scratch.T;
+    INT32 *D = scratch.D;
+    INT32 Sum;
+    unsigned ii;
 
-
-    //Frequency detection
-    goertzel_filter(CONSTANTS[0], CONSTANTS[1], internalArray, &T[0], &T[1], SAMPLES);
-    goertzel_filter(CONSTANTS[2], CONSTANTS[3], internalArray, &T[2], &T[3], SAMPLES);
-    goertzel_filter(CONSTANTS[4], CONSTANTS[5], internalArray, &T[4], &T[5], SAMPLES);
-    goertzel_filter(CONSTANTS[6], CONSTANTS[7], internalArray, &T[6], &T[7], SAMPLES);
-    goertzel_filter(CONSTANTS[8], CONSTANTS[9], internalArray, &T[8], &T[9], SAMPLES);
-    goertzel_filter(CONSTANTS[10], CONSTANTS[11], internalArray, &T[10], &T[11], SAMPLES);
-    goertzel_filter(CONSTANTS[12], CONSTANTS[13], internalArray, &T[12], &T[13], SAMPLES);
-    goertzel_filter(CONSTANTS[14], CONSTANTS[15], internalArray, &T[14], &T[15], SAMPLES);
-    goertzel_filter(CONSTANTS[16], CONSTANTS[17], internalArray, &T[16], &T[17], SAMPLES);
-
-#if DEBUG
-    for (ii = 0; ii < COEFF_NUMBER; ++ii)
-        printf("%d ", T[ii]);
-    printf("\n");
-#endif
+    // Sum          Average of the dial tones (other than the max row and
+    //              column).
+    // ii           Iteration variable
 
     INT32 Row = 0;
     INT32 Temp = 0;
@@ -384,6 +777,9 @@ char DtmfDetector::DTMF_detection(INT16 short_array_samples[])
         }
     }
 
+    scratch.row = Row;
+    scratch.column = Column;
+
     Sum=0;
     //Find average value dial tones without max row and max column
     for(ii = 0; ii < 10; ii++)
@@ -403,9 +799,10 @@ char DtmfDetector::DTMF_detection(INT16 short_array_samples[])
     //are less then threshold then return
     // This means the tones are too quiet compared to the other, non-max
     // DTMF frequencies.
-    if(T[Row]/Sum < dialTonesToOhersDialTones)
+    scratch.reason = DTMF_REJECT_WEAK;
+    if(quotientBelow(T[Row], Sum, config.dialTonesToOhersDialTones))
         return ' ';
-    if(T[Column]/Sum < dialTonesToOhersDialTones)
+    if(quotientBelow(T[Column], Sum, config.dialTonesToOhersDialTones))
         return ' ';
 
     // Next, check if the volume of the row and column frequencies
@@ -413,6 +810,7 @@ char DtmfDetector::DTMF_detection(INT16 short_array_samples[])
     // the same tone.
     //
     // In the literature, this is known as "twist".
+    scratch.reason = DTMF_REJECT_TWIST;
     //If relations max colum to max row is large then 4 then return
     if(T[Row] < (T[Column] >> 2)) return ' ';
     //If relations max colum to max row is large then 4 then return
@@ -420,128 +818,137 @@ char DtmfDetector::DTMF_detection(INT16 short_array_samples[])
     // allowed ratios for normal and reverse twist are different.
     if(T[Column] < ((T[Row] >> 1) - (T[Row] >> 3))) return ' ';
 
-    // N.B. looks like avoiding a divide by zero.
+    // N.B. looks like avoiding a divide by zero.  There are no divisions
+    // left, but the ratios are still those of the patched magnitudes.
+    // T itself is left alone for the trace; the checks below use D.
     for(ii = 0; ii < COEFF_NUMBER; ii++)
-        if(T[ii] == 0)
-            T[ii] = 1;
+        D[ii] = T[ii] ? T[ii] : 1;
+
+    // The checks of each stage below go over all the magnitudes without
+    // branching, so that the compiler can vectorize them.  They have no
+    // side effects, so this rejects for the same reason as returning at
+    // the first failure would.
 
     //If relations max row and max column to all other tones are less then
     //threshold then return
     // Check for the presence of strong harmonics.
+    bool rejected = false;
     for(ii = 10; ii < COEFF_NUMBER; ii ++)
     {
-        if(T[Row]/T[ii] < dialTonesToOhersTones)
-            return ' ';
-        if(T[Column]/T[ii] < dialTonesToOhersTones)
-            return ' ';
+        rejected |= quotientBelow(D[Row], D[ii], config.dialTonesToOhersTones)
+            | quotientBelow(D[Column], D[ii], config.dialTonesToOhersTones);
+    }
+    if(rejected)
+    {
+        scratch.reason = DTMF_REJECT_HARMONICS;
+        return ' ';
     }
-
 
     //If relations max row and max column tones to other dial tones are
     //less then threshold then return
+    //
+    // The tones checked are those that are NOT as strong as the maximum
+    // row or column (which are skipped by value, not by index).
+    //
+    // Column == 4 corresponds to 1176Hz.
+    // TODO: what is so special about this frequency?
+    INT32 columnThreshold = Column != 4 ? config.dialTonesToOhersDialTones
+                                        : config.dialTonesToOhersDialTones / 3;
     for(ii = 0; ii < 10; ii ++)
     {
-        // TODO:
-        // The next two nested if's can be collapsed into a single
-        // if-statement.  Basically, he's checking that the current
-        // tone is NOT the maximum tone.
-        //
-        // A simpler check would have been (ii != Column && ii != Row)
-        //
-        if(T[ii] != T[Column])
-        {
-            if(T[ii] != T[Row])
-            {
-                if(T[Row]/T[ii] < dialTonesToOhersDialTones)
-                    return ' ';
-                if(Column != 4)
-                {
-                    // Column == 4 corresponds to 1176Hz.
-                    // TODO: what is so special about this frequency?
-                    if(T[Column]/T[ii] < dialTonesToOhersDialTones)
-                        return ' ';
-                }
-                else
-                {
-                    if(T[Column]/T[ii] < (dialTonesToOhersDialTones/3))
-                        return ' ';
-                }
-            }
-        }
+        rejected |= (D[ii] != D[Column]) & (D[ii] != D[Row])
+            & (quotientBelow(D[Row], D[ii], config.dialTonesToOhersDialTones)
+               | quotientBelow(D[Column], D[ii], columnThreshold));
+    }
+    if(rejected)
+    {
+        scratch.reason = DTMF_REJECT_DIAL_TONES;
+        return ' ';
     }
 
+    scratch.reason = DTMF_ACCEPTED;
     //We are choosed a push button
     // Determine the tone based on the row and column frequencies.
-    switch (Row)
+    return BUTTONS[Row][Column - 4];
+}
+//-----------------------------------------------------------------
+// Detect an MF signal in a single batch of samples (SAMPLES elements).
+//
+// Any two of the six frequencies of the mode make a signal.  The two
+// strongest must each stand out from the other four by
+// dialTonesToOhersDialTones, and be within 6dB of each other.
+char DtmfDetector::MF_detection(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const
+{
+    INT32 *T = scratch.T;
+    INT16 *internalArray = scratch.internalArray;
+    const INT16 *K = MF_CONSTANTS[mode - MODE_MF_R1];
+
+    if(!normalizeBatch(short_array_samples, config, scratch))
+        return ' ';
+
+    //Frequency detection
+    goertzel_filter(K[0], K[1], internalArray, &T[0], &T[1], SAMPLES);
+    goertzel_filter(K[2], K[3], internalArray, &T[2], &T[3], SAMPLES);
+    goertzel_filter(K[4], K[5], internalArray, &T[4], &T[5], SAMPLES);
+    DTMF_PROFILE_LAP(DTMF_STAGE_GOERTZEL);
+
+    char decision = classifyMFBatch(config, scratch);
+    DTMF_PROFILE_LAP(DTMF_STAGE_CLASSIFY);
+    return decision;
+}
+//-----------------------------------------------------------------
+// The second half of MF_detection: determine the signal from the
+// magnitudes in T.
+char DtmfDetector::classifyMFBatch(const DtmfDetectorConfig &config, Scratch &scratch) const
+{
+    const INT32 *T = scratch.T;
+    INT32 *D = scratch.D;
+    unsigned ii;
+
+    // First    Index of the strongest frequency in T
+    // Second   Index of the second strongest frequency in T
+    INT32 First = 0;
+    INT32 Second = 1;
+    if(T[1] > T[0])
     {
-    case 0:
-        switch (Column)
-        {
-        case 4:
-            return_value='1';
-            break;
-        case 5:
-            return_value='2';
-            break;
-        case 6:
-            return_value='3';
-            break;
-        case 7:
-            return_value='A';
-            break;
-        };
-        break;
-    case 1:
-        switch (Column)
-        {
-        case 4:
-            return_value='4';
-            break;
-        case 5:
-            return_value='5';
-            break;
-        case 6:
-            return_value='6';
-            break;
-        case 7:
-            return_value='B';
-            break;
-        };
-        break;
-    case 2:
-        switch (Column)
+        First = 1;
+        Second = 0;
+    }
+    for(ii = 2; ii < MF_FREQUENCIES; ii++)
+    {
+        if(T[ii] > T[First])
         {
-        case 4:
-            return_value='7';
-            break;
-        case 5:
-            return_value='8';
-            break;
-        case 6:
-            return_value='9';
-            break;
-        case 7:
-            return_value='C';
-            break;
-        };
-        break;
-    case 3:
-        switch (Column)
+            Second = First;
+            First = ii;
+        }
+        else if(T[ii] > T[Second])
         {
-        case 4:
-            return_value='*';
-            break;
-        case 5:
-            return_value='0';
-            break;
-        case 6:
-            return_value='#';
-            break;
-        case 7:
-            return_value='D';
-            break;
+            Second = ii;
         }
     }
+    // For tracing, row is the lower frequency of the pair in the bank.
+    scratch.row = First < Second ? First : Second;
+    scratch.column = First < Second ? Second : First;
+
+    // Twist: the weaker frequency must be within 6dB of the stronger.
+    scratch.reason = DTMF_REJECT_TWIST;
+    if(T[Second] < (T[First] >> 2))
+        return ' ';
+
+    // N.B. avoiding a divide by zero, as in classifyBatch.
+    for(ii = 0; ii < MF_FREQUENCIES; ii++)
+        D[ii] = T[ii] ? T[ii] : 1;
+
+    // The weaker of the two must still be well above the other four.
+    scratch.reason = DTMF_REJECT_DIAL_TONES;
+    for(ii = 0; ii < MF_FREQUENCIES; ii++)
+    {
+        if(ii == (unsigned)First || ii == (unsigned)Second)
+            continue;
+        if(quotientBelow(D[Second], D[ii], config.dialTonesToOhersDialTones))
+            return ' ';
+    }
 
-    return return_value;
+    scratch.reason = DTMF_ACCEPTED;
+    return MF_SIGNALS[mode - MODE_MF_R1][MF_PAIRS[scratch.row][scratch.column]];
 }
@@ -10,6 +10,15 @@
 #define DTMF_DETECTOR
 
 #include "types_cpp.hpp"
+#include "DtmfDetectorConfig.hpp"
+#include "DtmfEventQueue.hpp"
+#include "DtmfTrace.hpp"
+#include "CallProgressDetector.hpp"
+#include "DtmfCapture.hpp"
+#include "DtmfToneMeter.hpp"
+
+class DtmfWorkerPool;
+class DtmfLegPair;
 
 
 typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int32     INT32;
@@ -57,28 +66,93 @@ public:
     }
 };
 
-class DtmfDetector : public DtmfDetectorInterface
+// The size of a cache line.  The detector state is aligned to it so that
+// detectors allocated back to back (e.g. from a DtmfDetectorPool) never
+// share a line.
+const unsigned DTMF_CACHE_LINE = 64;
+
+class alignas(DTMF_CACHE_LINE) DtmfDetector : public DtmfDetectorInterface
 {
+    // Runs the Goertzel filters of two detectors in the same lanes.
+    friend class DtmfLegPair;
+public:
+    // What the detector looks for.  All the modes share the silence check,
+    // the normalization and the Goertzel filters; only the frequencies and
+    // the classification differ.
+    enum Mode
+    {
+        MODE_DTMF = 0,
+        // MF R1 (700-1700Hz).  Digits are reported as '0'-'9', KP as 'K',
+        // ST as 'S' and ST', ST'', ST''' as 'A', 'B', 'C'.
+        MODE_MF_R1,
+        // MF R2 (MFC) forward and backward signals, reported as the signal
+        // number in hex ('1'-'9', 'A'-'F').
+        MODE_MF_R2_FORWARD,
+        MODE_MF_R2_BACKWARD
+    };
 protected:
     // These coefficients include the 8 DTMF frequencies plus 10 harmonics.
     static const unsigned COEFF_NUMBER=18;
     // A fixed-size array to hold the coefficients
     static const INT16 CONSTANTS[COEFF_NUMBER];
-    // This array keeps the entire buffer PLUS a single batch.
-    INT16 *pArraySamples;
-    // The magnitude of each coefficient in the current frame.  Populated
-    // by goertzel_filter
-    INT32 T[COEFF_NUMBER];
-    // An array of size SAMPLES.  Used as input to the Goertzel function.
-    INT16  *internalArray;
-    // The size of the entire buffer used for processing samples.  
-    // Specified at construction time.
-    const INT32 frameSize; //Size of a frame is measured in INT16(word)
+    // The power the bins of the 8 DTMF frequencies get from a tone at that
+    // frequency, relative to a bin centred on it (for DtmfToneMeter).
+    static const float *toneGains();
     // The number of samples to utilize in a single call to Goertzel.
     // This is referred to as a frame.
-    static const INT32 SAMPLES;
-    // This gets used for a variety of purposes.  Most notably, it indicates
-    // the start of the circular buffer at the start of ::dtmfDetecting.
+    static const INT32 SAMPLES = 102;
+    // The coefficients of each MF mode, which pairs of them make which
+    // signal, and what each signal is reported as.
+    static const unsigned MF_FREQUENCIES = 6;
+    static const INT16 MF_CONSTANTS[3][MF_FREQUENCIES];
+    static const unsigned char MF_PAIRS[MF_FREQUENCIES][MF_FREQUENCIES];
+    static const char MF_SIGNALS[3][16];
+
+    // Per-call scratch space for DTMF_detection.  It is not part of the
+    // channel state, so a single instance is kept per thread and shared by
+    // all the detectors running on that thread.
+    struct Scratch
+    {
+        // The magnitude of each coefficient in the current frame.  Populated
+        // by goertzel_filter
+        INT32 T[COEFF_NUMBER];
+        // T, with the zeros replaced by 1 so that it can be divided by.
+        INT32 D[COEFF_NUMBER];
+        // An array of size SAMPLES.  Used as input to the Goertzel function.
+        INT16 internalArray[SAMPLES];
+        // How DTMF_detection came to its decision, for tracing: the
+        // strongest row and column frequencies (or -1), and a
+        // DtmfRejection.
+        INT32 row;
+        INT32 column;
+        INT32 reason;
+        // The number of bits the batch was scaled up by in internalArray.
+        INT32 shift;
+    };
+    static Scratch &threadScratch();
+
+    // The number of consecutive batches filtered at once, one per SIMD lane,
+    // when the input holds enough of them (see filterLanes).
+    static const unsigned LANES = 16;
+    // Scratch space for filterLanes, kept per thread like Scratch.  The
+    // samples are interleaved: samples[ii][lane] is sample ii of the lane's
+    // batch.
+    struct alignas(DTMF_CACHE_LINE) LaneScratch
+    {
+        INT16 samples[SAMPLES][LANES];
+        INT32 T[COEFF_NUMBER][LANES];
+        INT32 shift[LANES];
+        bool silent[LANES];
+    };
+    static LaneScratch &threadLaneScratch();
+
+    // The last batch from the previous call to dtmfDetecting, which was
+    // smaller than SAMPLES and could not be processed yet.
+    INT16 arraySamples[SAMPLES];
+    // The size of the input frame passed to dtmfDetecting.
+    // Specified at construction time (or by reset).
+    INT32 frameSize; //Size of a frame is measured in INT16(word)
+    // The number of samples currently held in arraySamples.
     INT32 frameCount;
     // The tone detected by the previous call to DTMF_detection.
     char prevDialButton;
@@ -97,22 +171,54 @@ protected:
     //
     // 111111   222222 -> 1111122222
     char permissionFlag;
+    // A Mode.
+    unsigned char mode;
 
-    // Used for quickly determining silence within a batch.
-    static INT32 powerThreshold;
-    //
-    // dialTonesToOhersTone is the higher ratio.
-    // dialTonesToOhersDialTones is the lower ratio.
-    //
-    // It seems like the aim of this implementation is to be more tolerant
-    // towards strong "dial tones" than "tones".  The latter include
-    // harmonics.
-    //
-    static INT32 dialTonesToOhersTones;
-    static INT32 dialTonesToOhersDialTones;
+    // The number of samples in all the batches processed so far, i.e. the
+    // position of the current batch in the channel's audio.
+    uint64_t sampleCount;
+    // Where detected push buttons are published, if anywhere, and the
+    // channel number to publish them under.
+    DtmfEventSink *eventSink;
+    UINT32 channel;
+    // Where to record every batch's decision, if anywhere.
+    DtmfTraceSink *traceSink;
+    // Looks for call progress and fax tones in the same batches, if set.
+    CallProgressDetector *callProgress;
+    // Keeps the last few seconds of input and decisions, if set.
+    DtmfCapture *capture;
+    // Measures each push button's tones, if set.
+    DtmfToneMeter *toneMeter;
+    // Where the thresholds come from.  Shared with the other detectors of
+    // the same group.
+    const DtmfConfigPublisher *configPublisher;
 
     // This protected function determines the tone present in a single frame.
-    char DTMF_detection(INT16 short_array_samples[]);
+    char DTMF_detection(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const;
+    // DTMF_detection is done in two steps: the filters, then the
+    // classification of their output.
+    bool filterBatch(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const;
+    bool normalizeBatch(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const;
+    // The counterpart of DTMF_detection in the MF modes.
+    char MF_detection(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch) const;
+    char classifyBatch(const DtmfDetectorConfig &config, Scratch &scratch) const;
+    char classifyMFBatch(const DtmfDetectorConfig &config, Scratch &scratch) const;
+    // The Goertzel filters of LANES consecutive batches (LANES * SAMPLES
+    // samples), run side by side.  The magnitudes are the same as
+    // filterBatch's.
+    void filterLanes(const INT16 short_array_samples[], const DtmfDetectorConfig &config, Scratch &scratch, LaneScratch &lanes) const;
+    // The same on any LANES batches: batches[lane] is the lane's batch.
+    void filterLanes(const INT16 *const batches[], const DtmfDetectorConfig &config, Scratch &scratch, LaneScratch &lanes) const;
+    // Classify and register the batch in lane of lanes, as the next batch
+    // of this detector's channel.
+    void registerLane(const LaneScratch &lanes, unsigned lane, const DtmfDetectorConfig &config, Scratch &scratch);
+    // Everything done with the decision on a batch once it is made: trace,
+    // call progress and the onset logic.
+    void registerBatch(char button, Scratch &scratch);
+    // Send the record of the last batch to traceSink.
+    void trace(char decision, const Scratch &scratch);
+    // Run the detection over count samples, which may be any number.
+    void consume(const INT16 samples[], UINT32 count);
 public:
 
     // frameSize_ - input frame size
@@ -122,6 +228,144 @@ public:
     void dtmfDetecting(INT16 inputFrame[]); // The DTMF detection.
     // The size of a inputFrame must be equal of a frameSize_, who
     // was set in constructor.
+
+    // The same over count samples, which may be any number (e.g. a large
+    // chunk of a recording).  The decisions do not depend on how the
+    // samples are split between calls, but large inputs are processed
+    // faster: LANES batches at a time are filtered in parallel.
+    void dtmfDetecting(const INT16 samples[], UINT32 count)
+    {
+        if(capture)
+            capture->record(samples, count);
+        consume(samples, count);
+    }
+
+    // The same, with the batches decided on all the threads of pool.  Only
+    // the onset logic runs in order, on the calling thread, so the result
+    // is exactly that of a sequential run, whatever the number of threads.
+    // While a trace sink, call progress detector or tone meter is set (all
+    // need every batch's intermediate results, in order), this is the same
+    // as dtmfDetecting(samples, count).
+    void dtmfDetecting(const INT16 samples[], UINT32 count, DtmfWorkerPool &pool);
+
+    // Decide each of batches full batches of samples (batches *
+    // batchSamples() samples) on its own: the push button it holds, or ' '.
+    // The channel state is neither used nor changed, so several threads
+    // may call this on the same detector at once.
+    void classifyBatches(const INT16 samples[], UINT32 batches, const DtmfDetectorConfig &config, char decisions[]) const;
+
+    // The MF signal made of the frequencies low < high (0 to 5, in the
+    // order listed for mode), as it would be reported.
+    static char mfSignal(Mode mode, unsigned low, unsigned high)
+    {
+        return MF_SIGNALS[mode - MODE_MF_R1][MF_PAIRS[low][high]];
+    }
+
+    // Return the detector to its freshly constructed state, so that the
+    // object can be recycled for a new channel without being freed.
+    void reset();
+    void reset(INT32 frameSize_);
+
+    // The largest snapshot saveState writes.
+    static const UINT32 STATE_BYTES = 288;
+    // Write a snapshot of the channel state (the samples held over to the
+    // next call, the onset logic, the dial buttons array, the position and
+    // the mode) into state, so that the channel can be continued elsewhere
+    // by restoreState: on another thread, or in another process.  Returns
+    // the number of bytes written, or 0 if size is too small.
+    UINT32 saveState(unsigned char state[], UINT32 size) const;
+    // Continue from a snapshot taken by saveState.  The sinks, call
+    // progress detector and configuration are not part of it, and are left
+    // as they are.  Returns false, leaving the detector unchanged, if state
+    // is not a snapshot this version can read.
+    bool restoreState(const unsigned char state[], UINT32 size);
+
+    // Take the thresholds from publisher, from the next call to
+    // dtmfDetecting on.  The publisher must outlive the detector.  By
+    // default (and after reset), detectors use
+    // DtmfConfigPublisher::defaults().
+    void setConfig(const DtmfConfigPublisher *publisher)
+    {
+        configPublisher = publisher;
+    }
+    const DtmfConfigPublisher *getConfig() const
+    {
+        return configPublisher;
+    }
+
+    // Publish each detected push button to sink as well.  Unlike the dial
+    // buttons array, which must not be touched while dtmfDetecting runs,
+    // a DtmfEventQueue sink can be drained from another thread.  Pass 0 to
+    // stop publishing.
+    void setEventSink(DtmfEventSink *sink, UINT32 channel_=0)
+    {
+        eventSink = sink;
+        channel = channel_;
+    }
+
+    // Record the decision made in every batch, together with the Goertzel
+    // magnitudes it was based on, in sink (e.g. the calling thread's
+    // DtmfTraceFile).  Pass 0 to stop.  When no sink is set this costs a
+    // single branch per batch.
+    void setTraceSink(DtmfTraceSink *sink)
+    {
+        traceSink = sink;
+    }
+
+    // Keep the input from the next call to dtmfDetecting on, and the
+    // decision on each batch of it, in capture (see DtmfCaptureArena), so
+    // that it can be dumped to a file when a push button goes astray.  It
+    // is filed under the channel given to setEventSink, so set that first.
+    // Set it again after restoreState.  Pass 0 to stop.
+    void setCapture(DtmfCapture *capture_);
+
+    // Look for the signals of mode from the next batch on.  The default
+    // (and the mode after reset) is MODE_DTMF.
+    void setMode(Mode mode_)
+    {
+        mode = static_cast<unsigned char>(mode_);
+    }
+    Mode getMode() const
+    {
+        return static_cast<Mode>(mode);
+    }
+
+    // Also look for call progress and fax tones, with the cadence state
+    // kept in detector (one per channel).  Its events are published to the
+    // event sink.  Pass 0 to stop.
+    void setCallProgress(CallProgressDetector *detector)
+    {
+        callProgress = detector;
+    }
+
+    // Measure the level, twist, SNR and duration of each push button in
+    // meter (one per channel), from the magnitudes the detection computes
+    // anyway.  Its metrics are published under the channel given to
+    // setEventSink.  Pass 0 to stop.
+    void setToneMeter(DtmfToneMeter *meter)
+    {
+        toneMeter = meter;
+    }
+
+    // The number of samples in a batch: the unit the decisions are made
+    // on, and the granularity of the event positions.
+    static INT32 batchSamples()
+    {
+        return SAMPLES;
+    }
+    // The number of batches processed at once in SIMD lanes.  Work split
+    // in multiples of it keeps the lanes full.
+    static UINT32 laneBatches()
+    {
+        return LANES;
+    }
+
+    // The number of samples processed so far (excluding a partial batch
+    // held over to the next call).
+    uint64_t getSampleCount() const
+    {
+        return sampleCount;
+    }
 };
 
 #endif
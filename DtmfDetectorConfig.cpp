@@ -0,0 +1,39 @@
+//
+// Detector configuration shared by a group of detectors.
+//
+
+#include "DtmfDetectorConfig.hpp"
+
+DtmfConfigPublisher::DtmfConfigPublisher(const DtmfDetectorConfig &initial)
+    : current(new DtmfDetectorConfig(initial))
+{
+}
+
+DtmfConfigPublisher::~DtmfConfigPublisher()
+{
+    reclaim();
+    delete current.load(std::memory_order_relaxed);
+}
+
+void DtmfConfigPublisher::publish(const DtmfDetectorConfig &config)
+{
+    const DtmfDetectorConfig *fresh = new DtmfDetectorConfig(config);
+    std::lock_guard<std::mutex> lock(writerLock);
+    // The release ordering makes the contents of fresh visible to any
+    // detector that loads the new pointer.
+    retired.push_back(current.exchange(fresh, std::memory_order_acq_rel));
+}
+
+void DtmfConfigPublisher::reclaim()
+{
+    std::lock_guard<std::mutex> lock(writerLock);
+    for(size_t ii = 0; ii < retired.size(); ii++)
+        delete retired[ii];
+    retired.clear();
+}
+
+DtmfConfigPublisher &DtmfConfigPublisher::defaults()
+{
+    static DtmfConfigPublisher publisher;
+    return publisher;
+}
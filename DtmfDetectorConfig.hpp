@@ -0,0 +1,82 @@
+#ifndef DTMF_DETECTOR_CONFIG
+#define DTMF_DETECTOR_CONFIG
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int32     INT32;
+
+// The thresholds used by DtmfDetector.  Once published through a
+// DtmfConfigPublisher, a configuration is never modified, so detectors can
+// read it without synchronization.
+struct DtmfDetectorConfig
+{
+    // Used for quickly determining silence within a batch.
+    INT32 powerThreshold;
+    //
+    // dialTonesToOhersTone is the higher ratio.
+    // dialTonesToOhersDialTones is the lower ratio.
+    //
+    // It seems like the aim of this implementation is to be more tolerant
+    // towards strong "dial tones" than "tones".  The latter include
+    // harmonics.
+    //
+    INT32 dialTonesToOhersTones;
+    INT32 dialTonesToOhersDialTones;
+
+    DtmfDetectorConfig():
+        powerThreshold(328),
+        dialTonesToOhersTones(16),
+        dialTonesToOhersDialTones(6)
+    {
+    }
+};
+
+// The current configuration of a group of detectors, e.g. all the channels
+// of one trunk group.
+//
+// Detectors load the current configuration once per call to dtmfDetecting.
+// publish() swaps in a new one atomically (RCU-style): calls already
+// running finish with the configuration they started with, and the next
+// call picks up the new one.  Detection threads never lock or wait.
+//
+// Replaced configurations are retired rather than freed, since a detection
+// thread may still be reading them.  reclaim() frees them; call it only
+// once every detection thread using this publisher has returned from
+// dtmfDetecting at least once since the last publish (a grace period).
+// Otherwise retired configurations are freed with the publisher.
+class DtmfConfigPublisher
+{
+    std::atomic<const DtmfDetectorConfig *> current;
+    // Serializes writers.  Never taken by detection threads.
+    std::mutex writerLock;
+    std::vector<const DtmfDetectorConfig *> retired;
+
+    // Not copyable
+    DtmfConfigPublisher(const DtmfConfigPublisher &);
+    DtmfConfigPublisher &operator=(const DtmfConfigPublisher &);
+public:
+    DtmfConfigPublisher(const DtmfDetectorConfig &initial=DtmfDetectorConfig());
+    ~DtmfConfigPublisher();
+
+    // The configuration detectors should use right now.
+    const DtmfDetectorConfig *get() const
+    {
+        return current.load(std::memory_order_acquire);
+    }
+
+    // Make config the current configuration.
+    void publish(const DtmfDetectorConfig &config);
+
+    // Free the configurations replaced by publish.  See above.
+    void reclaim();
+
+    // The publisher detectors use unless told otherwise.  It holds the
+    // default thresholds.
+    static DtmfConfigPublisher &defaults();
+};
+
+#endif
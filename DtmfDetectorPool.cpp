@@ -0,0 +1,81 @@
+//
+// A slab of DtmfDetector objects, for running a large number of channels.
+//
+
+#include <cassert>
+#include <new>
+#include <sys/mman.h>
+#include "DtmfDetectorPool.hpp"
+
+// The size of the huge pages we ask for (2MB on x86).
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+DtmfDetectorPool::DtmfDetectorPool(UINT32 capacity, bool hugePages)
+    : slab(0), slabBytes(0), freeList(0), freeCount(0), capacity_(capacity),
+      hugePages_(false)
+{
+    size_t bytes = sizeof(DtmfDetector) * capacity;
+    void *mem = MAP_FAILED;
+
+    // mmap gives us page-aligned (and so cache-line aligned) memory.  The
+    // kernel only hands out pages as they get touched.
+#ifdef MAP_HUGETLB
+    if(hugePages)
+    {
+        slabBytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        mem = mmap(0, slabBytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugePages_ = mem != MAP_FAILED;
+    }
+#endif
+    if(mem == MAP_FAILED)
+    {
+        slabBytes = bytes ? bytes : 1;
+        mem = mmap(0, slabBytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        // No reserved huge pages: let transparent huge pages back the
+        // slab instead, if they are enabled.
+        if(hugePages)
+            madvise(mem, slabBytes, MADV_HUGEPAGE);
+#endif
+    }
+    slab = static_cast<DtmfDetector *>(mem);
+
+    // The detectors are constructed once here, and only reset afterwards.
+    // Push them in reverse, so that acquire hands them out in address
+    // order.
+    freeList = new UINT32 [capacity];
+    for(UINT32 ii = 0; ii < capacity; ii++)
+    {
+        new (&slab[ii]) DtmfDetector(0);
+        freeList[ii] = capacity - ii - 1;
+    }
+    freeCount = capacity;
+}
+
+DtmfDetectorPool::~DtmfDetectorPool()
+{
+    for(UINT32 ii = 0; ii < capacity_; ii++)
+        slab[ii].~DtmfDetector();
+    munmap(slab, slabBytes);
+    delete [] freeList;
+}
+
+DtmfDetector *DtmfDetectorPool::acquire(INT32 frameSize)
+{
+    if(freeCount == 0)
+        return 0;
+    DtmfDetector *detector = &slab[freeList[--freeCount]];
+    detector->reset(frameSize);
+    return detector;
+}
+
+void DtmfDetectorPool::release(DtmfDetector *detector)
+{
+    assert(detector >= slab && detector < slab + capacity_);
+    assert(freeCount < capacity_);
+    freeList[freeCount++] = static_cast<UINT32>(detector - slab);
+}
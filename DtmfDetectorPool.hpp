@@ -0,0 +1,61 @@
+#ifndef DTMF_DETECTOR_POOL
+#define DTMF_DETECTOR_POOL
+
+#include <cstddef>
+#include "DtmfDetector.hpp"
+
+// A slab of DtmfDetector objects for applications running a large number
+// of channels.
+//
+// All the detectors live in a single contiguous, cache-line aligned
+// allocation made at construction time, so acquiring and releasing
+// channels never touches the heap.  Released detectors are reset and
+// recycled by the next acquire.
+//
+// The pool itself is not thread-safe.  Give each worker thread its own
+// pool (which also keeps its channels in its local memory).
+class DtmfDetectorPool
+{
+    // The slab holding capacity detectors.
+    DtmfDetector *slab;
+    // The size of the slab in bytes, as it was mapped.
+    size_t slabBytes;
+    // A stack of the indices of the detectors currently not in use.
+    UINT32 *freeList;
+    UINT32 freeCount;
+    UINT32 capacity_;
+    // Set if the slab is backed by huge pages.
+    bool hugePages_;
+
+    // Not copyable
+    DtmfDetectorPool(const DtmfDetectorPool &);
+    DtmfDetectorPool &operator=(const DtmfDetectorPool &);
+public:
+
+    // capacity     The maximum number of detectors in use at a time.
+    // hugePages    Try to back the slab with huge pages.  Falls back to
+    //              normal pages if none are available.
+    DtmfDetectorPool(UINT32 capacity, bool hugePages=false);
+    ~DtmfDetectorPool();
+
+    // Get a detector in its freshly constructed state.  Returns 0 if all
+    // the detectors are in use.
+    DtmfDetector *acquire(INT32 frameSize);
+    // Give a detector obtained from acquire back to the pool.
+    void release(DtmfDetector *detector);
+
+    UINT32 capacity() const
+    {
+        return capacity_;
+    }
+    UINT32 available() const
+    {
+        return freeCount;
+    }
+    bool hugePages() const
+    {
+        return hugePages_;
+    }
+};
+
+#endif
@@ -0,0 +1,56 @@
+//
+// Lock-free handoff of detector events between two threads.
+//
+
+#include "DtmfEventQueue.hpp"
+
+DtmfEventQueue::DtmfEventQueue(UINT32 capacity)
+    : head(0), cachedTail(0), dropped(0), tail(0), cachedHead(0)
+{
+    UINT32 size = 1;
+    while(size < capacity)
+        size <<= 1;
+    ring = new DtmfEvent [size];
+    mask = size - 1;
+}
+
+DtmfEventQueue::~DtmfEventQueue()
+{
+    delete [] ring;
+}
+
+bool DtmfEventQueue::push(const DtmfEvent &event)
+{
+    // The indices run freely and wrap around; only their difference
+    // matters.
+    UINT32 h = head.load(std::memory_order_relaxed);
+    if(h - cachedTail > mask)
+    {
+        cachedTail = tail.load(std::memory_order_acquire);
+        if(h - cachedTail > mask)
+        {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+            return false;
+        }
+    }
+    ring[h & mask] = event;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+UINT32 DtmfEventQueue::drain(DtmfEvent out[], UINT32 max)
+{
+    UINT32 t = tail.load(std::memory_order_relaxed);
+    if(cachedHead - t < max)
+        cachedHead = head.load(std::memory_order_acquire);
+    UINT32 count = cachedHead - t;
+    if(count > max)
+        count = max;
+    for(UINT32 ii = 0; ii < count; ii++)
+        out[ii] = ring[(t + ii) & mask];
+    // Publish the new tail only once the events have been copied out, so
+    // the producer cannot overwrite them.
+    tail.store(t + count, std::memory_order_release);
+    return count;
+}
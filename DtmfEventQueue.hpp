@@ -0,0 +1,111 @@
+#ifndef DTMF_EVENT_QUEUE
+#define DTMF_EVENT_QUEUE
+
+#include <atomic>
+#include <stdint.h>
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+
+// The cache line size, to keep the producer's and consumer's data apart.
+const unsigned DTMF_EVENT_CACHE_LINE = 64;
+
+// What a DtmfEvent reports.
+enum DtmfEventType
+{
+    // A push button (see DtmfEvent::digit).
+    DTMF_EVENT_DIGIT = 0,
+    // The following come from a CallProgressDetector.
+    DTMF_EVENT_DIAL_TONE,
+    DTMF_EVENT_BUSY,
+    DTMF_EVENT_REORDER,
+    DTMF_EVENT_RINGBACK,
+    DTMF_EVENT_SIT,
+    DTMF_EVENT_FAX_CNG,
+    DTMF_EVENT_FAX_CED
+};
+
+// Something a detector has found in a channel.
+struct DtmfEvent
+{
+    // The position in the channel's audio (in samples since the detector
+    // was constructed or reset) of the start of the batch in which the tone
+    // (or the tone pattern) started.
+    uint64_t sample;
+    // The channel number given to DtmfDetector::setEventSink.
+    UINT32 channel;
+    // The detected push button, for DTMF_EVENT_DIGIT.  0 otherwise.
+    char digit;
+    // A DtmfEventType.
+    unsigned char type;
+};
+
+// Receives the events of one or more detectors.  dtmfEvent is called from
+// within DtmfDetector::dtmfDetecting, on the detection thread.
+class DtmfEventSink
+{
+public:
+    virtual ~DtmfEventSink()
+    {
+    }
+    virtual void dtmfEvent(const DtmfEvent &event) = 0;
+};
+
+// A bounded, wait-free single-producer/single-consumer ring of events.
+//
+// The producer is the thread running the detectors (one detector, or a
+// bank of them all running on the same thread).  The consumer is any
+// other, single thread.  Neither side ever blocks: push fails when the ring
+// is full (the event is counted as dropped), and drain returns whatever is
+// available.
+class DtmfEventQueue : public DtmfEventSink
+{
+    DtmfEvent *ring;
+    // capacity - 1; the capacity is a power of two.
+    UINT32 mask;
+
+    // The producer's line: where the next event goes, and the producer's
+    // last look at tail (refreshed only when the ring seems full).
+    alignas(DTMF_EVENT_CACHE_LINE) std::atomic<UINT32> head;
+    UINT32 cachedTail;
+    // Events that did not fit.  Written by the producer only.
+    std::atomic<UINT32> dropped;
+
+    // The consumer's line: the next event to read, and the consumer's last
+    // look at head.
+    alignas(DTMF_EVENT_CACHE_LINE) std::atomic<UINT32> tail;
+    UINT32 cachedHead;
+
+    // Not copyable
+    DtmfEventQueue(const DtmfEventQueue &);
+    DtmfEventQueue &operator=(const DtmfEventQueue &);
+public:
+    // The capacity is rounded up to a power of two.
+    explicit DtmfEventQueue(UINT32 capacity);
+    ~DtmfEventQueue();
+
+    // Producer side.  Returns false (and counts a drop) if the ring is
+    // full.
+    bool push(const DtmfEvent &event);
+    void dtmfEvent(const DtmfEvent &event)
+    {
+        push(event);
+    }
+
+    // Consumer side.  Move up to max events into out, oldest first, and
+    // return how many were moved.
+    UINT32 drain(DtmfEvent out[], UINT32 max);
+
+    UINT32 capacity() const
+    {
+        return mask + 1;
+    }
+    // The number of events lost because the ring was full.
+    UINT32 getDropped() const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
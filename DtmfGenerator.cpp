@@ -6,6 +6,7 @@
  */
 
 #include "DtmfGenerator.hpp"
+#include "DtmfState.hpp"
 
 // Multiplicaton of two fixed-point numbers
 static inline INT32 MPY48SR(INT16 o16, INT32 o32)
@@ -102,6 +103,12 @@ DtmfGenerator::DtmfGenerator(INT32 FrameSize, INT32 DurationPush, INT32 Duration
     sizeOfFrame = FrameSize;
     readyFlag = 1;
     countLengthDialButtonsArray = 0;
+    count = 0;
+    // Set by transmitNewDialButtonsArray and dtmfGenerating; zeroed so
+    // that a snapshot of a fresh generator is well defined.
+    tempCountDurationPushButton = tempCountDurationPause = 0;
+    tempCoeff1 = tempCoeff2 = 0;
+    y1_1 = y1_2 = y2_1 = y2_2 = 0;
 }
 
 // The destructor does nothing.
@@ -335,3 +342,79 @@ INT32 DtmfGenerator::transmitNewDialButtonsArray(char dialButtonsArray[], UINT32
     readyFlag = 0;
     return 1;
 }
+
+// The snapshot format: "GS", a version, then the fields in the order
+// below.  Bump the version whenever it changes.
+static const unsigned char GENERATOR_STATE_VERSION = 1;
+const UINT32 DtmfGenerator::STATE_BYTES;
+
+UINT32 DtmfGenerator::saveState(unsigned char state[], UINT32 size) const
+{
+    DtmfStateWriter out(state, size);
+    out.put('G', 1);
+    out.put('S', 1);
+    out.put(GENERATOR_STATE_VERSION, 1);
+    out.put(sizeOfFrame, 4);
+    out.put(countDurationPushButton, 4);
+    out.put(countDurationPause, 4);
+    out.put(tempCountDurationPushButton, 4);
+    out.put(tempCountDurationPause, 4);
+    out.put(readyFlag ? 1 : 0, 1);
+    // The push buttons not generated completely yet.
+    out.put(countLengthDialButtonsArray, 1);
+    for(UINT32 ii = 0; ii < countLengthDialButtonsArray; ii++)
+        out.put(static_cast<unsigned char>(pushDialButtons[count + ii]), 1);
+    out.put(static_cast<UINT16>(tempCoeff1), 2);
+    out.put(static_cast<UINT16>(tempCoeff2), 2);
+    out.put(y1_1, 4);
+    out.put(y1_2, 4);
+    out.put(y2_1, 4);
+    out.put(y2_2, 4);
+    return out.finish();
+}
+
+bool DtmfGenerator::restoreState(const unsigned char state[], UINT32 size)
+{
+    DtmfStateReader in(state, size);
+    if(in.get(1) != 'G' || in.get(1) != 'S' || in.get(1) != GENERATOR_STATE_VERSION)
+        return false;
+    INT32 frame = static_cast<INT32>(in.getSigned(4));
+    INT32 push = static_cast<INT32>(in.getSigned(4));
+    INT32 pause = static_cast<INT32>(in.getSigned(4));
+    INT32 pushLeft = static_cast<INT32>(in.getSigned(4));
+    INT32 pauseLeft = static_cast<INT32>(in.getSigned(4));
+    INT32 ready = static_cast<INT32>(in.get(1));
+    UINT32 length = static_cast<UINT32>(in.get(1));
+    if(frame <= 0 || length > sizeof(pushDialButtons))
+        return false;
+    char buttons[sizeof(pushDialButtons)];
+    for(UINT32 ii = 0; ii < length; ii++)
+        buttons[ii] = static_cast<char>(in.get(1));
+    INT16 coeff1 = static_cast<INT16>(in.getSigned(2));
+    INT16 coeff2 = static_cast<INT16>(in.getSigned(2));
+    INT32 y11 = static_cast<INT32>(in.getSigned(4));
+    INT32 y12 = static_cast<INT32>(in.getSigned(4));
+    INT32 y21 = static_cast<INT32>(in.getSigned(4));
+    INT32 y22 = static_cast<INT32>(in.getSigned(4));
+    if(!in.finish())
+        return false;
+
+    sizeOfFrame = frame;
+    countDurationPushButton = push;
+    countDurationPause = pause;
+    tempCountDurationPushButton = pushLeft;
+    tempCountDurationPause = pauseLeft;
+    readyFlag = ready;
+    // The push buttons left move to the front of the array.
+    for(UINT32 ii = 0; ii < length; ii++)
+        pushDialButtons[ii] = buttons[ii];
+    countLengthDialButtonsArray = length;
+    count = 0;
+    tempCoeff1 = coeff1;
+    tempCoeff2 = coeff2;
+    y1_1 = y11;
+    y1_2 = y12;
+    y2_1 = y21;
+    y2_2 = y22;
+    return true;
+}
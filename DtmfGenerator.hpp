@@ -98,6 +98,24 @@ public:
     {
         return readyFlag?1:0;
     }
+
+    // The size of the frames dtmfGenerating writes.
+    INT32 getFrameSize() const
+    {
+        return sizeOfFrame;
+    }
+
+    // The largest snapshot saveState writes.
+    static const UINT32 STATE_BYTES = 72;
+    // Write a snapshot of the generator (the push buttons left, the
+    // position in the current tone or pause and the oscillators) into
+    // state.  Returns the number of bytes written, or 0 if size is too
+    // small.
+    UINT32 saveState(unsigned char state[], UINT32 size) const;
+    // Continue generating from a snapshot taken by saveState, possibly in
+    // another process.  Returns false, leaving the generator unchanged, if
+    // state is not a snapshot this version can read.
+    bool restoreState(const unsigned char state[], UINT32 size);
 };
 
 /*			Example:
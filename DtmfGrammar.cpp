@@ -0,0 +1,299 @@
+//
+// Digit patterns compiled into a DFA, and the per-channel matcher.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include "DtmfGrammar.hpp"
+
+const UINT32 DtmfGrammar::START;
+const UINT32 DtmfGrammar::DEAD;
+
+static const char SYMBOLS[] = "0123456789*#ABCD";
+
+// The longest a pattern may get once its repetitions are written out.
+static const size_t MAX_ITEMS = 256;
+
+int DtmfGrammar::symbol(char digit)
+{
+    const char *p = digit ? strchr(SYMBOLS, digit) : 0;
+    return p ? static_cast<int>(p - SYMBOLS) : -1;
+}
+
+namespace
+{
+    // One push button of a pattern: the set of those it accepts, as a
+    // bitmask of symbols.  An optional item may be skipped, and a looping
+    // one matched any number of times.
+    struct Item
+    {
+        unsigned mask;
+        bool optional;
+        bool loop;
+    };
+
+    bool parseError(const std::string &pattern, size_t position, const char *why, std::string &error)
+    {
+        std::ostringstream out;
+        out << pattern << ": " << why << " at position " << position;
+        error = out.str();
+        return false;
+    }
+
+    bool parseNumber(const std::string &pattern, size_t &ii, unsigned &value)
+    {
+        size_t start = ii;
+        value = 0;
+        while(ii < pattern.size() && pattern[ii] >= '0' && pattern[ii] <= '9' && value <= MAX_ITEMS)
+            value = value * 10 + (pattern[ii++] - '0');
+        return ii > start;
+    }
+
+    bool parse(const std::string &pattern, std::vector<Item> &items, std::string &error)
+    {
+        items.clear();
+        if(pattern.empty())
+            return parseError(pattern, 0, "empty pattern", error);
+        // Whether the last item can take a repetition.
+        bool repeatable = false;
+        for(size_t ii = 0; ii < pattern.size(); )
+        {
+            char c = pattern[ii];
+            Item item = { 0, false, false };
+            if(c == '{')
+            {
+                if(!repeatable)
+                    return parseError(pattern, ii, "nothing to repeat", error);
+                unsigned lo, hi;
+                bool bounded = true;
+                ii++;
+                if(!parseNumber(pattern, ii, lo))
+                    return parseError(pattern, ii, "expected a count", error);
+                hi = lo;
+                if(ii < pattern.size() && pattern[ii] == ',')
+                {
+                    ii++;
+                    bounded = parseNumber(pattern, ii, hi);
+                }
+                if(ii >= pattern.size() || pattern[ii] != '}')
+                    return parseError(pattern, ii, "expected }", error);
+                ii++;
+                if((bounded && hi < lo) || (lo == 0 && bounded && hi == 0))
+                    return parseError(pattern, ii, "bad repetition", error);
+                if(items.size() - 1 + (bounded ? hi : lo + 1) > MAX_ITEMS)
+                    return parseError(pattern, ii, "too long", error);
+                Item repeated = items.back();
+                items.pop_back();
+                for(unsigned jj = 0; jj < lo; jj++)
+                    items.push_back(repeated);
+                repeated.optional = true;
+                for(unsigned jj = lo; bounded && jj < hi; jj++)
+                    items.push_back(repeated);
+                if(!bounded)
+                {
+                    repeated.loop = true;
+                    items.push_back(repeated);
+                }
+                repeatable = false;
+                continue;
+            }
+            if(c == '?')
+            {
+                item.mask = 0xffff;
+                ii++;
+            }
+            else if(c == '[')
+            {
+                for(ii++; ii < pattern.size() && pattern[ii] != ']'; ii++)
+                {
+                    int from = DtmfGrammar::symbol(pattern[ii]);
+                    if(from < 0)
+                        return parseError(pattern, ii, "not a push button", error);
+                    int to = from;
+                    if(ii + 2 < pattern.size() && pattern[ii + 1] == '-' && pattern[ii + 2] != ']')
+                    {
+                        to = DtmfGrammar::symbol(pattern[ii + 2]);
+                        if(to < from)
+                            return parseError(pattern, ii, "bad range", error);
+                        ii += 2;
+                    }
+                    for(int s = from; s <= to; s++)
+                        item.mask |= 1u << s;
+                }
+                if(ii >= pattern.size())
+                    return parseError(pattern, ii, "expected ]", error);
+                if(!item.mask)
+                    return parseError(pattern, ii, "empty class", error);
+                ii++;
+            }
+            else
+            {
+                int s = DtmfGrammar::symbol(c);
+                if(s < 0)
+                    return parseError(pattern, ii, "not a push button", error);
+                item.mask = 1u << s;
+                ii++;
+            }
+            if(items.size() >= MAX_ITEMS)
+                return parseError(pattern, ii, "too long", error);
+            items.push_back(item);
+            repeatable = true;
+        }
+        return true;
+    }
+
+    // The positions of all the patterns, one after the other: position p
+    // of pattern k is base[k] + p, where p is the number of the next item
+    // to match, and p == items[k].size() means the pattern has matched.
+    struct Positions
+    {
+        std::vector<std::vector<Item> > items;
+        std::vector<UINT32> base;
+        // For each position, its pattern and its number in the pattern.
+        std::vector<UINT32> pattern;
+        std::vector<UINT32> offset;
+
+        // Add position (and the positions after any optional items from
+        // there) to set.
+        void close(UINT32 position, std::vector<UINT32> &set) const
+        {
+            const std::vector<Item> &its = items[pattern[position]];
+            for(UINT32 p = offset[position]; ; p++, position++)
+            {
+                set.push_back(position);
+                if(p >= its.size() || !its[p].optional)
+                    break;
+            }
+        }
+    };
+}
+
+DtmfGrammar::DtmfGrammar()
+{
+    std::string error;
+    compile(std::vector<std::string>(), error);
+}
+
+bool DtmfGrammar::compile(const std::vector<std::string> &patterns, std::string &error, UINT32 maxStates)
+{
+    Positions positions;
+    positions.items.resize(patterns.size());
+    for(UINT32 k = 0; k < patterns.size(); k++)
+    {
+        if(!parse(patterns[k], positions.items[k], error))
+        {
+            // An empty grammar, which matches nothing.
+            compile(std::vector<std::string>(), error);
+            return false;
+        }
+        positions.base.push_back(positions.pattern.size());
+        for(UINT32 p = 0; p <= positions.items[k].size(); p++)
+        {
+            positions.pattern.push_back(k);
+            positions.offset.push_back(p);
+        }
+    }
+
+    // The subset construction.  Each state is the sorted set of positions
+    // the push buttons so far may have led to.
+    typedef std::vector<UINT32> Set;
+    std::map<Set, UINT32> known;
+    std::vector<Set> sets(2);
+    for(UINT32 k = 0; k < patterns.size(); k++)
+        positions.close(positions.base[k], sets[START]);
+    std::sort(sets[START].begin(), sets[START].end());
+    known[sets[DEAD]] = DEAD;
+    known[sets[START]] = START;
+    std::vector<UINT32> table(32, DEAD);
+    Set next;
+    for(UINT32 state = START; state < sets.size(); state++)
+    {
+        for(int s = 0; s < 16; s++)
+        {
+            next.clear();
+            for(size_t ii = 0; ii < sets[state].size(); ii++)
+            {
+                UINT32 position = sets[state][ii];
+                const std::vector<Item> &its = positions.items[positions.pattern[position]];
+                UINT32 p = positions.offset[position];
+                if(p < its.size() && (its[p].mask >> s & 1))
+                    positions.close(its[p].loop ? position : position + 1, next);
+            }
+            std::sort(next.begin(), next.end());
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+            std::map<Set, UINT32>::iterator found = known.find(next);
+            if(found == known.end())
+            {
+                if(sets.size() >= maxStates)
+                {
+                    compile(std::vector<std::string>(), error);
+                    error = "too many states";
+                    return false;
+                }
+                found = known.insert(std::make_pair(next, (UINT32)sets.size())).first;
+                sets.push_back(next);
+                table.resize(table.size() + 16, DEAD);
+            }
+            table[state * 16 + s] = found->second;
+        }
+    }
+
+    patterns_ = patterns;
+    transitions.swap(table);
+    matches.assign(sets.size(), -1);
+    outcomes.assign(sets.size(), UNDECIDED);
+    for(UINT32 state = 0; state < sets.size(); state++)
+    {
+        for(size_t ii = 0; ii < sets[state].size() && matches[state] < 0; ii++)
+        {
+            UINT32 position = sets[state][ii];
+            if(positions.offset[position] == positions.items[positions.pattern[position]].size())
+                matches[state] = positions.pattern[position];
+        }
+        bool more = false;
+        for(int s = 0; s < 16; s++)
+            more = more || transitions[state * 16 + s] != DEAD;
+        if(sets[state].empty())
+            outcomes[state] = NO_MATCH;
+        else if(!more)
+            outcomes[state] = matches[state] >= 0 ? MATCH : NO_MATCH;
+    }
+    return true;
+}
+
+DtmfGrammarMatcher::DtmfGrammarMatcher(const DtmfGrammar &grammar_, UINT32 channels, DtmfGrammarListener *listener_)
+    : grammar(grammar_), listener(listener_), channelStates(channels, DtmfGrammar::START),
+      lastSamples(channels, 0), interDigitTimeout(0)
+{
+}
+
+void DtmfGrammarMatcher::decide(UINT32 channel, UINT32 state, uint64_t sample)
+{
+    channelStates[channel] = DECIDED;
+    if(grammar.match(state) >= 0)
+        listener->grammarMatch(channel, grammar.match(state), sample);
+    else
+        listener->grammarNoMatch(channel, sample);
+}
+
+void DtmfGrammarMatcher::push(UINT32 channel, char digit, uint64_t sample)
+{
+    UINT32 state = channelStates[channel];
+    if(state == DECIDED)
+        return;
+    state = grammar.next(state, digit);
+    lastSamples[channel] = sample;
+    if(grammar.outcome(state) != DtmfGrammar::UNDECIDED)
+        decide(channel, state, sample);
+    else
+        channelStates[channel] = state;
+}
+
+void DtmfGrammarMatcher::timeout(UINT32 channel, uint64_t sample)
+{
+    if(channelStates[channel] != DECIDED)
+        decide(channel, channelStates[channel], sample);
+}
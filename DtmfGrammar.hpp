@@ -0,0 +1,179 @@
+#ifndef DTMF_GRAMMAR
+#define DTMF_GRAMMAR
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "types_cpp.hpp"
+#include "DtmfEventQueue.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+
+// A set of digit patterns (menu options, PIN lengths, feature codes, ...)
+// compiled into a single deterministic automaton over the 16 push
+// buttons, so that the push buttons of a channel are matched against all
+// of them at the cost of one table lookup each.
+//
+// A pattern matches the whole sequence of push buttons of a channel, from
+// its first one.  It is made of:
+//
+//   0-9 * # A-D    that push button
+//   ?              any push button
+//   [...]          any of the push buttons listed, with ranges such as
+//                  [1-5] (e.g. [0-9*])
+//   {m} {m,n} {m,} the previous item m times, m to n times, or at least
+//                  m times
+//
+// e.g. "1", "2", "*7[0-9]{2}", "[0-9]{4,6}#".
+class DtmfGrammar
+{
+public:
+    // The state of a channel that has seen no push buttons yet, and the
+    // state of one that no pattern can match any more.
+    static const UINT32 START = 1;
+    static const UINT32 DEAD = 0;
+
+    enum Outcome
+    {
+        // More push buttons can still change the outcome.
+        UNDECIDED = 0,
+        // The push buttons so far match a pattern, and no more could make
+        // them match another one.
+        MATCH,
+        // No pattern can match, whatever follows.
+        NO_MATCH
+    };
+
+    DtmfGrammar();
+
+    // Compile patterns, replacing any earlier grammar.  When several
+    // patterns match, the first one listed wins.  Returns false, leaving
+    // the grammar empty, if a pattern is not valid (error says which and
+    // why), or the automaton would need more than maxStates states.
+    bool compile(const std::vector<std::string> &patterns, std::string &error, UINT32 maxStates=65536);
+
+    // The state after push button digit in state.  A character that is not
+    // a push button leads to DEAD.
+    UINT32 next(UINT32 state, char digit) const
+    {
+        int s = symbol(digit);
+        return s < 0 ? DEAD : transitions[state * 16 + s];
+    }
+    Outcome outcome(UINT32 state) const
+    {
+        return static_cast<Outcome>(outcomes[state]);
+    }
+    // The pattern the push buttons leading to state match, or -1.
+    int match(UINT32 state) const
+    {
+        return matches[state];
+    }
+    UINT32 states() const
+    {
+        return matches.size();
+    }
+    const std::string &pattern(UINT32 index) const
+    {
+        return patterns_[index];
+    }
+
+    // The position of push button digit in "0123456789*#ABCD", or -1.
+    static int symbol(char digit);
+
+private:
+    std::vector<std::string> patterns_;
+    std::vector<UINT32> transitions;
+    std::vector<int> matches;
+    std::vector<unsigned char> outcomes;
+};
+
+// Told when the outcome of a channel is decided.  Called from within
+// DtmfGrammarMatcher::dtmfEvent (so on the detection thread) or timeout.
+class DtmfGrammarListener
+{
+public:
+    virtual ~DtmfGrammarListener()
+    {
+    }
+    // The push buttons of channel match pattern (its index in the
+    // grammar).  sample is the position of the last push button, or the
+    // position passed to timeout.
+    virtual void grammarMatch(UINT32 channel, UINT32 pattern, uint64_t sample) = 0;
+    // No pattern can match the push buttons of channel.
+    virtual void grammarNoMatch(UINT32 channel, uint64_t sample) = 0;
+};
+
+// Runs the push buttons of a bank of channels through a grammar.  Set it
+// as the event sink of each channel's detector (with the channel's
+// number), and the listener hears of each channel's outcome as soon as it
+// is decided, so that the caller can stop detecting on it.  Each channel
+// costs twelve bytes.
+//
+// Like the detectors feeding it, a matcher must only be used from one
+// thread at a time.
+class DtmfGrammarMatcher : public DtmfEventSink
+{
+    // The state of a channel whose outcome has been reported.
+    static const UINT32 DECIDED = ~(UINT32)0;
+
+    const DtmfGrammar &grammar;
+    DtmfGrammarListener *listener;
+    std::vector<UINT32> channelStates;
+    // The position of each channel's last push button.
+    std::vector<uint64_t> lastSamples;
+    uint64_t interDigitTimeout;
+
+    void decide(UINT32 channel, UINT32 state, uint64_t sample);
+
+    // Not copyable
+    DtmfGrammarMatcher(const DtmfGrammarMatcher &);
+    DtmfGrammarMatcher &operator=(const DtmfGrammarMatcher &);
+public:
+    // The grammar and listener must outlive the matcher.
+    DtmfGrammarMatcher(const DtmfGrammar &grammar_, UINT32 channels, DtmfGrammarListener *listener_);
+
+    // Advance event's channel on a push button.  Other events, and events
+    // of decided channels, are ignored.
+    void dtmfEvent(const DtmfEvent &event)
+    {
+        if(event.type == DTMF_EVENT_DIGIT)
+            push(event.channel, event.digit, event.sample);
+    }
+    // The same, for push buttons from elsewhere (e.g. RFC 4733 events).
+    void push(UINT32 channel, char digit, uint64_t sample);
+    // The caller has waited long enough for more push buttons on channel:
+    // decide it on those it has, if it is not decided yet.  A pattern that
+    // is the prefix of another (e.g. "1" and "12") only matches this way.
+    void timeout(UINT32 channel, uint64_t sample);
+    // Time a channel out by itself once it has gone samples without a push
+    // button since its last one, as seen by advance.  0 (the default)
+    // never does.  Waiting for the first push button is up to the caller.
+    void setInterDigitTimeout(uint64_t samples)
+    {
+        interDigitTimeout = samples;
+    }
+    // Channel's audio has been detected up to sample.  Call after each
+    // dtmfDetecting for the inter-digit timeout to apply.
+    void advance(UINT32 channel, uint64_t sample)
+    {
+        if(interDigitTimeout && channelStates[channel] != DtmfGrammar::START
+           && sample - lastSamples[channel] > interDigitTimeout)
+            timeout(channel, sample);
+    }
+    // Start channel over, e.g. for a new call or menu.
+    void reset(UINT32 channel)
+    {
+        channelStates[channel] = DtmfGrammar::START;
+    }
+    bool decided(UINT32 channel) const
+    {
+        return channelStates[channel] == DECIDED;
+    }
+    UINT32 channels() const
+    {
+        return channelStates.size();
+    }
+};
+
+#endif
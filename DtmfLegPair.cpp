@@ -0,0 +1,206 @@
+//
+// Both legs of a call detected in the same lanes, with echo suppression.
+//
+
+#include <cassert>
+#include <cmath>
+#include "DtmfLegPair.hpp"
+
+const uint64_t DtmfLegPair::DEFAULT_ECHO_WINDOW;
+
+DtmfLegPair::DtmfLegPair(DtmfDetector &near, DtmfDetector &far)
+    : sink(0), echoWindow(DEFAULT_ECHO_WINDOW), echoes(0)
+{
+    DtmfDetector *detectors[2] = { &near, &far };
+    for(unsigned ii = 0; ii < 2; ii++)
+    {
+        legs[ii].pair = this;
+        legs[ii].index = ii;
+        legs[ii].detector = detectors[ii];
+        legs[ii].first = 0;
+        legs[ii].count = 0;
+        detectors[ii]->setEventSink(&legs[ii], ii);
+    }
+}
+
+void DtmfLegPair::setEventSink(DtmfEventSink *sink_, UINT32 nearChannel, UINT32 farChannel)
+{
+    sink = sink_;
+    legs[0].detector->setEventSink(&legs[0], nearChannel);
+    legs[1].detector->setEventSink(&legs[1], farChannel);
+}
+
+void DtmfLegPair::Leg::dtmfEvent(const DtmfEvent &event)
+{
+    // Call progress and fax tones are not echo-checked.
+    if(event.type != DTMF_EVENT_DIGIT)
+    {
+        if(pair->sink)
+            pair->sink->dtmfEvent(event);
+        return;
+    }
+    // The detector has just registered the batch the push button was
+    // decided in, so its magnitudes are still in the thread's scratch.
+    const DtmfDetector::Scratch &scratch = DtmfDetector::threadScratch();
+    double power = 0;
+    if(scratch.row >= 0 && scratch.column >= 0)
+        power = ldexp((double)scratch.T[scratch.row] + scratch.T[scratch.column], -2 * scratch.shift);
+    pair->digit(index, event, power);
+}
+
+void DtmfLegPair::digit(unsigned leg, const DtmfEvent &event, double power)
+{
+    expire(event.sample);
+    Leg &self = legs[leg], &other = legs[1 - leg];
+    // The same push button on both legs within the echo window: one is the
+    // echo of the other.  An echo cannot start before what it echoes, and
+    // is weaker when the delay is too short to tell them apart by their
+    // batches.  The other leg's push buttons are matched oldest first, so
+    // that a push button dialed twice is matched with its echoes in turn.
+    for(unsigned ii = 0; ii < other.count; ii++)
+    {
+        Recent &recent = other.at(ii);
+        if(recent.matched || recent.event.digit != event.digit)
+            continue;
+        echoes++;
+        recent.matched = true;
+        uint64_t original = recent.event.sample;
+        if(recent.waiting && (event.sample < recent.event.sample
+                              || (event.sample == recent.event.sample && power > recent.power)))
+        {
+            // This one is the original: drop the other.
+            recent.waiting = false;
+            original = event.sample;
+            if(self.count == RECENT)
+                expire(self.at(0).event.sample + echoWindow + 1);
+            Recent &mine = self.at(self.count++);
+            mine.event = event;
+            mine.power = power;
+            mine.waiting = true;
+            mine.matched = true;
+        }
+        // The original has nothing more to wait for.
+        publishBefore(original + 1);
+        return;
+    }
+    // Make room by letting the oldest go early.
+    if(self.count == RECENT)
+        expire(self.at(0).event.sample + echoWindow + 1);
+    Recent &mine = self.at(self.count++);
+    mine.event = event;
+    mine.power = power;
+    mine.waiting = true;
+    mine.matched = false;
+}
+
+void DtmfLegPair::publishBefore(uint64_t end)
+{
+    for(;;)
+    {
+        // The earliest waiting push button of each leg: those before it
+        // are published or dropped.
+        Recent *earliest[2] = { 0, 0 };
+        for(unsigned leg = 0; leg < 2; leg++)
+        {
+            for(unsigned ii = 0; ii < legs[leg].count && !earliest[leg]; ii++)
+                if(legs[leg].at(ii).waiting)
+                    earliest[leg] = &legs[leg].at(ii);
+        }
+        Recent *next = earliest[0];
+        if(!next || (earliest[1] && earliest[1]->event.sample < next->event.sample))
+            next = earliest[1];
+        if(!next || next->event.sample >= end)
+            return;
+        next->waiting = false;
+        if(sink)
+            sink->dtmfEvent(next->event);
+    }
+}
+
+void DtmfLegPair::expire(uint64_t sample)
+{
+    if(sample <= echoWindow)
+        return;
+    uint64_t end = sample - echoWindow;
+    publishBefore(end);
+    for(unsigned leg = 0; leg < 2; leg++)
+    {
+        Leg &l = legs[leg];
+        while(l.count > 0 && l.at(0).event.sample < end)
+        {
+            l.first = (l.first + 1) % RECENT;
+            l.count--;
+        }
+    }
+}
+
+void DtmfLegPair::flush()
+{
+    publishBefore(UINT64_MAX);
+    legs[0].count = legs[1].count = 0;
+}
+
+void DtmfLegPair::dtmfDetecting(const INT16 near[], const INT16 far[], UINT32 count)
+{
+    static const unsigned HALF = DtmfDetector::LANES / 2;
+    static const UINT32 SAMPLES = DtmfDetector::SAMPLES;
+    DtmfDetector &a = *legs[0].detector, &b = *legs[1].detector;
+    assert(a.frameCount == b.frameCount);
+    if(a.capture)
+        a.capture->record(near, count);
+    if(b.capture)
+        b.capture->record(far, count);
+
+    // Complete the batches left over from the previous call first.
+    UINT32 done = 0;
+    if(a.frameCount > 0)
+    {
+        done = SAMPLES - a.frameCount;
+        if(done > count)
+            done = count;
+        a.consume(near, done);
+        b.consume(far, done);
+    }
+
+    // Then HALF batches of each leg at a time in the lanes, near in the
+    // first half, far in the second.  The batches are registered in the
+    // order they were taken, alternating between the legs, so that the
+    // push buttons of both reach digit in order.
+    if(a.frameCount == 0 && a.mode == DtmfDetector::MODE_DTMF && b.mode == DtmfDetector::MODE_DTMF
+       && a.configPublisher == b.configPublisher)
+    {
+        const DtmfDetectorConfig &config = *a.configPublisher->get();
+        DtmfDetector::Scratch &scratch = DtmfDetector::threadScratch();
+        DtmfDetector::LaneScratch &lanes = DtmfDetector::threadLaneScratch();
+        const INT16 *batches[DtmfDetector::LANES];
+        for(; count - done >= HALF * SAMPLES; done += HALF * SAMPLES)
+        {
+            for(unsigned lane = 0; lane < HALF; lane++)
+            {
+                batches[lane] = &near[done + lane * SAMPLES];
+                batches[HALF + lane] = &far[done + lane * SAMPLES];
+            }
+            a.filterLanes(batches, config, scratch, lanes);
+            for(unsigned lane = 0; lane < HALF; lane++)
+            {
+                a.registerLane(lanes, lane, config, scratch);
+                b.registerLane(lanes, HALF + lane, config, scratch);
+            }
+        }
+    }
+
+    // What is left a batch at a time, and the last partial batch kept for
+    // the next call.
+    for(; count - done >= SAMPLES; done += SAMPLES)
+    {
+        a.consume(&near[done], SAMPLES);
+        b.consume(&far[done], SAMPLES);
+    }
+    a.consume(&near[done], count - done);
+    b.consume(&far[done], count - done);
+
+    // The next push button registered can start no earlier than the batch
+    // before the one under way.
+    if(a.sampleCount >= SAMPLES)
+        expire(a.sampleCount - SAMPLES);
+}
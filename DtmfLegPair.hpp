@@ -0,0 +1,114 @@
+#ifndef DTMF_LEG_PAIR
+#define DTMF_LEG_PAIR
+
+#include <stdint.h>
+#include "DtmfDetector.hpp"
+#include "DtmfEventQueue.hpp"
+
+
+// The two legs of a full-duplex call (e.g. the channels of a stereo call
+// recording), detected together.
+//
+// A push button sent on one leg usually comes back on the other as an
+// echo, and two detectors on their own would report it twice.  The pair
+// reports it once, on the leg it was sent on: when the same push button
+// starts on both legs within the echo window, the one that starts later
+// (or, in the same batch, the weaker one) is the echo, and is dropped.
+//
+// Both legs are detected in the same pass: the Goertzel filters of
+// LANES / 2 batches of each leg run side by side in the same SIMD lanes,
+// so the lanes fill up on half as much input as a single detector needs.
+//
+// The pair takes over the event sinks of its legs' detectors.  Each push
+// button is held back until no echo of it can turn up any more (up to the
+// echo window), and the push buttons of both legs are published in the
+// order they started.  The dial buttons arrays of the detectors are as
+// they would be on their own, echoes included.
+class DtmfLegPair
+{
+    // A push button a leg started within the echo window.
+    struct Recent
+    {
+        DtmfEvent event;
+        // The power of the push button's two frequencies in the batch it
+        // was registered in, scaled back to the input's level.
+        double power;
+        // Still to be published.
+        bool waiting;
+        // Told from its echo already (or dropped as one): it cannot be
+        // matched again.
+        bool matched;
+    };
+    // The most push buttons a leg keeps within the echo window: with the
+    // default window, at most 4 fit.  Beyond that, the oldest is let go.
+    static const unsigned RECENT = 16;
+
+    // One leg, and its recent push buttons, oldest first, from
+    // recent[first] on (modulo RECENT).
+    struct Leg : public DtmfEventSink
+    {
+        DtmfLegPair *pair;
+        unsigned index;
+        DtmfDetector *detector;
+        Recent recent[RECENT];
+        unsigned first;
+        unsigned count;
+
+        Recent &at(unsigned ii)
+        {
+            return recent[(first + ii) % RECENT];
+        }
+        void dtmfEvent(const DtmfEvent &event);
+    };
+    Leg legs[2];
+    DtmfEventSink *sink;
+    uint64_t echoWindow;
+    uint64_t echoes;
+
+    void digit(unsigned leg, const DtmfEvent &event, double power);
+    // Publish the waiting push buttons of both legs that started before
+    // end, the earliest first.
+    void publishBefore(uint64_t end);
+    // Publish the push buttons that started more than the echo window
+    // before sample, and forget them.
+    void expire(uint64_t sample);
+
+    // Not copyable
+    DtmfLegPair(const DtmfLegPair &);
+    DtmfLegPair &operator=(const DtmfLegPair &);
+public:
+    // The default echo window, in samples: 128ms, the longest echo path a
+    // G.168 echo canceller is usually configured for.
+    static const uint64_t DEFAULT_ECHO_WINDOW = 1024;
+
+    // The detectors must outlive the pair.  Set their mode, configuration
+    // and other sinks on them as usual (the same configuration publisher on
+    // both lets them share the lanes).
+    DtmfLegPair(DtmfDetector &near, DtmfDetector &far);
+
+    // Publish the push buttons of the legs to sink, under the channel
+    // numbers of near and far.
+    void setEventSink(DtmfEventSink *sink_, UINT32 nearChannel=0, UINT32 farChannel=1);
+
+    // Treat the same push button on the other leg as an echo if it starts
+    // within samples of the first.
+    void setEchoWindow(uint64_t samples)
+    {
+        echoWindow = samples;
+    }
+
+    // Detect count samples of each leg, taken at the same instants.  The
+    // legs must always be given the same number of samples.
+    void dtmfDetecting(const INT16 near[], const INT16 far[], UINT32 count);
+
+    // The input has ended: publish the push buttons still held back.
+    void flush();
+
+    // The number of push buttons dropped as echoes so far.
+    uint64_t getEchoes() const
+    {
+        return echoes;
+    }
+};
+
+#endif
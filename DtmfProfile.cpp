@@ -0,0 +1,282 @@
+//
+// Per-stage timing of the detector.  See DtmfProfile.hpp.
+//
+
+#ifdef DTMF_PROFILE
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "DtmfProfile.hpp"
+
+// The histograms are log-linear, as in HdrHistogram: values below
+// 2 * SUB_BUCKETS ticks are counted exactly, larger ones in SUB_BUCKETS
+// buckets per power of two, so within 1/SUB_BUCKETS (1.6%) of the value.
+// Values of 2**MAX_BITS ticks or more (hours) go into the last bucket.
+static const unsigned SUB_BITS = 6;
+static const unsigned SUB_BUCKETS = 1 << SUB_BITS;
+static const unsigned MAX_BITS = 48;
+static const unsigned BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+static const char *const STAGE_NAMES[DTMF_STAGES] =
+{
+    "copy", "silence", "normalize", "goertzel", "goertzel x16",
+    "classify", "register", "leftover", "parallel", "call"
+};
+
+// The histograms of a single thread.  They are only written by the thread
+// itself, and read by dtmfProfileDump from any thread.
+struct DtmfProfileThread
+{
+    std::atomic<uint64_t> counts[DTMF_STAGES][BUCKETS];
+    std::atomic<uint64_t> total[DTMF_STAGES];
+    std::atomic<uint64_t> max[DTMF_STAGES];
+    // The end of the last lap, 0 before the first mark.
+    uint64_t last;
+    unsigned number;
+};
+
+static unsigned bucketOf(uint64_t ticks)
+{
+    if(ticks < 2 * SUB_BUCKETS)
+        return static_cast<unsigned>(ticks);
+    unsigned shift = 63 - __builtin_clzll(ticks) - SUB_BITS;
+    if(shift + SUB_BITS >= MAX_BITS)
+        return BUCKETS - 1;
+    return shift * SUB_BUCKETS + static_cast<unsigned>(ticks >> shift);
+}
+
+// The largest value counted in bucket.
+static uint64_t bucketTop(unsigned bucket)
+{
+    if(bucket < 2 * SUB_BUCKETS)
+        return bucket;
+    unsigned shift = bucket / SUB_BUCKETS - 1;
+    uint64_t mantissa = bucket - shift * SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+// All the threads that have recorded anything.  They are never freed, so
+// that their histograms survive them.
+static std::mutex threadsMutex;
+static std::vector<DtmfProfileThread *> threads;
+
+static DtmfProfileThread &thisThread()
+{
+    static thread_local DtmfProfileThread *profile = 0;
+    if(!profile)
+    {
+        profile = new DtmfProfileThread();
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        profile->number = threads.size();
+        threads.push_back(profile);
+    }
+    return *profile;
+}
+
+uint64_t dtmfProfileClockNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void dtmfProfileRecord(DtmfProfileStage stage, uint64_t ticks)
+{
+    DtmfProfileThread &profile = thisThread();
+    // Only this thread writes, so a load and a store will do.
+    std::atomic<uint64_t> &count = profile.counts[stage][bucketOf(ticks)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    profile.total[stage].store(profile.total[stage].load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+    if(ticks > profile.max[stage].load(std::memory_order_relaxed))
+        profile.max[stage].store(ticks, std::memory_order_relaxed);
+}
+
+void dtmfProfileMark()
+{
+    thisThread().last = dtmfProfileTicks();
+}
+
+void dtmfProfileLap(DtmfProfileStage stage)
+{
+    DtmfProfileThread &profile = thisThread();
+    uint64_t now = dtmfProfileTicks();
+    if(profile.last)
+        dtmfProfileRecord(stage, now - profile.last);
+    profile.last = now;
+}
+
+// Where the ticks are counted from, to convert them to ns.
+static uint64_t startTicks = dtmfProfileTicks();
+static uint64_t startNs = dtmfProfileClockNs();
+
+static double nsPerTick()
+{
+    // Give the conversion at least 10ms to settle.
+    uint64_t ns;
+    while((ns = dtmfProfileClockNs()) - startNs < 10000000)
+        ;
+    uint64_t ticks = dtmfProfileTicks();
+    return ticks > startTicks ? double(ns - startNs) / (ticks - startTicks) : 1.0;
+}
+
+// The histogram of one stage, summed over some threads.
+struct StageSummary
+{
+    std::vector<uint64_t> counts;
+    uint64_t count, total, max;
+
+    StageSummary() : counts(BUCKETS), count(0), total(0), max(0)
+    {
+    }
+
+    void add(const DtmfProfileThread &profile, unsigned stage)
+    {
+        for(unsigned ii = 0; ii < BUCKETS; ii++)
+        {
+            uint64_t n = profile.counts[stage][ii].load(std::memory_order_relaxed);
+            counts[ii] += n;
+            count += n;
+        }
+        total += profile.total[stage].load(std::memory_order_relaxed);
+        uint64_t m = profile.max[stage].load(std::memory_order_relaxed);
+        if(m > max)
+            max = m;
+    }
+
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t rank = static_cast<uint64_t>(fraction * count + 0.999999), seen = 0;
+        for(unsigned ii = 0; ii < BUCKETS; ii++)
+        {
+            seen += counts[ii];
+            if(seen >= rank && seen > 0)
+                return bucketTop(ii) < max ? bucketTop(ii) : max;
+        }
+        return max;
+    }
+};
+
+static void printStages(std::string &out, const char *who, const std::vector<DtmfProfileThread *> &among, double scale)
+{
+    char line[256];
+    for(unsigned stage = 0; stage < DTMF_STAGES; stage++)
+    {
+        StageSummary summary;
+        for(size_t ii = 0; ii < among.size(); ii++)
+            summary.add(*among[ii], stage);
+        if(!summary.count)
+            continue;
+        snprintf(line, sizeof(line), "%-7s %-13s %12llu %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+                 who, STAGE_NAMES[stage], (unsigned long long)summary.count,
+                 scale * summary.total / summary.count,
+                 scale * summary.percentile(0.5), scale * summary.percentile(0.99),
+                 scale * summary.percentile(0.999), scale * summary.max);
+        out += line;
+    }
+}
+
+void dtmfProfileDump(int fd)
+{
+    std::vector<DtmfProfileThread *> all;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        all = threads;
+    }
+    double scale = nsPerTick();
+    char line[256], number[16];
+    std::string out;
+    snprintf(line, sizeof(line), "dtmf profile: %u threads, %.3f ticks per ns\n"
+             "%-7s %-13s %12s %10s %10s %10s %10s %10s\n",
+             (unsigned)all.size(), 1 / scale,
+             "thread", "stage", "count", "mean ns", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+    out += line;
+    for(size_t ii = 0; ii < all.size(); ii++)
+    {
+        snprintf(number, sizeof(number), "%u", all[ii]->number);
+        printStages(out, number, std::vector<DtmfProfileThread *>(1, all[ii]), scale);
+    }
+    if(all.size() > 1)
+        printStages(out, "all", all, scale);
+
+    for(size_t done = 0; done < out.size(); )
+    {
+        ssize_t n = write(fd, out.data() + done, out.size() - done);
+        if(n <= 0)
+            break;
+        done += n;
+    }
+}
+
+void dtmfProfileReset()
+{
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for(size_t ii = 0; ii < threads.size(); ii++)
+    {
+        for(unsigned stage = 0; stage < DTMF_STAGES; stage++)
+        {
+            for(unsigned bucket = 0; bucket < BUCKETS; bucket++)
+                threads[ii]->counts[stage][bucket].store(0, std::memory_order_relaxed);
+            threads[ii]->total[stage].store(0, std::memory_order_relaxed);
+            threads[ii]->max[stage].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// The histograms are printed to outputFd at exit, and on SIGUSR1.  The
+// signal handler only writes to a pipe; a thread waiting on the other end
+// does the printing.
+static int outputFd = 2;
+static int signalPipe[2] = {-1, -1};
+
+static void onSignal(int)
+{
+    char byte = 0;
+    ssize_t ignored = write(signalPipe[1], &byte, 1);
+    (void)ignored;
+}
+
+static void dumpOnSignals()
+{
+    char byte;
+    while(read(signalPipe[0], &byte, 1) == 1)
+        dtmfProfileDump(outputFd);
+}
+
+static void dumpAtExit()
+{
+    dtmfProfileDump(outputFd);
+}
+
+static struct DtmfProfileSetup
+{
+    DtmfProfileSetup()
+    {
+        const char *path = getenv("DTMF_PROFILE_OUT");
+        if(path)
+        {
+            int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if(fd >= 0)
+                outputFd = fd;
+        }
+        atexit(dumpAtExit);
+        if(pipe(signalPipe) != 0)
+            return;
+        std::thread(dumpOnSignals).detach();
+        struct sigaction action = {};
+        action.sa_handler = onSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, 0);
+    }
+} setup;
+
+#endif
@@ -0,0 +1,109 @@
+//
+// Per-stage timing of the detector, for profiling builds only.
+//
+// Built with -DDTMF_PROFILE (make profile), the stages of
+// DtmfDetector::dtmfDetecting are timed with the CPU's cycle counter, and
+// the times go into a log-linear histogram per stage and thread.  The
+// histograms are printed as count, mean, p50, p99, p99.9 and max in ns:
+//
+// - when the program exits,
+// - on SIGUSR1,
+// - by dtmfProfileDump.
+//
+// They go to stderr, or are appended to the file named by the
+// DTMF_PROFILE_OUT environment variable.  Without DTMF_PROFILE the
+// DTMF_PROFILE_* macros compile to nothing.
+//
+#ifndef DTMF_PROFILE_HPP
+#define DTMF_PROFILE_HPP
+
+#include <stdint.h>
+
+// The stages timed.
+enum DtmfProfileStage
+{
+    // Copying samples: topping up the batch left over from the previous
+    // call, and interleaving batches for the SIMD lanes.
+    DTMF_STAGE_COPY = 0,
+    // The sum of the absolute values of a batch, for the silence check.
+    DTMF_STAGE_SILENCE,
+    // Scaling a batch up to the full 16 bits.
+    DTMF_STAGE_NORMALIZE,
+    // The Goertzel filter bank over a single batch.
+    DTMF_STAGE_GOERTZEL,
+    // The Goertzel filter bank over 16 batches, in SIMD lanes.
+    DTMF_STAGE_GOERTZEL_LANES,
+    // Deciding the push button from the magnitudes.
+    DTMF_STAGE_CLASSIFY,
+    // The onset logic, events, traces and call progress detection.
+    DTMF_STAGE_REGISTER,
+    // Keeping the samples short of a batch for the next call.
+    DTMF_STAGE_LEFTOVER,
+    // Deciding the batches of an input on a DtmfWorkerPool, as seen by
+    // the caller.
+    DTMF_STAGE_PARALLEL,
+    // A whole call to dtmfDetecting.
+    DTMF_STAGE_CALL,
+    DTMF_STAGES
+};
+
+#ifdef DTMF_PROFILE
+
+// Nanoseconds on the monotonic clock.
+uint64_t dtmfProfileClockNs();
+
+// The cycle counter, or nanoseconds where there is none.
+static inline uint64_t dtmfProfileTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return dtmfProfileClockNs();
+#endif
+}
+
+// Start timing a stage on this thread from now.
+void dtmfProfileMark();
+// Record the time since the last mark or lap on this thread for stage,
+// and start timing the next stage.
+void dtmfProfileLap(DtmfProfileStage stage);
+// Record ticks for stage on this thread.
+void dtmfProfileRecord(DtmfProfileStage stage, uint64_t ticks);
+
+// Print the histograms of all the threads so far to fd.
+void dtmfProfileDump(int fd);
+// Empty the histograms of all the threads.
+void dtmfProfileReset();
+
+// Records the time from its construction to its destruction.
+class DtmfProfileScope
+{
+    DtmfProfileStage stage;
+    uint64_t start;
+public:
+    explicit DtmfProfileScope(DtmfProfileStage stage_) : stage(stage_), start(dtmfProfileTicks())
+    {
+    }
+    ~DtmfProfileScope()
+    {
+        dtmfProfileRecord(stage, dtmfProfileTicks() - start);
+    }
+};
+
+#define DTMF_PROFILE_MARK() dtmfProfileMark()
+#define DTMF_PROFILE_LAP(stage) dtmfProfileLap(stage)
+#define DTMF_PROFILE_SCOPE(stage) DtmfProfileScope dtmfProfileScope_(stage)
+
+#else
+
+#define DTMF_PROFILE_MARK() ((void)0)
+#define DTMF_PROFILE_LAP(stage) ((void)0)
+#define DTMF_PROFILE_SCOPE(stage) ((void)0)
+
+#endif
+
+#endif
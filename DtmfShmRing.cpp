@@ -0,0 +1,283 @@
+//
+// The shared memory transport between a media server and dtmfd.
+//
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "DtmfShmRing.hpp"
+
+static const char SHM_MAGIC[8] = { 'D', 'T', 'M', 'F', 'S', 'H', 'M', '1' };
+static const UINT32 SHM_VERSION = 1;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "the rings need address-free atomics");
+static_assert(sizeof(DtmfEvent) == 16, "DtmfEvent is part of the segment layout");
+
+static UINT32 powerOfTwo(UINT32 value)
+{
+    UINT32 size = 1;
+    while(size < value)
+        size <<= 1;
+    return size;
+}
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + 63) & ~(uint64_t)63;
+}
+
+// The futexes are shared between processes, so not FUTEX_PRIVATE.
+static void futexWait(std::atomic<uint32_t> &word, uint32_t value, UINT32 timeoutMs)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, value, &timeout, 0, 0);
+}
+
+static void futexWake(std::atomic<uint32_t> &word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, 0x7fffffff, 0, 0, 0);
+}
+
+DtmfShmRing::DtmfShmRing(void *mapping_, size_t bytes)
+    : mapping(mapping_), mappingBytes(bytes)
+{
+    char *base = static_cast<char *>(mapping);
+    header = reinterpret_cast<Header *>(base);
+    channelState = reinterpret_cast<Channel *>(base + header->channelsOffset);
+    dirty = reinterpret_cast<std::atomic<uint64_t> *>(base + header->dirtyOffset);
+    audio = reinterpret_cast<INT16 *>(base + header->audioOffset);
+    events = reinterpret_cast<DtmfEvent *>(base + header->eventsOffset);
+}
+
+DtmfShmRing::~DtmfShmRing()
+{
+    munmap(mapping, mappingBytes);
+}
+
+DtmfShmRing *DtmfShmRing::create(const char *name, UINT32 channels, UINT32 ringSamples, UINT32 eventCapacity)
+{
+    if(channels == 0)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    ringSamples = powerOfTwo(ringSamples);
+    eventCapacity = powerOfTwo(eventCapacity);
+    uint64_t channelsOffset = alignUp(sizeof(Header));
+    uint64_t dirtyOffset = alignUp(channelsOffset + sizeof(Channel) * (uint64_t)channels);
+    uint64_t audioOffset = alignUp(dirtyOffset + 8 * (uint64_t)((channels + 63) / 64));
+    uint64_t eventsOffset = alignUp(audioOffset + sizeof(INT16) * (uint64_t)ringSamples * channels);
+    uint64_t bytes = eventsOffset + sizeof(DtmfEvent) * (uint64_t)eventCapacity;
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0)
+        return 0;
+    if(ftruncate(fd, bytes) != 0)
+    {
+        int error = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = error;
+        return 0;
+    }
+    void *mem = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+    {
+        int error = errno;
+        shm_unlink(name);
+        errno = error;
+        return 0;
+    }
+
+    // The segment starts out zeroed, which is the initial state of all the
+    // atomics.  The magic goes in last, so that a daemon attaching early
+    // never sees a half-made header.
+    Header *header = new(mem) Header();
+    header->version = SHM_VERSION;
+    header->channels = channels;
+    header->ringSamples = ringSamples;
+    header->eventCapacity = eventCapacity;
+    header->channelsOffset = channelsOffset;
+    header->dirtyOffset = dirtyOffset;
+    header->audioOffset = audioOffset;
+    header->eventsOffset = eventsOffset;
+    header->bytes = bytes;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    return new DtmfShmRing(mem, bytes);
+}
+
+DtmfShmRing *DtmfShmRing::attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0)
+        return 0;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        close(fd);
+        return 0;
+    }
+    void *mem = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+        return 0;
+    const Header *header = static_cast<const Header *>(mem);
+    if(memcmp(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 || header->version != SHM_VERSION
+       || header->bytes != (uint64_t)st.st_size)
+    {
+        munmap(mem, st.st_size);
+        return 0;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return new DtmfShmRing(mem, st.st_size);
+}
+
+void DtmfShmRing::unlink(const char *name)
+{
+    shm_unlink(name);
+}
+
+void DtmfShmRing::startCall(UINT32 channel)
+{
+    Channel &c = channelState[channel];
+    c.callStart.store(c.written.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    c.call.store(c.call.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    dirty[channel / 64].fetch_or((uint64_t)1 << (channel % 64), std::memory_order_release);
+}
+
+UINT32 DtmfShmRing::write(UINT32 channel, const INT16 samples[], UINT32 count)
+{
+    Channel &c = channelState[channel];
+    const UINT32 size = header->ringSamples;
+    uint64_t w = c.written.load(std::memory_order_relaxed);
+    uint64_t space = size - (w - c.read.load(std::memory_order_acquire));
+    if(count > space)
+        count = space;
+    if(count == 0)
+        return 0;
+    INT16 *ring = audio + (uint64_t)channel * size;
+    UINT32 start = w & (size - 1);
+    UINT32 first = count < size - start ? count : size - start;
+    memcpy(ring + start, samples, first * sizeof(INT16));
+    memcpy(ring, samples + first, (count - first) * sizeof(INT16));
+    c.written.store(w + count, std::memory_order_release);
+    dirty[channel / 64].fetch_or((uint64_t)1 << (channel % 64), std::memory_order_release);
+    return count;
+}
+
+void DtmfShmRing::publish()
+{
+    // Sequentially consistent, against the daemon's daemonSleeping store
+    // and audioSeq load: either it sees the new sequence number and does
+    // not sleep, or this sees it sleeping and wakes it.
+    header->audioSeq.fetch_add(1);
+    if(header->daemonSleeping.load())
+        futexWake(header->audioSeq);
+}
+
+void DtmfShmRing::finish()
+{
+    header->finished.store(1, std::memory_order_release);
+    publish();
+}
+
+UINT32 DtmfShmRing::drainEvents(DtmfEvent out[], UINT32 max)
+{
+    UINT32 t = header->eventTail.load(std::memory_order_relaxed);
+    UINT32 count = header->eventHead.load(std::memory_order_acquire) - t;
+    if(count > max)
+        count = max;
+    for(UINT32 ii = 0; ii < count; ii++)
+        out[ii] = events[(t + ii) & (header->eventCapacity - 1)];
+    header->eventTail.store(t + count, std::memory_order_release);
+    return count;
+}
+
+void DtmfShmRing::waitEvents(uint32_t seq, UINT32 timeoutMs)
+{
+    header->consumerSleeping.store(1);
+    if(header->eventSeq.load() == seq)
+        futexWait(header->eventSeq, seq, timeoutMs);
+    header->consumerSleeping.store(0);
+}
+
+UINT32 DtmfShmRing::peek(UINT32 channel, const INT16 *&samples) const
+{
+    const Channel &c = channelState[channel];
+    const UINT32 size = header->ringSamples;
+    uint64_t r = c.read.load(std::memory_order_relaxed);
+    uint64_t available = c.written.load(std::memory_order_acquire) - r;
+    UINT32 start = r & (size - 1);
+    samples = audio + (uint64_t)channel * size + start;
+    return available < size - start ? available : size - start;
+}
+
+UINT32 DtmfShmRing::peek(UINT32 channel, const INT16 *&samples, uint32_t call) const
+{
+    UINT32 count = peek(channel, samples);
+    // peek loaded written with acquire, so a call started before any of
+    // the samples counted were written shows here.
+    if(channelState[channel].call.load(std::memory_order_acquire) != call)
+        return 0;
+    return count;
+}
+
+bool DtmfShmRing::drained() const
+{
+    if(!header->finished.load(std::memory_order_acquire))
+        return false;
+    for(UINT32 ii = 0; ii < header->channels; ii++)
+    {
+        const Channel &c = channelState[ii];
+        if(c.read.load(std::memory_order_relaxed) != c.written.load(std::memory_order_acquire))
+            return false;
+    }
+    return true;
+}
+
+void DtmfShmRing::waitAudio(uint32_t seq, UINT32 timeoutMs)
+{
+    header->daemonSleeping.store(1);
+    if(header->audioSeq.load() == seq)
+        futexWait(header->audioSeq, seq, timeoutMs);
+    header->daemonSleeping.store(0);
+}
+
+void DtmfShmRing::dtmfEvent(const DtmfEvent &event)
+{
+    UINT32 h = header->eventHead.load(std::memory_order_relaxed);
+    if(h - header->eventTail.load(std::memory_order_acquire) >= header->eventCapacity)
+    {
+        header->eventsDropped.store(header->eventsDropped.load(std::memory_order_relaxed) + 1,
+                                    std::memory_order_relaxed);
+        return;
+    }
+    events[h & (header->eventCapacity - 1)] = event;
+    header->eventHead.store(h + 1, std::memory_order_release);
+}
+
+void DtmfShmRing::publishEvents()
+{
+    header->eventSeq.fetch_add(1);
+    if(header->consumerSleeping.load())
+        futexWake(header->eventSeq);
+}
+
+void DtmfShmRing::setDone()
+{
+    header->daemonDone.store(1, std::memory_order_release);
+    publishEvents();
+}
@@ -0,0 +1,225 @@
+#ifndef DTMF_SHM_RING
+#define DTMF_SHM_RING
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "types_cpp.hpp"
+#include "DtmfEventQueue.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int16     INT16;
+
+// A POSIX shared memory segment through which a media server hands the
+// audio of many channels to a detector process (dtmfd), and gets the
+// detected push buttons back, without copies through the kernel.
+//
+// Each channel has a single-producer/single-consumer ring of samples: the
+// media server writes, the daemon runs the channel's detector straight
+// over the mapped samples.  The events go back through a second ring, with
+// the same design as DtmfEventQueue.  Either side sleeps on a futex in
+// the segment when it has nothing to do, and the other side only makes
+// the wake-up system call if it actually sleeps.
+//
+// The media server creates the segment; the daemon attaches to it.
+class DtmfShmRing : public DtmfEventSink
+{
+public:
+    // The start of the segment.  The rest of it is laid out from the
+    // offsets here.
+    struct Header
+    {
+        char magic[8];
+        UINT32 version;
+        UINT32 channels;
+        // Samples per channel ring, and events in the event ring.  Both
+        // are powers of two.
+        UINT32 ringSamples;
+        UINT32 eventCapacity;
+        uint64_t channelsOffset;
+        uint64_t dirtyOffset;
+        uint64_t audioOffset;
+        uint64_t eventsOffset;
+        uint64_t bytes;
+
+        // Bumped by the media server after writing audio, and waited on
+        // by the daemon.
+        alignas(64) std::atomic<uint32_t> audioSeq;
+        std::atomic<uint32_t> daemonSleeping;
+        // Set by the media server when there is no more audio.
+        std::atomic<uint32_t> finished;
+
+        // Bumped by the daemon after publishing events, and waited on by
+        // the media server.
+        alignas(64) std::atomic<uint32_t> eventSeq;
+        std::atomic<uint32_t> consumerSleeping;
+        // Set by the daemon once it has processed all the audio after
+        // finished was set.
+        std::atomic<uint32_t> daemonDone;
+
+        // The event ring's indices, as in DtmfEventQueue.
+        alignas(64) std::atomic<uint32_t> eventHead;
+        std::atomic<uint32_t> eventsDropped;
+        alignas(64) std::atomic<uint32_t> eventTail;
+    };
+
+    // The positions in a channel's ring.  They count samples since the
+    // segment was created, and are never wrapped.
+    struct Channel
+    {
+        // Written by the media server.
+        alignas(64) std::atomic<uint64_t> written;
+        // Where the current call started, and a count of the calls.
+        std::atomic<uint64_t> callStart;
+        std::atomic<uint32_t> call;
+        // Written by the daemon.
+        alignas(64) std::atomic<uint64_t> read;
+    };
+
+    // Create the segment name (e.g. "/dtmfd"), replacing any old one.
+    // ringSamples and eventCapacity are rounded up to powers of two.
+    // Returns 0 on failure, with errno set.
+    static DtmfShmRing *create(const char *name, UINT32 channels, UINT32 ringSamples, UINT32 eventCapacity);
+    // Attach to a segment made by create.  Returns 0 if there is none, or
+    // it is not one this version can use.
+    static DtmfShmRing *attach(const char *name);
+    // Remove the segment name.  Mappings stay valid until unmapped.
+    static void unlink(const char *name);
+    // Unmaps the segment.
+    ~DtmfShmRing();
+
+    UINT32 channels() const
+    {
+        return header->channels;
+    }
+    UINT32 ringSamples() const
+    {
+        return header->ringSamples;
+    }
+
+    //
+    // The media server's side.
+    //
+
+    // Start a new call on channel: the daemon resets its detector and
+    // skips any samples of the previous call it has not read yet.  Call
+    // before writing the call's first samples.
+    void startCall(UINT32 channel);
+    // Append up to count samples to channel's ring.  Returns the number
+    // appended, fewer than count if the ring is full.  The daemon only
+    // looks at them after publish.
+    UINT32 write(UINT32 channel, const INT16 samples[], UINT32 count);
+    // Let the daemon know about everything written since the last
+    // publish.  Costs a system call only if the daemon is asleep.
+    void publish();
+    // No more audio will be written.
+    void finish();
+    // Move up to max events into out, oldest first.  Returns how many.
+    UINT32 drainEvents(DtmfEvent out[], UINT32 max);
+    // The event sequence number, to pass to waitEvents.
+    uint32_t eventSequence() const
+    {
+        return header->eventSeq.load();
+    }
+    // Sleep until the event sequence number moves on from seq, or for at
+    // most timeoutMs.
+    void waitEvents(uint32_t seq, UINT32 timeoutMs);
+    // True once the daemon has processed all the audio after finish.
+    bool daemonDone() const
+    {
+        return header->daemonDone.load(std::memory_order_acquire) != 0;
+    }
+    UINT32 eventsDropped() const
+    {
+        return header->eventsDropped.load(std::memory_order_relaxed);
+    }
+
+    //
+    // The daemon's side.
+    //
+
+    // The number of 64-bit words in the bitmap of channels written to.
+    UINT32 dirtyWords() const
+    {
+        return (header->channels + 63) / 64;
+    }
+    // Take the bits of channels 64 * word to 64 * word + 63 that have been
+    // written to (or had a call started) since the last take.
+    uint64_t takeDirty(UINT32 word)
+    {
+        return dirty[word].exchange(0, std::memory_order_acq_rel);
+    }
+    // Mark channel as written to again, so that the next take sees the
+    // audio left unread in this pass.
+    void markDirty(UINT32 channel)
+    {
+        dirty[channel / 64].fetch_or((uint64_t)1 << (channel % 64), std::memory_order_relaxed);
+    }
+    // The call number of channel.  When it changes, the daemon resets the
+    // channel's detector and calls skipToCall.
+    uint32_t call(UINT32 channel) const
+    {
+        return channelState[channel].call.load(std::memory_order_acquire);
+    }
+    // Skip the unread samples before the current call's start.  The read
+    // position never moves back: the previous call's detector may already
+    // have read past the start (see peek with a call number), and the
+    // space behind it may already hold new samples.
+    void skipToCall(UINT32 channel)
+    {
+        Channel &c = channelState[channel];
+        uint64_t start = c.callStart.load(std::memory_order_acquire);
+        if(start > c.read.load(std::memory_order_relaxed))
+            c.read.store(start, std::memory_order_release);
+    }
+    // The longest contiguous run of unread samples of channel, in place in
+    // the ring.  Returns its length, 0 if there is nothing to read.
+    UINT32 peek(UINT32 channel, const INT16 *&samples) const;
+    // The same, but nothing once a call after call (the call number the
+    // daemon last saw) has started: the media server may start one at any
+    // time, the rest of the old call is skipped anyway (see startCall), and
+    // the new call's samples are not for the old call's detector.
+    UINT32 peek(UINT32 channel, const INT16 *&samples, uint32_t call) const;
+    // Mark count samples read, giving their space back to the media
+    // server.
+    void consume(UINT32 channel, UINT32 count)
+    {
+        Channel &c = channelState[channel];
+        c.read.store(c.read.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+    // True once the media server has finished and all the audio is read.
+    bool drained() const;
+    // The audio sequence number, to pass to waitAudio.
+    uint32_t audioSequence() const
+    {
+        return header->audioSeq.load();
+    }
+    // Sleep until the audio sequence number moves on from seq, or for at
+    // most timeoutMs.
+    void waitAudio(uint32_t seq, UINT32 timeoutMs);
+    // Publish an event to the media server.  It sees it after
+    // publishEvents.  Events that do not fit are counted as dropped.
+    void dtmfEvent(const DtmfEvent &event);
+    // Wake the media server if it waits for events.
+    void publishEvents();
+    // Tell the media server all the audio has been processed.
+    void setDone();
+
+private:
+    void *mapping;
+    size_t mappingBytes;
+    Header *header;
+    Channel *channelState;
+    std::atomic<uint64_t> *dirty;
+    INT16 *audio;
+    DtmfEvent *events;
+
+    DtmfShmRing(void *mapping_, size_t bytes);
+
+    // Not copyable
+    DtmfShmRing(const DtmfShmRing &);
+    DtmfShmRing &operator=(const DtmfShmRing &);
+};
+
+#endif
@@ -0,0 +1,80 @@
+//
+// The byte encoding of detector and generator snapshots (see
+// DtmfDetector::saveState and DtmfGenerator::saveState).  Values are
+// written little-endian whatever the host, so that a snapshot can be
+// restored in another process or on another machine.
+//
+#ifndef DTMF_STATE
+#define DTMF_STATE
+
+#include <stdint.h>
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+
+class DtmfStateWriter
+{
+    unsigned char *out;
+    UINT32 size;
+    UINT32 used;
+public:
+    DtmfStateWriter(unsigned char out_[], UINT32 size_) : out(out_), size(size_), used(0)
+    {
+    }
+
+    void put(uint64_t value, unsigned bytes)
+    {
+        for(unsigned ii = 0; ii < bytes; ii++, value >>= 8)
+        {
+            if(used < size)
+                out[used] = static_cast<unsigned char>(value);
+            used++;
+        }
+    }
+
+    // The number of bytes written, or 0 if they did not all fit.
+    UINT32 finish() const
+    {
+        return used <= size ? used : 0;
+    }
+};
+
+class DtmfStateReader
+{
+    const unsigned char *in;
+    UINT32 size;
+    UINT32 used;
+public:
+    DtmfStateReader(const unsigned char in_[], UINT32 size_) : in(in_), size(size_), used(0)
+    {
+    }
+
+    // An unsigned value of bytes bytes, or 0 past the end.
+    uint64_t get(unsigned bytes)
+    {
+        uint64_t value = 0;
+        for(unsigned ii = 0; ii < bytes; ii++, used++)
+        {
+            if(used < size)
+                value |= static_cast<uint64_t>(in[used]) << (8 * ii);
+        }
+        return value;
+    }
+
+    // A signed value of bytes bytes.
+    int64_t getSigned(unsigned bytes)
+    {
+        uint64_t value = get(bytes);
+        unsigned shift = 64 - 8 * bytes;
+        return static_cast<int64_t>(value << shift) >> shift;
+    }
+
+    // True if everything read was there, and nothing is left over.
+    bool finish() const
+    {
+        return used == size;
+    }
+};
+
+#endif
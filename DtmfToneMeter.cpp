@@ -0,0 +1,156 @@
+//
+// Per-digit level, twist, SNR and duration, from the detector's own
+// magnitudes.
+//
+
+#include <cmath>
+#include <cstring>
+#include "DtmfToneMeter.hpp"
+
+const unsigned DtmfToneMeter::FREQUENCIES;
+
+// The number of samples in a batch, as in DtmfDetector.
+static const double SAMPLES = 102;
+
+// The level of a full-scale sine in dBm0 (G.711).
+static const double FULL_SCALE_DBM0 = 3.17;
+
+// The SNR reported when the other bins are all empty.
+static const double MAX_SNR = 120;
+
+// A sine of amplitude A over a batch gets a magnitude of
+// (A * SAMPLES / 2)**2 / 2**20 (see CallProgressDetector::classify), so a
+// power (magnitude scaled back to the input) of p is a sine of amplitude
+// sqrt(p) * 2**11 / SAMPLES.
+static double amplitude(double power)
+{
+    return sqrt(power) * 2048 / SAMPLES;
+}
+
+static double dbm0(double power)
+{
+    double a = amplitude(power);
+    return a > 0 ? 20 * log10(a / 32768) + FULL_SCALE_DBM0 : -INFINITY;
+}
+
+DtmfToneMeter::DtmfToneMeter(DtmfMetricsSink *sink_)
+    : sink(sink_)
+{
+    reset();
+}
+
+void DtmfToneMeter::reset()
+{
+    memset(previous, 0, sizeof(previous));
+    previousValid = false;
+    previousDecision = ' ';
+    inTone = false;
+    digit = 0;
+    channel = 0;
+}
+
+void DtmfToneMeter::process(char decision, const INT32 T[], UINT32 bins, INT32 row_, INT32 column_, INT32 shift,
+                            const float gains[], uint64_t sample, UINT32 channel_)
+{
+    // The magnitudes were of the batch scaled up by shift bits.
+    double scale = ldexp(1.0, -2 * shift);
+    channel = channel_;
+    // The power of the tone at frequency ii.
+#define POWER(ii) (fmax(T[ii], 0) * scale / (gains ? gains[ii] : 1))
+    if(inTone && decision == ' ')
+    {
+        float trail = 0;
+        if(T)
+            trail = amplitude(POWER(row)) + amplitude(POWER(column));
+        finishTone(trail);
+    }
+    else if(decision != ' ' && (inTone || previousDecision == ' '))
+    {
+        // The onset logic of DtmfDetector: a tone that follows a silent
+        // batch is registered as a push button in its second batch.
+        if(!inTone)
+        {
+            inTone = true;
+            digit = 0;
+            start = sample;
+            batches = 0;
+            row = row_;
+            column = column_;
+            leadAmplitude = 0;
+            if(previousValid && row < (INT32)FREQUENCIES && column < (INT32)FREQUENCIES)
+                leadAmplitude = amplitude(previous[row]) + amplitude(previous[column]);
+            for(unsigned ii = 0; ii < 3; ii++)
+                innerPowers[ii] = allPowers[ii] = 0;
+            otherBins = bins - 2;
+        }
+        else
+        {
+            if(batches == 1)
+                digit = decision;
+            // The last batch is not the last any more.
+            if(batches >= 2)
+                for(unsigned ii = 0; ii < 3; ii++)
+                    innerPowers[ii] += lastPowers[ii];
+        }
+        double other = 0;
+        for(UINT32 ii = 0; ii < bins; ii++)
+            if((INT32)ii != row && (INT32)ii != column)
+                other += fmax(T[ii], 0);
+        lastPowers[0] = POWER(row);
+        lastPowers[1] = POWER(column);
+        lastPowers[2] = other * scale;
+        for(unsigned ii = 0; ii < 3; ii++)
+            allPowers[ii] += lastPowers[ii];
+        lastAmplitude = amplitude(lastPowers[0]) + amplitude(lastPowers[1]);
+        if(batches == 0)
+            firstAmplitude = lastAmplitude;
+        batches++;
+    }
+
+    previousDecision = decision;
+    previousValid = T != 0;
+    if(T)
+        for(UINT32 ii = 0; ii < FREQUENCIES && ii < bins; ii++)
+            previous[ii] = POWER(ii);
+#undef POWER
+}
+
+void DtmfToneMeter::finish()
+{
+    if(inTone)
+        finishTone(0);
+}
+
+void DtmfToneMeter::finishTone(float trailAmplitude)
+{
+    inTone = false;
+    if(!digit || !sink)
+        return;
+    // The batches between the first and the last are taken to be wholly
+    // covered by the tone.  The amplitude at a partly covered one is in
+    // proportion to the part covered.
+    UINT32 inner = batches - 2;
+    const double *powers = inner ? innerPowers : allPowers;
+    UINT32 count = inner ? inner : batches;
+    double full = amplitude(powers[0] / count) + amplitude(powers[1] / count);
+    if(!inner)
+        full = fmax(firstAmplitude, lastAmplitude);
+    double covered = inner;
+    const float edges[] = { leadAmplitude, firstAmplitude, lastAmplitude, trailAmplitude };
+    for(unsigned ii = 0; ii < 4; ii++)
+        covered += full > 0 ? fmin(1.0, edges[ii] / full) : 1;
+
+    DtmfDigitMetrics metrics;
+    metrics.sample = start;
+    metrics.channel = channel;
+    metrics.digit = digit;
+    metrics.batches = batches;
+    metrics.duration = static_cast<UINT32>(covered * SAMPLES + 0.5);
+    metrics.lowLevel = dbm0(powers[0] / count);
+    metrics.highLevel = dbm0(powers[1] / count);
+    metrics.twist = metrics.highLevel - metrics.lowLevel;
+    double tones = (powers[0] + powers[1]) / 2;
+    double others = otherBins ? powers[2] / otherBins : 0;
+    metrics.snr = others > 0 ? fmin(MAX_SNR, 10 * log10(tones / others)) : MAX_SNR;
+    sink->dtmfDigitMetrics(metrics);
+}
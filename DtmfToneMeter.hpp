@@ -0,0 +1,121 @@
+#ifndef DTMF_TONE_METER
+#define DTMF_TONE_METER
+
+#include <stdint.h>
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int32     INT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+
+// How a push button was signalled, for finding gateways that send them
+// too quiet, too short or with too much twist.
+struct DtmfDigitMetrics
+{
+    // As in the DtmfEvent of the push button.
+    uint64_t sample;
+    UINT32 channel;
+    char digit;
+    // The number of batches the tone was detected in.
+    UINT32 batches;
+    // How long the tone lasted, in samples.  The batches at either edge of
+    // the tone count for the part of them it covered, as estimated from
+    // their magnitudes against those of the batches in between.
+    UINT32 duration;
+    // The levels of the low (row) and high (column) tones in dBm0, taking
+    // a full-scale 16-bit sine as +3.17dBm0, as G.711 does.  For MF, the
+    // lower and higher frequencies of the pair.
+    float lowLevel;
+    float highLevel;
+    // highLevel - lowLevel, in dB.
+    float twist;
+    // The mean power of the two tones against the mean power of the other
+    // bins of the filter bank (the other frequencies, and the harmonics
+    // for DTMF), in dB.
+    float snr;
+};
+
+// Receives the metrics of each push button once its tone has ended.
+// Called from within DtmfDetector::dtmfDetecting, on the detection thread.
+class DtmfMetricsSink
+{
+public:
+    virtual ~DtmfMetricsSink()
+    {
+    }
+    virtual void dtmfDigitMetrics(const DtmfDigitMetrics &metrics) = 0;
+};
+
+// Measures the level, twist, signal to noise ratio and duration of each
+// push button, from the Goertzel magnitudes and normalization shift the
+// detector has already computed for every batch: no extra pass over the
+// samples.
+//
+// Attach one to a DtmfDetector with setToneMeter.  The object holds the
+// state of a single channel.
+class DtmfToneMeter
+{
+    // The most frequencies a push button is made of: the 8 of DTMF.
+    static const unsigned FREQUENCIES = 8;
+
+    DtmfMetricsSink *sink;
+
+    // The power of each frequency in the previous batch, scaled back to
+    // the input's level, and whether it was measured (it is not for a
+    // silent batch).
+    float previous[FREQUENCIES];
+    bool previousValid;
+    char previousDecision;
+
+    // The tone in progress, if inTone: where it started, its push button
+    // once registered, and its frequencies.
+    bool inTone;
+    char digit;
+    uint64_t start;
+    UINT32 channel;
+    UINT32 batches;
+    INT32 row;
+    INT32 column;
+    // The amplitude of the tone's frequencies in the batch before the tone,
+    // in its first batch and in its last one so far.
+    float leadAmplitude;
+    float firstAmplitude;
+    float lastAmplitude;
+    // The powers of the last batch so far: of the two frequencies, and of
+    // all the other bins together.
+    double lastPowers[3];
+    // The sums of those powers over the batches between the first and the
+    // last, and over all the batches of the tone.
+    double innerPowers[3];
+    double allPowers[3];
+    UINT32 otherBins;
+
+    void finishTone(float trailAmplitude);
+public:
+    DtmfToneMeter(DtmfMetricsSink *sink_=0);
+
+    // Forget everything seen so far (not the sink).
+    void reset();
+
+    // Publish the metrics of each push button to sink.
+    void setSink(DtmfMetricsSink *sink_)
+    {
+        sink = sink_;
+    }
+
+    // Process the decision on a batch.  T holds the magnitudes of the
+    // bins of the filter bank (the frequencies first, then any harmonics),
+    // or is 0 for a silent batch.  row and column are the strongest
+    // frequencies, and shift the number of bits the batch was scaled up by
+    // before filtering.  gains, if not 0, is the power each frequency's
+    // bin gets from a tone at that frequency, relative to a bin centred on
+    // it.  sample is the position of the batch.
+    void process(char decision, const INT32 T[], UINT32 bins, INT32 row, INT32 column, INT32 shift,
+                 const float gains[], uint64_t sample, UINT32 channel);
+
+    // The input has ended: publish the push button whose tone lasted up to
+    // its end, if any.
+    void finish();
+};
+
+#endif
@@ -0,0 +1,59 @@
+//
+// Per-batch trace records of the detector's decisions.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "DtmfTrace.hpp"
+
+static_assert(sizeof(DtmfTraceRecord) == 88, "the trace file format changed");
+
+const UINT32 DtmfTraceFile::FILE_HEADER;
+
+DtmfTraceFile::DtmfTraceFile(const char *path, UINT32 capacity_)
+    : fd(-1), mapping(0), mappingBytes(0), capacity(capacity_ ? capacity_ : 1)
+{
+    mappingBytes = FILE_HEADER + sizeof(DtmfTraceRecord) * capacity;
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return;
+    if(ftruncate(fd, mappingBytes) != 0)
+        return;
+    void *mem = mmap(0, mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED)
+        return;
+    mapping = static_cast<char *>(mem);
+
+    UINT32 recordSize = sizeof(DtmfTraceRecord);
+    memcpy(mapping, "DTMFTRC1", 8);
+    memcpy(mapping + 8, &recordSize, 4);
+    memcpy(mapping + 12, &capacity, 4);
+    written = reinterpret_cast<volatile uint64_t *>(mapping + 16);
+    *written = 0;
+    records = reinterpret_cast<DtmfTraceRecord *>(mapping + FILE_HEADER);
+}
+
+DtmfTraceFile::~DtmfTraceFile()
+{
+    if(mapping)
+        munmap(mapping, mappingBytes);
+    if(fd >= 0)
+        close(fd);
+}
+
+DtmfTraceFile *DtmfTraceFile::forThisThread(const char *directory, UINT32 capacity)
+{
+    static thread_local std::unique_ptr<DtmfTraceFile> file;
+    if(!file)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/dtmf-trace-%ld.bin", directory, (long)syscall(SYS_gettid));
+        file.reset(new DtmfTraceFile(path, capacity));
+    }
+    return file->good() ? file.get() : 0;
+}
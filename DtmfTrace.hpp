@@ -0,0 +1,117 @@
+#ifndef DTMF_TRACE
+#define DTMF_TRACE
+
+#include <atomic>
+#include <stdint.h>
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int32     INT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+
+// Why DTMF_detection did not find a push button in a batch.
+enum DtmfRejection
+{
+    // A push button was found.
+    DTMF_ACCEPTED = 0,
+    // The batch is too quiet.
+    DTMF_REJECT_SILENCE,
+    // The strongest row or column frequency is too weak compared to the
+    // average of the other DTMF frequencies.
+    DTMF_REJECT_WEAK,
+    // The strongest row and column frequencies differ too much in level.
+    DTMF_REJECT_TWIST,
+    // A harmonic is too strong.
+    DTMF_REJECT_HARMONICS,
+    // Another DTMF frequency is too strong.
+    DTMF_REJECT_DIAL_TONES
+};
+
+// What DTMF_detection saw in a single batch.
+struct DtmfTraceRecord
+{
+    // The position of the batch in the channel's audio.
+    uint64_t sample;
+    // The channel number given to DtmfDetector::setEventSink.
+    UINT32 channel;
+    // The Goertzel magnitudes (all 0 for silence).
+    INT32 T[18];
+    // The index in T of the strongest row and column frequencies, or -1
+    // if the batch was rejected before they were determined.
+    signed char row;
+    signed char column;
+    // The push button detected, ' ' if none.
+    char decision;
+    // A DtmfRejection.
+    unsigned char reason;
+};
+
+// Receives a record for every batch a detector processes.  dtmfTrace is
+// called from within DtmfDetector::dtmfDetecting, on the detection thread.
+class DtmfTraceSink
+{
+public:
+    virtual ~DtmfTraceSink()
+    {
+    }
+    virtual void dtmfTrace(const DtmfTraceRecord &record) = 0;
+};
+
+// Writes trace records into a ring in a memory-mapped file: the file
+// always holds the most recent records, and can be read (e.g. by
+// scripts/plot_T.py) while it is being written.  Writing a record is a
+// copy into the mapping; the kernel writes the pages back in its own time.
+//
+// The file starts with a FILE_HEADER-byte header:
+//
+//  offset  size
+//  0       8       magic, "DTMFTRC1"
+//  8       4       record size, sizeof(DtmfTraceRecord)
+//  12      4       capacity, in records
+//  16      8       number of records written so far
+//
+// followed by the records.  Record n is stored at index n % capacity.
+// Integers are in the byte order of the machine writing the file.
+//
+// A DtmfTraceFile must only be written by a single thread.
+class DtmfTraceFile : public DtmfTraceSink
+{
+    int fd;
+    char *mapping;
+    size_t mappingBytes;
+    UINT32 capacity;
+    volatile uint64_t *written;
+    DtmfTraceRecord *records;
+
+    // Not copyable
+    DtmfTraceFile(const DtmfTraceFile &);
+    DtmfTraceFile &operator=(const DtmfTraceFile &);
+public:
+    static const UINT32 FILE_HEADER = 64;
+
+    // Create (or truncate) the file at path, with room for capacity
+    // records.  good() tells whether that worked.
+    DtmfTraceFile(const char *path, UINT32 capacity);
+    ~DtmfTraceFile();
+
+    bool good() const
+    {
+        return mapping != 0;
+    }
+
+    void dtmfTrace(const DtmfTraceRecord &record)
+    {
+        uint64_t n = *written;
+        records[n % capacity] = record;
+        // Readers must not see the new count before the record itself.
+        std::atomic_thread_fence(std::memory_order_release);
+        *written = n + 1;
+    }
+
+    // The trace file of the calling thread, in directory: created on the
+    // first call as dtmf-trace-<thread id>.bin, and closed when the thread
+    // exits.  Returns 0 if the file could not be created.
+    static DtmfTraceFile *forThisThread(const char *directory, UINT32 capacity=65536);
+};
+
+#endif
@@ -0,0 +1,88 @@
+//
+// Threads deciding the batches of a large input in parallel.
+//
+
+#include "DtmfWorkerPool.hpp"
+
+DtmfWorkerPool::DtmfWorkerPool(unsigned threads_)
+    : parts(threads_ ? threads_ : std::thread::hardware_concurrency()),
+      generation(0), pending(0), stopping(false)
+{
+    if(parts == 0)
+        parts = 1;
+    // The caller works on part 0.
+    for(unsigned part = 1; part < parts; part++)
+        threads.push_back(std::thread(&DtmfWorkerPool::run, this, part));
+}
+
+DtmfWorkerPool::~DtmfWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startCond.notify_all();
+    for(size_t ii = 0; ii < threads.size(); ii++)
+        threads[ii].join();
+}
+
+void DtmfWorkerPool::classify(const DtmfDetector &detector_, const INT16 samples_[], UINT32 batches_,
+                              const DtmfDetectorConfig &config_, char decisions_[])
+{
+    // Parts are whole multiples of the lanes, so that only the last part
+    // has batches that don't fill the lanes.
+    UINT32 lanes = DtmfDetector::laneBatches();
+    UINT32 partBatches_ = (batches_ + parts - 1) / parts;
+    partBatches_ = (partBatches_ + lanes - 1) / lanes * lanes;
+    if(parts < 2 || batches_ <= partBatches_)
+    {
+        detector_.classifyBatches(samples_, batches_, config_, decisions_);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        detector = &detector_;
+        samples = samples_;
+        batches = batches_;
+        partBatches = partBatches_;
+        config = &config_;
+        decisions = decisions_;
+        pending = parts - 1;
+        generation++;
+    }
+    startCond.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    while(pending > 0)
+        doneCond.wait(lock);
+}
+
+void DtmfWorkerPool::work(unsigned part)
+{
+    UINT32 first = part * partBatches;
+    if(first >= batches)
+        return;
+    UINT32 count = batches - first < partBatches ? batches - first : partBatches;
+    detector->classifyBatches(&samples[first * DtmfDetector::batchSamples()], count, *config, &decisions[first]);
+}
+
+void DtmfWorkerPool::run(unsigned part)
+{
+    unsigned long seen = 0;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(generation == seen && !stopping)
+                startCond.wait(lock);
+            if(stopping)
+                return;
+            seen = generation;
+        }
+        work(part);
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--pending == 0)
+            doneCond.notify_one();
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef DTMF_WORKER_POOL
+#define DTMF_WORKER_POOL
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DtmfDetector.hpp"
+
+// A fixed set of threads that decide the batches of a large input in
+// parallel (see DtmfDetector::dtmfDetecting with a pool).  The threads are
+// started once and wait between inputs.
+//
+// A pool serves a single caller at a time.
+class DtmfWorkerPool
+{
+public:
+    // threads is the total number of threads working on an input,
+    // including the caller; threads - 1 are started.  0 means one per CPU.
+    explicit DtmfWorkerPool(unsigned threads=0);
+    ~DtmfWorkerPool();
+
+    unsigned size() const
+    {
+        return parts;
+    }
+
+    // detector.classifyBatches over batches batches, split into parts of
+    // whole multiples of DtmfDetector::laneBatches() batches.  Returns once
+    // all the decisions are made.
+    void classify(const DtmfDetector &detector, const INT16 samples[], UINT32 batches,
+                  const DtmfDetectorConfig &config, char decisions[]);
+private:
+    unsigned parts;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable startCond;
+    std::condition_variable doneCond;
+    // Bumped for every input; the threads wait for it to change.
+    unsigned long generation;
+    unsigned pending;
+    bool stopping;
+
+    // The input being decided.
+    const DtmfDetector *detector;
+    const INT16 *samples;
+    UINT32 batches;
+    UINT32 partBatches;
+    const DtmfDetectorConfig *config;
+    char *decisions;
+
+    void run(unsigned part);
+    void work(unsigned part);
+
+    // Not copyable
+    DtmfWorkerPool(const DtmfWorkerPool &);
+    DtmfWorkerPool &operator=(const DtmfWorkerPool &);
+};
+
+#endif
@@ -0,0 +1,60 @@
+//
+// G.711 mu-law and A-law decoding.
+//
+
+#include "G711.hpp"
+
+static INT16 ulawToLinear(unsigned char u)
+{
+    u = ~u;
+    int t = ((u & 0x0f) << 3) + 0x84;
+    t <<= (u & 0x70) >> 4;
+    return static_cast<INT16>((u & 0x80) ? 0x84 - t : t - 0x84);
+}
+
+static INT16 alawToLinear(unsigned char a)
+{
+    a ^= 0x55;
+    int t = (a & 0x0f) << 4;
+    int segment = (a & 0x70) >> 4;
+    if(segment == 0)
+        t += 8;
+    else
+        t = (t + 0x108) << (segment - 1);
+    return static_cast<INT16>((a & 0x80) ? t : -t);
+}
+
+// Both laws decode through a table, built on first use.
+struct G711Tables
+{
+    INT16 ulaw[256];
+    INT16 alaw[256];
+    G711Tables()
+    {
+        for(unsigned ii = 0; ii < 256; ii++)
+        {
+            ulaw[ii] = ulawToLinear(static_cast<unsigned char>(ii));
+            alaw[ii] = alawToLinear(static_cast<unsigned char>(ii));
+        }
+    }
+};
+
+static const G711Tables &tables()
+{
+    static const G711Tables t;
+    return t;
+}
+
+void ulawDecode(const unsigned char in[], size_t count, INT16 out[])
+{
+    const INT16 *table = tables().ulaw;
+    for(size_t ii = 0; ii < count; ii++)
+        out[ii] = table[in[ii]];
+}
+
+void alawDecode(const unsigned char in[], size_t count, INT16 out[])
+{
+    const INT16 *table = tables().alaw;
+    for(size_t ii = 0; ii < count; ii++)
+        out[ii] = table[in[ii]];
+}
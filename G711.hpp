@@ -0,0 +1,14 @@
+#ifndef G711
+#define G711
+
+#include <stddef.h>
+#include "types_cpp.hpp"
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int16     INT16;
+
+// Decode count G.711 mu-law (PCMU, RTP payload type 0) or A-law (PCMA,
+// payload type 8) bytes into 16-bit linear samples.
+void ulawDecode(const unsigned char in[], size_t count, INT16 out[]);
+void alawDecode(const unsigned char in[], size_t count, INT16 out[]);
+
+#endif
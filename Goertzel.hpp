@@ -0,0 +1,130 @@
+//
+// The Goertzel filter shared by the detectors.  See DtmfDetector.cpp.
+//
+#ifndef DTMF_GOERTZEL
+#define DTMF_GOERTZEL
+
+#include "types_cpp.hpp"
+
+
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int32     INT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint32    UINT32;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Int16     INT16;
+typedef Types<sizeof(long int), sizeof(int), sizeof(short int), sizeof(char)>::Uint16    UINT16;
+
+// This is the same function as in DtmfGenerator.cpp
+//
+// Detectors built on the same fixed-point Goertzel filter include this file.
+static inline INT32 MPY48SR(INT16 o16, INT32 o32)
+{
+    UINT32   Temp0;
+    INT32    Temp1;
+    Temp0 = (((UINT16)o32 * o16) + 0x4000) >> 15;
+    Temp1 = (INT16)(o32 >> 16) * o16;
+    return (Temp1 << 1) + Temp0;
+}
+
+// The Goertzel algorithm.
+// For a good description and walkthrough, see:
+// https://sites.google.com/site/hobbydebraj/home/goertzel-algorithm-dtmf-detection
+//
+// Koeff0           Coefficient for the first frequency.
+// Koeff1           Coefficient for the second frequency.
+// arraySamples     Input samples to process.  Must be COUNT elements long.
+// Magnitude0       Detected magnitude of the first frequency.
+// Magnitude1       Detected magnitude of the second frequency.
+// COUNT            The number of elements in arraySamples.  Always equal to
+//                  SAMPLES in practice.
+static inline void goertzel_filter(INT16 Koeff0, INT16 Koeff1, const INT16 arraySamples[], INT32 *Magnitude0, INT32 *Magnitude1, UINT32 COUNT)
+{
+    INT32 Temp0, Temp1;
+    UINT16 ii;
+    // Vk1_0    prev (first frequency)
+    // Vk2_0    prev_prev (first frequency)
+    //
+    // Vk1_1    prev (second frequency)
+    // Vk2_0    prev_prev (second frequency)
+    INT32 Vk1_0 = 0, Vk2_0 = 0, Vk1_1 = 0, Vk2_1 = 0;
+
+    // Iterate over all the input samples
+    // For each sample, process the two frequencies we're interested in:
+    // output = Input + 2*coeff*prev - prev_prev
+    // N.B. bit-shifting to the left achieves the multiplication by 2.
+    for(ii = 0; ii < COUNT; ++ii)
+    {
+        Temp0 = MPY48SR(Koeff0, Vk1_0 << 1) - Vk2_0 + arraySamples[ii],
+        Temp1 = MPY48SR(Koeff1, Vk1_1 << 1) - Vk2_1 + arraySamples[ii];
+        Vk2_0 = Vk1_0,
+        Vk2_1 = Vk1_1;
+        Vk1_0 = Temp0,
+        Vk1_1 = Temp1;
+    }
+
+    // Magnitude: prev_prev**prev_prev + prev*prev - coeff*prev*prev_prev
+
+    // TODO: what does shifting by 10 bits to the right achieve?  Probably to
+    // make room for the magnitude calculations.
+    Vk1_0 >>= 10,
+              Vk1_1 >>= 10,
+                        Vk2_0 >>= 10,
+                                  Vk2_1 >>= 10;
+    Temp0 = MPY48SR(Koeff0, Vk1_0 << 1),
+    Temp1 = MPY48SR(Koeff1, Vk1_1 << 1);
+    Temp0 = (INT16)Temp0 * (INT16)Vk2_0,
+    Temp1 = (INT16)Temp1 * (INT16)Vk2_1;
+    Temp0 = (INT16)Vk1_0 * (INT16)Vk1_0 + (INT16)Vk2_0 * (INT16)Vk2_0 - Temp0;
+    Temp1 = (INT16)Vk1_1 * (INT16)Vk1_1 + (INT16)Vk2_1 * (INT16)Vk2_1 - Temp1;
+    *Magnitude0 = Temp0,
+     *Magnitude1 = Temp1;
+    return;
+}
+
+// goertzel_filter over LANES independent inputs at once, written so that
+// the compiler can keep one input per SIMD lane.  The magnitudes are
+// exactly those goertzel_filter finds for each input on its own.
+//
+// arraySamples     The inputs, interleaved: arraySamples[ii][lane] is
+//                  sample ii of input lane.
+// Magnitude0       LANES magnitudes of the first frequency.
+// Magnitude1       LANES magnitudes of the second frequency.
+template <unsigned LANES>
+static inline void goertzel_filter_lanes(INT16 Koeff0, INT16 Koeff1, const INT16 arraySamples[][LANES], INT32 Magnitude0[], INT32 Magnitude1[], UINT32 COUNT)
+{
+    INT32 Vk1_0[LANES], Vk2_0[LANES], Vk1_1[LANES], Vk2_1[LANES];
+    UINT32 ii, lane;
+    for(lane = 0; lane < LANES; lane++)
+        Vk1_0[lane] = Vk2_0[lane] = Vk1_1[lane] = Vk2_1[lane] = 0;
+
+    for(ii = 0; ii < COUNT; ++ii)
+    {
+        for(lane = 0; lane < LANES; lane++)
+        {
+            // MPY48SR, spelled out on 32-bit lanes: the high and low halves
+            // of the state times the coefficient, the low one rounded.
+            INT32 V0 = Vk1_0[lane] * 2, V1 = Vk1_1[lane] * 2;
+            UINT32 Temp0 = ((UINT32)((V0 >> 16) * Koeff0) << 1) + (UINT32)((((V0 & 0xffff) * Koeff0) + 0x4000) >> 15);
+            UINT32 Temp1 = ((UINT32)((V1 >> 16) * Koeff1) << 1) + (UINT32)((((V1 & 0xffff) * Koeff1) + 0x4000) >> 15);
+            Temp0 += (UINT32)arraySamples[ii][lane] - (UINT32)Vk2_0[lane];
+            Temp1 += (UINT32)arraySamples[ii][lane] - (UINT32)Vk2_1[lane];
+            Vk2_0[lane] = Vk1_0[lane];
+            Vk2_1[lane] = Vk1_1[lane];
+            Vk1_0[lane] = (INT32)Temp0;
+            Vk1_1[lane] = (INT32)Temp1;
+        }
+    }
+
+    // The magnitudes, as in goertzel_filter.
+    for(lane = 0; lane < LANES; lane++)
+    {
+        INT32 A0 = Vk1_0[lane] >> 10, B0 = Vk2_0[lane] >> 10;
+        INT32 A1 = Vk1_1[lane] >> 10, B1 = Vk2_1[lane] >> 10;
+        INT32 Temp0 = MPY48SR(Koeff0, A0 << 1);
+        INT32 Temp1 = MPY48SR(Koeff1, A1 << 1);
+        Temp0 = (INT16)Temp0 * (INT16)B0;
+        Temp1 = (INT16)Temp1 * (INT16)B1;
+        Magnitude0[lane] = (INT16)A0 * (INT16)A0 + (INT16)B0 * (INT16)B0 - Temp0;
+        Magnitude1[lane] = (INT16)A1 * (INT16)A1 + (INT16)B1 * (INT16)B1 - Temp1;
+    }
+}
+
+#endif
@@ -1,152 +1,761 @@
 //
 // Utilize the DtmfDetector to detect tones in an AU file.
-// The file must be 8KHz, PCM encoded, mono.
+// The file must be 8KHz, PCM encoded, mono.  A stereo file is taken as
+// the two legs of a call, detected together (see DtmfLegPair).
+//
+// The input may also be a stream: stdin (-), a FIFO, a UNIX domain socket
+// or raw samples (-r), e.g. from ffmpeg ... -f s16le -ar 8000 -ac 1 - |
+// detect-au -r s16le -.  Each push button is then printed as soon as it is
+// detected, and memory stays the same however long the stream runs.
 //
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
+#include <deque>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
+#include <vector>
 
+#include <cerrno>
 #include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
+#include "AuFile.hpp"
+#include "ChunkReader.hpp"
 #include "DtmfDetector.hpp"
+#include "DtmfGrammar.hpp"
+#include "DtmfLegPair.hpp"
+#include "DtmfToneMeter.hpp"
+#include "DtmfWorkerPool.hpp"
+#include "G711.hpp"
 
 //
-// The string ".snd" in big-endian byte ordering.  This identifies the file as
-// an AU sound file.
+// The size of the buffer we use for processing the audio samples.
 //
-#define AU_MAGIC 0x2e736e64
+#define BUFLEN 256
 
 //
-// The size of the buffer we use for reading & processing the audio samples.
+// The file is read ahead in chunks of CHUNKLEN bytes, with up to
+// CHUNKS of them in memory at a time.
 //
-#define BUFLEN 256
+#define CHUNKLEN (1 << 20)
+#define CHUNKS 3
+
+//
+// A stream is read through a buffer of STREAMLEN bytes, whatever its
+// length.
+//
+#define STREAMLEN (1 << 18)
 
 using namespace std;
 
 //
-// Swap the endianness of an 4-byte integer.
+// The sample formats of a stream, as ffmpeg names them.  All are 8KHz
+// mono.
 //
-uint32_t
-swap32(uint32_t a)
+enum StreamFormat
+{
+    FORMAT_S16LE,
+    FORMAT_S16BE,
+    FORMAT_S8,
+    FORMAT_U8,
+    FORMAT_MULAW,
+    FORMAT_ALAW
+};
+
+static bool
+parse_format(const char *name, StreamFormat &format)
+{
+    static const char *const NAMES[] = { "s16le", "s16be", "s8", "u8", "mulaw", "alaw" };
+    for (size_t ii = 0; ii < sizeof(NAMES) / sizeof(NAMES[0]); ++ii)
+    {
+        if (strcmp(name, NAMES[ii]) == 0)
+        {
+            format = (StreamFormat)ii;
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t
+sample_bytes(StreamFormat format)
 {
-    char b1, b2, b3, b4 = 0;
-    b1 = a;
-    b2 = a >> 8;
-    b3 = a >> 16;
-    b4 = a >> 24;
-    return (b1 << 24) + (b2 << 16) + (b3 << 8) + b4;
+    return format == FORMAT_S16LE || format == FORMAT_S16BE ? 2 : 1;
 }
 
-struct au_header
+//
+// Decode count samples.  8-bit PCM is shifted up, as for AU files.
+//
+static void
+decode_samples(StreamFormat format, const unsigned char *in, size_t count, short *out)
+{
+    switch (format)
+    {
+    case FORMAT_S16LE:
+        for (size_t k = 0; k < count; ++k)
+            out[k] = (short)(in[2 * k] | in[2 * k + 1] << 8);
+        break;
+    case FORMAT_S16BE:
+        for (size_t k = 0; k < count; ++k)
+            out[k] = (short)(in[2 * k] << 8 | in[2 * k + 1]);
+        break;
+    case FORMAT_S8:
+        for (size_t k = 0; k < count; ++k)
+            out[k] = (signed char)in[k] << 8;
+        break;
+    case FORMAT_U8:
+        for (size_t k = 0; k < count; ++k)
+            out[k] = (in[k] - 128) << 8;
+        break;
+    case FORMAT_MULAW:
+        ulawDecode(in, count, out);
+        break;
+    case FORMAT_ALAW:
+        alawDecode(in, count, out);
+        break;
+    }
+}
+
+//
+// Prints what the detector's dial buttons array would hold after each
+// BUFLEN-sample buffer, given the push buttons detected.
+//
+class ButtonLines : public DtmfEventSink
+{
+    // The position of each push button, in batches, in order.
+    deque<uint64_t> batches;
+    deque<char> digits;
+    // As in DtmfDetectorInterface: the index is reset for every buffer, the
+    // array is not.
+    char buttons[DtmfDetector::NUMBER_OF_BUTTONS];
+    int index;
+    uint64_t printed;
+    // Also gets every event, if set.
+    DtmfEventSink *next;
+public:
+    ButtonLines(DtmfEventSink *next_) : index(0), printed(0), next(next_)
+    {
+        buttons[0] = 0;
+    }
+
+    void dtmfEvent(const DtmfEvent &event)
+    {
+        //
+        // A push button is registered at the end of the batch after the one
+        // it started in.
+        //
+        batches.push_back(event.sample / DtmfDetector::batchSamples() + 1);
+        digits.push_back(event.digit);
+        if (next)
+            next->dtmfEvent(event);
+    }
+
+    //
+    // Print the lines of the buffers before buffer end.
+    //
+    void print(uint64_t end)
+    {
+        for (; printed < end; printed++)
+        {
+            index = 0;
+            //
+            // The buttons registered in batches that end in this buffer.
+            //
+            while (!batches.empty() && ((batches.front() + 1) * DtmfDetector::batchSamples() - 1) / BUFLEN == printed)
+            {
+                buttons[index++] = digits.front();
+                buttons[index] = 0;
+                if (index >= 64)
+                    index = 0;
+                batches.pop_front();
+                digits.pop_front();
+            }
+            cout << printed * BUFLEN << ": `" << buttons << "'" << endl;
+        }
+    }
+};
+
+//
+// Prints each push button of a stream as soon as it is detected, with the
+// sample its tone starts at.
+//
+class StreamEvents : public DtmfEventSink
+{
+    // Also gets every event, if set.
+    DtmfEventSink *next;
+public:
+    StreamEvents(DtmfEventSink *next_) : next(next_)
+    {
+    }
+
+    void dtmfEvent(const DtmfEvent &event)
+    {
+        cout << event.sample << ": `" << event.digit << "'\n";
+        if (next)
+            next->dtmfEvent(event);
+    }
+};
+
+//
+// Prints the outcome of the -g patterns.
+//
+class GrammarOutcome : public DtmfGrammarListener
 {
-    uint32_t magic;
-    uint32_t header_size;
-    uint32_t nsamples;
-    uint32_t encoding;
-    uint32_t sample_rate;
-    uint32_t nchannels;
+    const DtmfGrammar &grammar;
+public:
+    GrammarOutcome(const DtmfGrammar &grammar_) : grammar(grammar_)
+    {
+    }
+
+    void grammarMatch(UINT32, UINT32 pattern, uint64_t sample)
+    {
+        cout << "grammar: match `" << grammar.pattern(pattern) << "' at " << sample << endl;
+    }
+
+    void grammarNoMatch(UINT32, uint64_t sample)
+    {
+        cout << "grammar: no match at " << sample << endl;
+    }
 };
 
-string
-au_header_tostr(au_header &h)
+static int64_t
+now_ms()
 {
-    stringstream ss;
-    ss << h.header_size << " header bytes, " << 
-        h.nsamples << " samples, encoding type: " << h.encoding << ", " 
-        << h.sample_rate << "Hz, " << h.nchannels << " channels";
-    return ss.str();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-int
-main(int argc, char **argv)
+//
+// Open fname as a stream: stdin for -, a connection for a UNIX domain
+// socket, and the file itself otherwise.  Returns -1 on failure.
+//
+static int
+open_stream(const char *fname)
 {
-    if (argc != 2)
+    if (strcmp(fname, "-") == 0)
+        return 0;
+    struct stat st;
+    if (stat(fname, &st) != 0 || !S_ISSOCK(st.st_mode))
+        return open(fname, O_RDONLY);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(fname) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, fname);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
     {
-        cerr << "usage: " << argv[0] << " filename.au" << endl;
-        return 1;
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+//
+// Detect the push buttons of the stream open on fd, as they come.  Unless
+// raw gives its format, the stream must start with an AU header (whose
+// length may be unknown, ~0).
+//
+// The stream is read as fast as it comes, as much as is there at a time.
+// What has been read is detected once latency_ms have passed since its
+// first byte arrived, or as soon as the buffer is full, whichever comes
+// first: the detector gets large inputs when the stream is ahead (e.g. a
+// file being transcoded), and no push button waits more than latency_ms
+// on a live one.  The push buttons detected are flushed after each round.
+//
+static int
+detect_stream(const char *fname, int fd, const StreamFormat *raw, unsigned latency_ms,
+              DtmfDetector &detector, DtmfGrammarMatcher *matcher, DtmfWorkerPool &pool)
+{
+    StreamFormat format = raw ? *raw : FORMAT_S8;
+    bool header_done = raw != NULL;
+    //
+    // The bytes of the AU header's annotation still to skip, and of audio
+    // still to come (if the header says).
+    //
+    uint64_t skip = 0;
+    uint64_t left = UINT64_MAX;
+    vector<unsigned char> buf(STREAMLEN);
+    vector<short> sbuf(STREAMLEN);
+    size_t have = 0;
+    //
+    // Whether bytes have arrived since the last round, and by when they are
+    // to be detected.
+    //
+    bool armed = false;
+    int64_t deadline = 0;
+    bool eof = false;
+    uint64_t fed = 0;
+    while (!eof && !(matcher && matcher->decided(0)))
+    {
+        if (have < buf.size())
+        {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            int timeout = armed ? (int)max<int64_t>(0, deadline - now_ms()) : -1;
+            int ready = poll(&pfd, 1, timeout);
+            if (ready < 0 && errno != EINTR)
+            {
+                cerr << fname << ": " << strerror(errno) << endl;
+                return 1;
+            }
+            if (ready > 0)
+            {
+                ssize_t n = read(fd, &buf[have], buf.size() - have);
+                if (n < 0 && errno != EINTR && errno != EAGAIN)
+                {
+                    cerr << fname << ": " << strerror(errno) << endl;
+                    return 1;
+                }
+                if (n == 0)
+                    eof = true;
+                if (n > 0)
+                {
+                    if (!armed)
+                        deadline = now_ms() + latency_ms;
+                    armed = true;
+                    have += n;
+                }
+            }
+            if (!eof && have < buf.size() && (!armed || now_ms() < deadline))
+                continue;
+        }
+        armed = false;
+
+        size_t used = 0;
+        if (!header_done)
+        {
+            if (have < sizeof(AuHeader))
+            {
+                if (eof)
+                {
+                    cerr << fname << ": no AU header" << endl;
+                    return 1;
+                }
+                continue;
+            }
+            AuHeader header;
+            if (!decodeAuHeader(&buf[0], header))
+            {
+                cerr << "bad magic number: " << hex << header.magic << endl;
+                return 1;
+            }
+            cout << fname << ": " << auHeaderToString(header) << endl;
+            if (header.header_size < sizeof(AuHeader) || header.sample_rate != 8000 || header.nchannels != 1
+                || (header.encoding != AU_ENCODING_PCM8 && header.encoding != AU_ENCODING_PCM16
+                    && header.encoding != AU_ENCODING_MULAW))
+            {
+                cerr << fname << ": unsupported AU format" << endl;
+                return 1;
+            }
+            format = header.encoding == AU_ENCODING_PCM16 ? FORMAT_S16BE
+                : header.encoding == AU_ENCODING_MULAW ? FORMAT_MULAW : FORMAT_S8;
+            skip = header.header_size - sizeof(AuHeader);
+            if (header.nsamples != ~(uint32_t)0)
+                left = header.nsamples;
+            used = sizeof(AuHeader);
+            header_done = true;
+        }
+        size_t skipped = (size_t)min<uint64_t>(skip, have - used);
+        used += skipped;
+        skip -= skipped;
+
+        size_t bytes = (size_t)min<uint64_t>(have - used, left);
+        size_t count = bytes / sample_bytes(format);
+        bytes = count * sample_bytes(format);
+        decode_samples(format, &buf[used], count, &sbuf[0]);
+        used += bytes;
+        if (left != UINT64_MAX)
+            left -= bytes;
+        if (left == 0)
+            eof = true;
+        //
+        // Keep what is short of a sample for the next round.
+        //
+        memmove(&buf[0], &buf[used], have - used);
+        have -= used;
+
+        if (!matcher)
+        {
+            detector.dtmfDetecting(&sbuf[0], count, pool);
+            fed += count;
+        }
+        for (size_t done = 0; matcher && done < count && !matcher->decided(0); done += BUFLEN)
+        {
+            size_t n = min<size_t>(BUFLEN, count - done);
+            detector.dtmfDetecting(&sbuf[done], n);
+            fed += n;
+            matcher->advance(0, fed);
+        }
+        cout.flush();
+    }
+    //
+    // A batch of silence after the end, for a tone that lasts up to it to
+    // be registered.
+    //
+    if (!matcher || !matcher->decided(0))
+    {
+        sbuf.assign(DtmfDetector::batchSamples(), 0);
+        detector.dtmfDetecting(&sbuf[0], sbuf.size());
+    }
+    if (matcher)
+        matcher->timeout(0, fed);
+    cout.flush();
+    return 0;
+}
+
+//
+// Prints the metrics of each push button (-M).
+//
+class MetricsLines : public DtmfMetricsSink
+{
+public:
+    void dtmfDigitMetrics(const DtmfDigitMetrics &m)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "metrics: `%c' at %llu: %u samples (%u batches), low %.1fdBm0, high %.1fdBm0, "
+                 "twist %.1fdB, snr %.1fdB", m.digit, (unsigned long long)m.sample, m.duration, m.batches,
+                 m.lowLevel, m.highLevel, m.twist, m.snr);
+        cout << line << '\n';
     }
+};
 
-    ifstream fin(argv[1], ios::binary);
-    if (!fin.good())
+//
+// Prints each push button of a two-leg recording, with the leg it was
+// sent on.
+//
+class LegEvents : public DtmfEventSink
+{
+public:
+    void dtmfEvent(const DtmfEvent &event)
     {
-        cerr << argv[1] << ": unable to open file" << endl;
+        cout << event.sample << ": leg " << event.channel << " `" << event.digit << "'" << endl;
+    }
+};
+
+//
+// Detect the push buttons of a stereo AU file, with one leg of the call
+// in each channel, dropping the echoes of each leg's push buttons in the
+// other.
+//
+static int
+detect_legs(const char *fname, int fd, const AuHeader &header, unsigned echo_ms,
+            DtmfDetector &near, DtmfDetector &far)
+{
+    LegEvents events;
+    DtmfLegPair pair(near, far);
+    pair.setEventSink(&events, 0, 1);
+    pair.setEchoWindow((uint64_t)echo_ms * 8);
+
+    ChunkReader reader(fd, header.header_size, header.nsamples, CHUNKLEN, CHUNKS);
+    if (!reader.start())
+    {
+        cerr << fname << ": unable to allocate read buffers" << endl;
         return 1;
     }
-    au_header header;
-    fin.read((char *)&header, sizeof(au_header));
+    //
+    // The channels are interleaved, and chunks hold whole frames.
+    //
+    size_t width = header.encoding == AU_ENCODING_PCM16 ? 2 : 1;
+    vector<short> legs[2];
+    ChunkReader::Chunk chunk;
+    while (reader.next(chunk))
+    {
+        size_t frames = chunk.size / (2 * width);
+        for (unsigned leg = 0; leg < 2; ++leg)
+        {
+            legs[leg].resize(frames + 1);
+            const unsigned char *in = (const unsigned char *)chunk.data + leg * width;
+            for (size_t k = 0; k < frames; ++k, in += 2 * width)
+                legs[leg][k] = width == 2 ? (short)(in[0] << 8 | in[1]) : (signed char)in[0] << 8;
+        }
+        reader.release();
+        pair.dtmfDetecting(&legs[0][0], &legs[1][0], frames);
+    }
+    if (reader.getError())
+    {
+        cerr << fname << ": " << strerror(reader.getError()) << endl;
+        return 1;
+    }
+    //
+    // The last batch is padded with silence, and no more push buttons are
+    // coming.
+    //
+    for (unsigned leg = 0; leg < 2; ++leg)
+        legs[leg].assign(DtmfDetector::batchSamples(), 0);
+    pair.dtmfDetecting(&legs[0][0], &legs[1][0], DtmfDetector::batchSamples());
+    pair.flush();
+    cout << "echoes: " << pair.getEchoes() << endl;
+    close(fd);
+    return 0;
+}
 
+int
+main(int argc, char **argv)
+{
+    //
+    // -t directory     Write a trace record for every batch to a file in
+    //                  directory (see DtmfTraceFile and scripts/plot_T.py)
+    // -j threads       Detect on this many threads (default 1, 0 for one
+    //                  per CPU).  The output does not depend on it.
+    // -g pattern       Match the push buttons against pattern (see
+    //                  DtmfGrammar; may be given more than once), and stop
+    //                  as soon as the outcome is decided
+    // -T ms            With -g, decide on the push buttons so far after
+    //                  this long without another one (default 3000)
+    // -r format        The input is raw samples, 8KHz mono: s16le, s16be,
+    //                  s8, u8, mulaw or alaw.  Implies streaming.
+    // -l ms            When streaming, the longest a push button may wait
+    //                  to be printed once its audio is in (default 20)
+    // -M               Print the level, twist, SNR and duration of each
+    //                  push button once its tone ends (see DtmfToneMeter)
+    // -e ms            With a stereo file, the longest delay between a
+    //                  push button and its echo in the other leg (default
+    //                  128)
     //
-    // The data in the AU file header is stored in big-endian byte ordering.
-    // If we're on a little-endian machine, we need to reorder the bytes.
-    // While other arrangements (e.g. middle-endian) are also technically
-    // possible, this example does not support them, since they are relatively
-    // rare.
+    // A filename of - is stdin.  The input is streamed when it is not a
+    // regular file.  -g, -j and -M apply to mono input.
     //
-    if (header.magic == AU_MAGIC)
+    const char *trace_dir = NULL;
+    vector<string> patterns;
+    unsigned timeout_ms = 3000;
+    StreamFormat raw_format;
+    bool raw = false;
+    unsigned latency_ms = 20;
+    bool metrics = false;
+    unsigned echo_ms = DtmfLegPair::DEFAULT_ECHO_WINDOW / 8;
+    unsigned threads = 1;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:j:g:T:r:l:Me:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            trace_dir = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'g':
+            patterns.push_back(optarg);
+            break;
+        case 'T':
+            timeout_ms = atoi(optarg);
+            break;
+        case 'r':
+            raw = true;
+            bad_usage = bad_usage || !parse_format(optarg, raw_format);
+            break;
+        case 'l':
+            latency_ms = atoi(optarg);
+            break;
+        case 'M':
+            metrics = true;
+            break;
+        case 'e':
+            echo_ms = atoi(optarg);
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc - optind != 1)
+    {
+        cerr << "usage: " << argv[0] << " [-t tracedir] [-j threads] [-g pattern]... [-T ms] [-r format] [-l ms] [-M] [-e ms] filename.au|-" << endl;
+        return 1;
+    }
+    const char *fname = argv[optind];
+    DtmfGrammar grammar;
+    string error;
+    if (!patterns.empty() && !grammar.compile(patterns, error))
+    {
+        cerr << error << endl;
+        return 1;
+    }
+    GrammarOutcome outcome(grammar);
+    DtmfGrammarMatcher matcher(grammar, 1, &outcome);
+    matcher.setInterDigitTimeout((uint64_t)timeout_ms * 8);
+
+    DtmfDetector detector(BUFLEN);
+    if (trace_dir)
+    {
+        DtmfTraceFile *trace = DtmfTraceFile::forThisThread(trace_dir);
+        if (!trace)
+        {
+            cerr << trace_dir << ": unable to create trace file" << endl;
+            return 1;
+        }
+        detector.setTraceSink(trace);
+    }
+    DtmfWorkerPool pool(threads);
+    MetricsLines metrics_lines;
+    DtmfToneMeter meter(&metrics_lines);
+    if (metrics)
+        detector.setToneMeter(&meter);
+
+    struct stat st;
+    if (raw || strcmp(fname, "-") == 0 || (stat(fname, &st) == 0 && !S_ISREG(st.st_mode)))
     {
+        int fd = open_stream(fname);
+        if (fd < 0)
+        {
+            cerr << fname << ": unable to open stream" << endl;
+            return 1;
+        }
+        StreamEvents events(patterns.empty() ? NULL : &matcher);
+        detector.setEventSink(&events);
+        int status = detect_stream(fname, fd, raw ? &raw_format : NULL, latency_ms, detector,
+                                   patterns.empty() ? NULL : &matcher, pool);
+        meter.finish();
+        cout.flush();
+        return status;
     }
-    else if (header.magic == swap32(AU_MAGIC))
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
     {
-        header.header_size = swap32(header.header_size);
-        header.nsamples = swap32(header.nsamples);
-        header.encoding = swap32(header.encoding);
-        header.sample_rate = swap32(header.sample_rate);
-        header.nchannels = swap32(header.nchannels);
+        cerr << fname << ": unable to open file" << endl;
+        return 1;
     }
-    else
+    AuHeader header;
+    if (!readAuHeader(fd, header))
     {
         cerr << "bad magic number: " << hex << header.magic << endl;
         return 1;
     }
 
-    cout << argv[1] << ": " << au_header_tostr(header) << endl;
+    cout << fname << ": " << auHeaderToString(header) << endl;
     //
     // This example only supports a specific type of AU format:
     //
-    // - no additional data in the header
-    // - linear PCM encoding
+    // - 8-bit linear PCM encoding, or 16-bit as written by DtmfCapture
+    //   (whose header carries an annotation)
     // - 8KHz sample rate
-    // - mono
+    // - mono, or stereo with a leg of a call in each channel
     //
     if 
     (
-        header.header_size != 24
+        header.header_size < 24
         ||
-        header.encoding != 2
+        (header.encoding != AU_ENCODING_PCM8 && header.encoding != AU_ENCODING_PCM16)
         ||
         header.sample_rate != 8000
         ||
-        header.nchannels != 1
+        (header.nchannels != 1 && header.nchannels != 2)
     )
     {
-        cerr << argv[1] << ": unsupported AU format" << endl;
+        cerr << fname << ": unsupported AU format" << endl;
         return 1;
     }
+    if (header.nchannels == 2)
+    {
+        detector.setToneMeter(NULL);
+        DtmfDetector far(BUFLEN);
+        if (trace_dir)
+            far.setTraceSink(DtmfTraceFile::forThisThread(trace_dir));
+        return detect_legs(fname, fd, header, echo_ms, detector, far);
+    }
 
-    char cbuf[BUFLEN];
-    short sbuf[BUFLEN];
-    DtmfDetector detector(BUFLEN);
-    for (uint32_t i = 0; i < header.nsamples; i += BUFLEN)
+    //
+    // Whole chunks are passed to the detector at once, which lets it
+    // process many batches in parallel.  The push buttons come back as
+    // events, and are printed per BUFLEN samples as if each buffer had been
+    // passed on its own.
+    //
+    ButtonLines lines(patterns.empty() ? NULL : &matcher);
+    detector.setEventSink(&lines);
+
+    //
+    // The samples are read on a separate thread, a few chunks ahead of the
+    // detection, so that waiting for the disk overlaps with the detection
+    // of the chunks already read.
+    //
+    ChunkReader reader(fd, header.header_size, header.nsamples, CHUNKLEN, CHUNKS);
+    if (!reader.start())
     {
-        fin.read(cbuf, BUFLEN);
+        cerr << fname << ": unable to allocate read buffers" << endl;
+        return 1;
+    }
+    vector<short> sbuf;
+    ChunkReader::Chunk chunk;
+    uint64_t fed = 0;
+    while (reader.next(chunk))
+    {
+        //
+        // Promote our 8-bit samples to 16 bits, since that's what the
+        // detector expects.  Shift them left during promotion, since the
+        // decoder won't pick them up otherwise (volume too low).  16-bit
+        // samples are big-endian (and chunks hold whole samples).
+        //
+        if (header.encoding == AU_ENCODING_PCM16)
+        {
+            sbuf.resize(chunk.size / 2);
+            for (size_t k = 0; k < sbuf.size(); ++k)
+                sbuf[k] = (short)((unsigned char)chunk.data[2 * k] << 8 | (unsigned char)chunk.data[2 * k + 1]);
+        }
+        else
+        {
+            sbuf.resize(chunk.size);
+            for (size_t k = 0; k < chunk.size; ++k)
+                sbuf[k] = (signed char)chunk.data[k] << 8;
+        }
+        reader.release();
+        if (patterns.empty())
+        {
+            detector.dtmfDetecting(&sbuf[0], sbuf.size(), pool);
+            fed += sbuf.size();
+            lines.print(fed / BUFLEN);
+            continue;
+        }
         //
-        // Promote our 8-bit samples to 16 bits, since that's what the detector
-        // expects.  Shift them left during promotion, since the decoder won't
-        // pick them up otherwise (volume too low).
+        // With patterns, a buffer at a time, to stop as soon as their
+        // outcome is decided.
         //
-        for (int j = 0; j < BUFLEN; ++j)
-            sbuf[j] = cbuf[j] << 8;
-        detector.zerosIndexDialButton();
-        detector.dtmfDetecting(sbuf);
-        cout << i << ": `" << detector.getDialButtonsArray() << "'" << endl;
+        for (size_t done = 0; done < sbuf.size() && !matcher.decided(0); done += BUFLEN)
+        {
+            size_t n = min<size_t>(BUFLEN, sbuf.size() - done);
+            detector.dtmfDetecting(&sbuf[done], n);
+            fed += n;
+            matcher.advance(0, fed);
+            lines.print(fed / BUFLEN);
+        }
+        if (matcher.decided(0))
+            break;
     }
+    if (reader.getError())
+    {
+        cerr << fname << ": " << strerror(reader.getError()) << endl;
+        return 1;
+    }
+    //
+    // The last buffer is padded with silence.
+    //
+    if (fed % BUFLEN && !matcher.decided(0))
+    {
+        sbuf.assign(BUFLEN - fed % BUFLEN, 0);
+        detector.dtmfDetecting(&sbuf[0], sbuf.size());
+        lines.print(fed / BUFLEN + 1);
+    }
+    //
+    // No more push buttons are coming.
+    //
+    if (!patterns.empty())
+        matcher.timeout(0, fed);
+    meter.finish();
     cout << endl;
-    fin.close();
+    close(fd);
 
     return 0;
 }
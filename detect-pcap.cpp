@@ -0,0 +1,881 @@
+//
+// Detect DTMF in the RTP streams of a pcap (or pcapng) capture.
+//
+// Streams are told apart by SSRC.  G.711 (PCMU and PCMA) payloads are put
+// back in sequence number order, decoded, and run through a DtmfDetector,
+// one stream per thread.  RFC 4733 telephone-event packets are extracted
+// as well.  The output is a single timeline of both kinds of digits:
+//
+//  <seconds since the first packet> <ssrc> <source> -> <destination> <kind> <digit> [<duration ms>]
+//
+// where kind is "inband" for digits found in the audio and "rfc4733" for
+// telephone events.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DtmfDetector.hpp"
+#include "DtmfEventQueue.hpp"
+#include "G711.hpp"
+
+using namespace std;
+
+//
+// The number of samples passed to the detector at a time (20ms).
+//
+#define FRAMELEN 160
+
+//
+// Gaps in a stream up to this many samples are filled with silence.  Longer
+// ones (e.g. a timestamp reset) are skipped over.
+//
+#define MAX_GAP (8000 * 5)
+
+//
+// Gaps up to this many samples (a few lost packets) are concealed instead:
+// the last period of the audio before the gap is repeated, so that a lost
+// packet does not split a tone in two.  The period is looked for in the
+// last HISTORY samples.
+//
+#define MAX_CONCEAL 480
+#define HISTORY 480
+#define MIN_PERIOD 20
+
+#define PT_PCMU 0
+#define PT_PCMA 8
+
+//
+// What the capture says about a single RTP packet.  The payload stays in
+// the mapped file.
+//
+struct Packet
+{
+    // Capture time, in ns since the epoch.
+    uint64_t time;
+    // Offset and size of the payload in the file.
+    uint64_t payload;
+    uint32_t size;
+    uint32_t timestamp;
+    uint16_t seq;
+    uint8_t pt;
+};
+
+struct Stream
+{
+    uint32_t ssrc;
+    string source;
+    string destination;
+    vector<Packet> audio;
+    vector<Packet> events;
+    // Packets of payload types we can't decode.
+    uint64_t unsupported;
+};
+
+//
+// A digit on the merged timeline.
+//
+struct Digit
+{
+    uint64_t time;
+    const Stream *stream;
+    bool inband;
+    char digit;
+    // For telephone events, in ms.
+    uint32_t duration;
+};
+
+static bool
+digit_less(const Digit &a, const Digit &b)
+{
+    if (a.time != b.time)
+        return a.time < b.time;
+    return a.stream->ssrc < b.stream->ssrc;
+}
+
+//
+// Reading the capture.
+//
+struct Capture
+{
+    const unsigned char *data;
+    uint64_t size;
+    // The -e option, or -1 to guess.
+    int event_pt;
+    vector<Stream> streams;
+    unordered_map<uint32_t, size_t> by_ssrc;
+    uint64_t packets;
+    uint64_t rtp_packets;
+    uint64_t first_time;
+};
+
+static inline uint16_t
+be16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t
+be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+//
+// Consider the UDP payload at p (len bytes) as RTP.  Addresses are only
+// formatted for the first packet of a stream.
+//
+static void
+rtp_packet(Capture &cap, uint64_t time, const unsigned char *p, uint32_t len,
+           int family, const unsigned char *src, const unsigned char *dst,
+           uint16_t sport, uint16_t dport)
+{
+    if (len < 12 || (p[0] >> 6) != 2)
+        return;
+    uint8_t pt = p[1] & 0x7f;
+    uint32_t header = 12 + (p[0] & 0x0f) * 4;
+    if (p[0] & 0x10)
+    {
+        if (len < header + 4)
+            return;
+        header += 4 + be16(p + header + 2) * 4;
+    }
+    uint32_t padding = (p[0] & 0x20) ? p[len - 1] : 0;
+    if (len < header + padding)
+        return;
+    uint32_t size = len - header - padding;
+
+    bool audio = pt == PT_PCMU || pt == PT_PCMA;
+    bool event;
+    if (cap.event_pt >= 0)
+        event = pt == cap.event_pt;
+    else
+        event = pt >= 96 && size > 0 && size % 4 == 0 && size <= 64;
+    if (!audio && !event && (pt >= 72 && pt <= 76))
+        return;     // RTCP
+
+    uint32_t ssrc = be32(p + 8);
+    unordered_map<uint32_t, size_t>::iterator it = cap.by_ssrc.find(ssrc);
+    Stream *stream;
+    if (it == cap.by_ssrc.end())
+    {
+        if (!audio && !event)
+            return;
+        cap.by_ssrc[ssrc] = cap.streams.size();
+        cap.streams.push_back(Stream());
+        stream = &cap.streams.back();
+        stream->ssrc = ssrc;
+        stream->unsupported = 0;
+        char a[INET6_ADDRSTRLEN], b[INET6_ADDRSTRLEN];
+        inet_ntop(family, src, a, sizeof(a));
+        inet_ntop(family, dst, b, sizeof(b));
+        const char *fmt = family == AF_INET6 ? "[%s]:%u" : "%s:%u";
+        char buf[INET6_ADDRSTRLEN + 10];
+        snprintf(buf, sizeof(buf), fmt, a, sport);
+        stream->source = buf;
+        snprintf(buf, sizeof(buf), fmt, b, dport);
+        stream->destination = buf;
+    }
+    else
+    {
+        stream = &cap.streams[it->second];
+    }
+
+    Packet packet;
+    packet.time = time;
+    packet.payload = (p + header) - cap.data;
+    packet.size = size;
+    packet.timestamp = be32(p + 4);
+    packet.seq = be16(p + 2);
+    packet.pt = pt;
+    if (audio)
+        stream->audio.push_back(packet);
+    else if (event)
+        stream->events.push_back(packet);
+    else
+        stream->unsupported++;
+    cap.rtp_packets++;
+}
+
+//
+// Dig the UDP payload out of an IPv4 or IPv6 packet.
+//
+static void
+ip_packet(Capture &cap, uint64_t time, const unsigned char *p, uint32_t len)
+{
+    if (len < 1)
+        return;
+    int family;
+    const unsigned char *src, *dst;
+    if ((p[0] >> 4) == 4)
+    {
+        uint32_t ihl = (p[0] & 0x0f) * 4;
+        if (len < 20 || ihl < 20 || len < ihl)
+            return;
+        uint32_t total = be16(p + 2);
+        // A total length short of the header is malformed: len would wrap.
+        if (total < ihl)
+            return;
+        if (total < len)
+            len = total;
+        // Fragments are not reassembled.
+        if ((be16(p + 6) & 0x3fff) != 0 || p[9] != 17)
+            return;
+        family = AF_INET;
+        src = p + 12;
+        dst = p + 16;
+        p += ihl;
+        len -= ihl;
+    }
+    else if ((p[0] >> 4) == 6)
+    {
+        if (len < 40)
+            return;
+        uint32_t payload = be16(p + 4);
+        if (payload + 40 < len)
+            len = payload + 40;
+        uint8_t next = p[6];
+        family = AF_INET6;
+        src = p + 8;
+        dst = p + 24;
+        p += 40;
+        len -= 40;
+        // Hop-by-hop, routing and destination options headers.
+        while (next == 0 || next == 43 || next == 60)
+        {
+            if (len < 8 || len < (uint32_t)(p[1] + 1) * 8)
+                return;
+            uint32_t ext = (p[1] + 1) * 8;
+            next = p[0];
+            p += ext;
+            len -= ext;
+        }
+        if (next != 17)
+            return;
+    }
+    else
+    {
+        return;
+    }
+    if (len < 8)
+        return;
+    uint16_t sport = be16(p);
+    uint16_t dport = be16(p + 2);
+    uint32_t udplen = be16(p + 4);
+    if (udplen >= 8 && udplen < len)
+        len = udplen;
+    rtp_packet(cap, time, p + 8, len - 8, family, src, dst, sport, dport);
+}
+
+//
+// Link-layer types (see pcap-linktype(7)).
+//
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+static void
+link_packet(Capture &cap, uint32_t linktype, uint64_t time, const unsigned char *p, uint32_t len)
+{
+    cap.packets++;
+    if (cap.first_time == 0 || time < cap.first_time)
+        cap.first_time = time;
+    uint16_t ethertype;
+    switch (linktype)
+    {
+    case LINKTYPE_ETHERNET:
+        if (len < 14)
+            return;
+        ethertype = be16(p + 12);
+        p += 14;
+        len -= 14;
+        // VLAN tags
+        while ((ethertype == 0x8100 || ethertype == 0x88a8) && len >= 4)
+        {
+            ethertype = be16(p + 2);
+            p += 4;
+            len -= 4;
+        }
+        if (ethertype != 0x0800 && ethertype != 0x86dd)
+            return;
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (len < 16)
+            return;
+        p += 16;
+        len -= 16;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (len < 20)
+            return;
+        p += 20;
+        len -= 20;
+        break;
+    case LINKTYPE_NULL:
+    case LINKTYPE_LOOP:
+        if (len < 4)
+            return;
+        p += 4;
+        len -= 4;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        break;
+    default:
+        return;
+    }
+    ip_packet(cap, time, p, len);
+}
+
+//
+// The classic pcap format.
+//
+static bool
+read_pcap(Capture &cap)
+{
+    const unsigned char *p = cap.data;
+    uint32_t magic;
+    memcpy(&magic, p, 4);
+    bool swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    bool nanoseconds = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+    if (cap.size < 24)
+        return false;
+    uint32_t linktype;
+    memcpy(&linktype, p + 20, 4);
+    if (swapped)
+        linktype = __builtin_bswap32(linktype);
+    linktype &= 0x0fffffff;
+
+    uint64_t offset = 24;
+    while (offset + 16 <= cap.size)
+    {
+        uint32_t sec, frac, caplen;
+        memcpy(&sec, p + offset, 4);
+        memcpy(&frac, p + offset + 4, 4);
+        memcpy(&caplen, p + offset + 8, 4);
+        if (swapped)
+        {
+            sec = __builtin_bswap32(sec);
+            frac = __builtin_bswap32(frac);
+            caplen = __builtin_bswap32(caplen);
+        }
+        offset += 16;
+        if (caplen > cap.size - offset)
+            break;
+        uint64_t time = sec * 1000000000ull + (nanoseconds ? frac : frac * 1000ull);
+        link_packet(cap, linktype, time, p + offset, caplen);
+        offset += caplen;
+    }
+    return true;
+}
+
+//
+// pcapng: only the section header, interface description and enhanced
+// (or simple) packet blocks matter.
+//
+struct Interface
+{
+    uint32_t linktype;
+    // Timestamp units per second.
+    uint64_t resolution;
+};
+
+static bool
+read_pcapng(Capture &cap)
+{
+    const unsigned char *p = cap.data;
+    bool swapped = false;
+    vector<Interface> interfaces;
+    uint64_t offset = 0;
+    while (offset + 12 <= cap.size)
+    {
+        uint32_t type, length;
+        memcpy(&type, p + offset, 4);
+        if (type == 0x0a0d0d0a)
+        {
+            uint32_t order;
+            memcpy(&order, p + offset + 8, 4);
+            swapped = order == 0x4d3c2b1a;
+            interfaces.clear();
+        }
+        memcpy(&length, p + offset + 4, 4);
+        if (swapped)
+        {
+            type = __builtin_bswap32(type);
+            length = __builtin_bswap32(length);
+        }
+        if (length < 12 || length % 4 != 0 || length > cap.size - offset)
+            break;
+        const unsigned char *body = p + offset + 8;
+        uint32_t body_len = length - 12;
+        uint32_t word;
+
+        if (type == 1 && body_len >= 8)
+        {
+            // Interface description
+            Interface iface;
+            uint16_t linktype;
+            memcpy(&linktype, body, 2);
+            iface.linktype = swapped ? __builtin_bswap16(linktype) : linktype;
+            iface.resolution = 1000000;
+            // Look for if_tsresol among the options.
+            uint32_t opt = 8;
+            while (opt + 4 <= body_len)
+            {
+                uint16_t code, olen;
+                memcpy(&code, body + opt, 2);
+                memcpy(&olen, body + opt + 2, 2);
+                if (swapped)
+                {
+                    code = __builtin_bswap16(code);
+                    olen = __builtin_bswap16(olen);
+                }
+                if (code == 0 || opt + 4 + olen > body_len)
+                    break;
+                if (code == 9 && olen >= 1)
+                {
+                    unsigned char r = body[opt + 4];
+                    iface.resolution = 1;
+                    for (int i = 0; i < (r & 0x7f); i++)
+                        iface.resolution *= (r & 0x80) ? 2 : 10;
+                }
+                opt += 4 + ((olen + 3) & ~3u);
+            }
+            interfaces.push_back(iface);
+        }
+        else if (type == 6 && body_len >= 20)
+        {
+            // Enhanced packet
+            uint32_t id, hi, lo, caplen;
+            memcpy(&id, body, 4);
+            memcpy(&hi, body + 4, 4);
+            memcpy(&lo, body + 8, 4);
+            memcpy(&caplen, body + 12, 4);
+            if (swapped)
+            {
+                id = __builtin_bswap32(id);
+                hi = __builtin_bswap32(hi);
+                lo = __builtin_bswap32(lo);
+                caplen = __builtin_bswap32(caplen);
+            }
+            if (id < interfaces.size() && caplen <= body_len - 20)
+            {
+                uint64_t ts = ((uint64_t)hi << 32) | lo;
+                uint64_t res = interfaces[id].resolution;
+                uint64_t time = ts / res * 1000000000ull + ts % res * 1000000000ull / res;
+                link_packet(cap, interfaces[id].linktype, time, body + 20, caplen);
+            }
+        }
+        else if (type == 3 && body_len >= 4 && !interfaces.empty())
+        {
+            // Simple packet: no timestamp.
+            memcpy(&word, body, 4);
+            if (swapped)
+                word = __builtin_bswap32(word);
+            uint32_t caplen = min(word, body_len - 4);
+            link_packet(cap, interfaces[0].linktype, cap.first_time, body + 4, caplen);
+        }
+        offset += length;
+    }
+    return true;
+}
+
+//
+// Detection.
+//
+
+//
+// Collects the digits a detector publishes.
+//
+class DigitSink : public DtmfEventSink
+{
+public:
+    vector<DtmfEvent> events;
+    void dtmfEvent(const DtmfEvent &event)
+    {
+        events.push_back(event);
+    }
+};
+
+//
+// Where in the capture a sample of the detector's input came from.
+//
+struct Anchor
+{
+    uint64_t sample;
+    uint64_t time;
+};
+
+static bool
+seq_less(const pair<int64_t, const Packet *> &a, const pair<int64_t, const Packet *> &b)
+{
+    return a.first < b.first;
+}
+
+//
+// Number the packets of a stream with a 64-bit sequence number, i.e.
+// unwrap seq across 16-bit wraparounds, and sort them by it.  Duplicates
+// are dropped.
+//
+static vector<const Packet *>
+in_sequence(const vector<Packet> &packets)
+{
+    vector<pair<int64_t, const Packet *> > numbered;
+    numbered.reserve(packets.size());
+    int64_t ext = 0;
+    for (size_t i = 0; i < packets.size(); i++)
+    {
+        if (i == 0)
+            ext = packets[i].seq;
+        else
+            ext += (int16_t)(packets[i].seq - (uint16_t)ext);
+        numbered.push_back(make_pair(ext, &packets[i]));
+    }
+    stable_sort(numbered.begin(), numbered.end(), seq_less);
+    vector<const Packet *> sorted;
+    sorted.reserve(numbered.size());
+    for (size_t i = 0; i < numbered.size(); i++)
+        if (i == 0 || numbered[i].first != numbered[i - 1].first)
+            sorted.push_back(numbered[i].second);
+    return sorted;
+}
+
+//
+// The period of the end of the audio in history (len samples, the most
+// recent last): the lag at which it best matches itself.
+//
+static uint32_t
+conceal_period(const INT16 *history, uint32_t len)
+{
+    uint32_t best = len / 2;
+    double best_score = -1;
+    for (uint32_t lag = MIN_PERIOD; lag <= len / 2; lag++)
+    {
+        const INT16 *a = history + len - lag;
+        const INT16 *b = a - lag;
+        double dot = 0, energy = 0;
+        for (uint32_t k = 0; k < lag; k++)
+        {
+            dot += (double)a[k] * b[k];
+            energy += (double)b[k] * b[k];
+        }
+        if (energy <= 0)
+            continue;
+        double score = dot / sqrt(energy * lag);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = lag;
+        }
+    }
+    return best;
+}
+
+static void
+detect_inband(const Capture &cap, const Stream &stream, vector<Digit> &out)
+{
+    vector<const Packet *> packets = in_sequence(stream.audio);
+    if (packets.empty())
+        return;
+
+    DtmfDetector detector(FRAMELEN);
+    DigitSink sink;
+    detector.setEventSink(&sink);
+    vector<Anchor> anchors;
+    INT16 frame[FRAMELEN];
+    vector<INT16> decoded;
+    // The end of the audio fed so far, for concealing lost packets.
+    INT16 history[HISTORY];
+    uint32_t history_len = 0;
+    int fill = 0;
+    // fed: samples passed to the detector (or waiting in frame).
+    // position: the RTP timestamp of sample number fed.
+    uint64_t fed = 0;
+    uint32_t position = packets[0]->timestamp;
+
+    for (size_t i = 0; i < packets.size(); i++)
+    {
+        const Packet &packet = *packets[i];
+        const unsigned char *payload = cap.data + packet.payload;
+        uint32_t size = packet.size;
+        int32_t ahead = (int32_t)(packet.timestamp - position);
+        if (ahead > MAX_GAP)
+        {
+            // Skip over the gap.
+            ahead = 0;
+        }
+        else if (ahead < 0)
+        {
+            // Overlaps with audio already fed: only use the rest.
+            if ((uint32_t)-ahead >= size)
+                continue;
+            payload += -ahead;
+            size -= -ahead;
+            ahead = 0;
+        }
+        // Fill the gap.
+        uint32_t period = 0;
+        if (ahead > 0 && ahead <= MAX_CONCEAL && history_len >= 2 * MIN_PERIOD)
+            period = conceal_period(history, history_len);
+        for (int32_t g = 0; g < ahead; g++)
+        {
+            frame[fill++] = period ? history[history_len - period + g % period] : 0;
+            if (fill == FRAMELEN)
+            {
+                detector.dtmfDetecting(frame);
+                fill = 0;
+            }
+        }
+        fed += ahead;
+        Anchor anchor = { fed, packet.time };
+        anchors.push_back(anchor);
+
+        decoded.resize(size);
+        if (packet.pt == PT_PCMU)
+            ulawDecode(payload, size, &decoded[0]);
+        else
+            alawDecode(payload, size, &decoded[0]);
+        for (uint32_t k = 0; k < size; )
+        {
+            uint32_t n = min<uint32_t>(size - k, FRAMELEN - fill);
+            memcpy(frame + fill, &decoded[k], n * sizeof(INT16));
+            fill += n;
+            k += n;
+            if (fill == FRAMELEN)
+            {
+                detector.dtmfDetecting(frame);
+                fill = 0;
+            }
+        }
+        fed += size;
+        if (ahead > 0)
+            history_len = 0;
+        uint32_t keep = min<uint32_t>(size, HISTORY);
+        if (history_len + keep > HISTORY)
+        {
+            uint32_t drop = history_len + keep - HISTORY;
+            memmove(history, history + drop, (history_len - drop) * sizeof(INT16));
+            history_len -= drop;
+        }
+        memcpy(history + history_len, &decoded[size - keep], keep * sizeof(INT16));
+        history_len += keep;
+        position = packet.timestamp + packet.size;
+    }
+    if (fill > 0)
+    {
+        memset(frame + fill, 0, (FRAMELEN - fill) * sizeof(INT16));
+        detector.dtmfDetecting(frame);
+    }
+
+    for (size_t i = 0; i < sink.events.size(); i++)
+    {
+        const DtmfEvent &event = sink.events[i];
+        // The last anchor at or before the digit.
+        size_t lo = 0, hi = anchors.size();
+        while (hi - lo > 1)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (anchors[mid].sample <= event.sample)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        Digit digit;
+        digit.time = anchors[lo].time + (event.sample - anchors[lo].sample) * 125000;
+        digit.stream = &stream;
+        digit.inband = true;
+        digit.digit = event.digit;
+        digit.duration = 0;
+        out.push_back(digit);
+    }
+}
+
+//
+// RFC 4733: each event is sent in several packets (updates and
+// retransmissions of the end) with the same RTP timestamp.
+//
+static void
+extract_events(const Capture &cap, const Stream &stream, vector<Digit> &out)
+{
+    static const char names[] = "0123456789*#ABCD";
+    vector<const Packet *> packets = in_sequence(stream.events);
+    // The event in progress: its timestamp, and its index in out.
+    bool current = false;
+    uint32_t timestamp = 0;
+    size_t index = 0;
+    for (size_t i = 0; i < packets.size(); i++)
+    {
+        const Packet &packet = *packets[i];
+        const unsigned char *payload = cap.data + packet.payload;
+        if (packet.size < 4)
+            continue;
+        uint8_t event = payload[0];
+        uint32_t duration = be16(payload + 2);
+        if (current && packet.timestamp == timestamp)
+        {
+            out[index].duration = max(out[index].duration, duration / 8);
+            continue;
+        }
+        current = true;
+        timestamp = packet.timestamp;
+        index = out.size();
+        Digit digit;
+        digit.time = packet.time;
+        digit.stream = &stream;
+        digit.inband = false;
+        digit.digit = event < 16 ? names[event] : '?';
+        digit.duration = duration / 8;
+        out.push_back(digit);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -j threads       Number of streams to process at once (default: one
+    //                  per CPU)
+    // -e payloadtype   The payload type of telephone events.  By default,
+    //                  any dynamic payload type carrying 4-byte blocks is
+    //                  taken for telephone events.
+    //
+    unsigned threads = thread::hardware_concurrency();
+    int event_pt = -1;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'e':
+            event_pt = atoi(optarg);
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc - optind != 1)
+    {
+        cerr << "usage: " << argv[0] << " [-j threads] [-e payloadtype] capture.pcap" << endl;
+        return 1;
+    }
+    if (threads == 0)
+        threads = 1;
+    const char *fname = argv[optind];
+
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        cerr << fname << ": unable to open file" << endl;
+        return 1;
+    }
+    if (st.st_size < 24)
+    {
+        cerr << fname << ": not a capture file" << endl;
+        return 1;
+    }
+    void *mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED)
+    {
+        cerr << fname << ": unable to map file" << endl;
+        return 1;
+    }
+    madvise(mem, st.st_size, MADV_SEQUENTIAL);
+
+    Capture cap;
+    cap.data = static_cast<const unsigned char *>(mem);
+    cap.size = st.st_size;
+    cap.event_pt = event_pt;
+    cap.packets = 0;
+    cap.rtp_packets = 0;
+    cap.first_time = 0;
+    uint32_t magic;
+    memcpy(&magic, cap.data, 4);
+    if (magic == 0x0a0d0d0a)
+        read_pcapng(cap);
+    else if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 || magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+        read_pcap(cap);
+    else
+    {
+        cerr << fname << ": not a capture file" << endl;
+        return 1;
+    }
+    madvise(mem, st.st_size, MADV_RANDOM);
+
+    //
+    // Each stream is processed by a single thread, into a digit list of
+    // its own.
+    //
+    vector<vector<Digit> > digits(cap.streams.size());
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+        workers.push_back(thread([&]()
+        {
+            for (size_t i; (i = next++) < cap.streams.size(); )
+            {
+                detect_inband(cap, cap.streams[i], digits[i]);
+                extract_events(cap, cap.streams[i], digits[i]);
+            }
+        }));
+    for (unsigned t = 0; t < threads; t++)
+        workers[t].join();
+
+    vector<Digit> timeline;
+    uint64_t unsupported = 0;
+    for (size_t i = 0; i < digits.size(); i++)
+    {
+        timeline.insert(timeline.end(), digits[i].begin(), digits[i].end());
+        unsupported += cap.streams[i].unsupported;
+    }
+    sort(timeline.begin(), timeline.end(), digit_less);
+
+    cout << fname << ": " << cap.packets << " packets, " << cap.rtp_packets
+         << " RTP packets in " << cap.streams.size() << " streams";
+    if (unsupported)
+        cout << " (" << unsupported << " packets of unsupported payload types)";
+    cout << endl;
+    for (size_t i = 0; i < timeline.size(); i++)
+    {
+        const Digit &d = timeline[i];
+        uint64_t t = d.time - cap.first_time;
+        printf("%llu.%03llu 0x%08x %s -> %s %s %c",
+               (unsigned long long)(t / 1000000000), (unsigned long long)(t / 1000000 % 1000),
+               d.stream->ssrc, d.stream->source.c_str(), d.stream->destination.c_str(),
+               d.inband ? "inband" : "rfc4733", d.digit);
+        if (!d.inband)
+            printf(" %u", d.duration);
+        printf("\n");
+    }
+    fflush(stdout);
+
+    munmap(mem, st.st_size);
+    close(fd);
+    return 0;
+}
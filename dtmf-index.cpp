@@ -0,0 +1,314 @@
+//
+// Add recordings to a digit index (see DigitIndex.hpp), for dtmf-query.
+//
+// Each new or changed AU file is run through the detector once, and the
+// push buttons found are written to a new segment of the index.  Files
+// already indexed with the same modification time and size are skipped, so
+// the indexer can be run over a whole archive as often as recordings
+// arrive.  The files must be 8KHz mono, mu-law or PCM encoded.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "AuFile.hpp"
+#include "DigitIndex.hpp"
+#include "DtmfDetector.hpp"
+
+using namespace std;
+
+struct Recording
+{
+    string path;
+    struct stat st;
+    // Filled in by the detection.
+    bool ok;
+    uint64_t samples;
+    vector<uint64_t> events;
+};
+
+//
+// Collects the push buttons of a recording as index events.
+//
+class EventCollector : public DtmfEventSink
+{
+public:
+    vector<uint64_t> *events;
+
+    void dtmfEvent(const DtmfEvent &event)
+    {
+        if (event.type == DTMF_EVENT_DIGIT)
+            events->push_back(event.sample << 8 | (unsigned char)event.digit);
+    }
+};
+
+static bool
+ends_with(const string &text, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return text.size() >= n && text.compare(text.size() - n, n, suffix) == 0;
+}
+
+//
+// Add path to files: the file itself, or the .au files below it if it is a
+// directory.
+//
+static void
+find_files(const string &path, vector<Recording> &files, bool named)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        cerr << path << ": " << strerror(errno) << endl;
+        return;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(path.c_str());
+        if (!dir)
+        {
+            cerr << path << ": " << strerror(errno) << endl;
+            return;
+        }
+        vector<string> names;
+        for (struct dirent *entry; (entry = readdir(dir)) != NULL; )
+            if (entry->d_name[0] != '.')
+                names.push_back(entry->d_name);
+        closedir(dir);
+        sort(names.begin(), names.end());
+        for (size_t ii = 0; ii < names.size(); ++ii)
+            find_files(path + "/" + names[ii], files, false);
+    }
+    else if (S_ISREG(st.st_mode) && (named || ends_with(path, ".au")))
+    {
+        char real[PATH_MAX];
+        Recording recording;
+        recording.path = realpath(path.c_str(), real) ? real : path;
+        recording.st = st;
+        recording.ok = false;
+        recording.samples = 0;
+        files.push_back(recording);
+    }
+}
+
+static void
+detect(Recording &recording, DtmfDetector &detector, EventCollector &collector)
+{
+    int fd = open(recording.path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << recording.path << ": " << strerror(errno) << endl;
+        return;
+    }
+    AuHeader header;
+    vector<INT16> samples;
+    bool ok = readAuHeader(fd, header) && header.sample_rate == 8000
+        && readAuSamples(fd, header, samples);
+    close(fd);
+    if (!ok)
+    {
+        cerr << recording.path << ": unsupported AU format" << endl;
+        return;
+    }
+    detector.reset();
+    collector.events = &recording.events;
+    detector.setEventSink(&collector);
+    if (!samples.empty())
+        detector.dtmfDetecting(&samples[0], samples.size());
+    recording.samples = samples.size();
+    recording.ok = true;
+}
+
+static void
+work(vector<Recording> &todo, atomic<size_t> &next)
+{
+    DtmfDetector detector(DtmfDetector::batchSamples());
+    EventCollector collector;
+    for (size_t ii; (ii = next++) < todo.size(); )
+        detect(todo[ii], detector, collector);
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -j threads       Run the detection on this many threads (default one
+    //                  per CPU)
+    // -m               Afterwards, merge all the segments of the index into
+    //                  one, dropping the recordings indexed again since
+    //
+    unsigned threads = 0;
+    bool merge = false;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:m")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'm':
+            merge = true;
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc == optind)
+    {
+        cerr << "usage: " << argv[0] << " [-j threads] [-m] indexdir [file.au|directory]..." << endl;
+        return 1;
+    }
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    const string dir = argv[optind];
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        cerr << dir << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    //
+    // One indexer at a time per index.  Queries do not take the lock: they
+    // only ever see whole segments.
+    //
+    int lock = open((dir + "/lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0)
+    {
+        cerr << dir << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    DigitIndex index;
+    if (!index.open(dir, true))
+    {
+        cerr << dir << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    //
+    // The live recordings already in the index, by path.
+    //
+    typedef pair<DigitIndexSegment *, UINT32> Location;
+    map<string, Location> indexed;
+    const vector<DigitIndexSegment *> &segments = index.segments();
+    for (size_t s = 0; s < segments.size(); ++s)
+        for (UINT32 ii = 0; ii < segments[s]->recordings(); ++ii)
+            if (!segments[s]->deleted(ii))
+                indexed[segments[s]->path(ii)] = Location(segments[s], ii);
+
+    vector<Recording> files;
+    for (int ii = optind + 1; ii < argc; ++ii)
+        find_files(argv[ii], files, true);
+    vector<Recording> todo;
+    vector<Location> replaced;
+    size_t unchanged = 0;
+    for (size_t ii = 0; ii < files.size(); ++ii)
+    {
+        map<string, Location>::iterator found = indexed.find(files[ii].path);
+        if (found != indexed.end())
+        {
+            // The same file named twice.
+            if (!found->second.first)
+                continue;
+            const DigitIndexSegment::Record &r = found->second.first->record(found->second.second);
+            if (r.mtime == files[ii].st.st_mtime && r.size == (uint64_t)files[ii].st.st_size)
+            {
+                unchanged++;
+                continue;
+            }
+            replaced.push_back(found->second);
+        }
+        indexed[files[ii].path] = Location(NULL, 0);
+        todo.push_back(files[ii]);
+    }
+
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (unsigned ii = 1; ii < threads && ii < todo.size(); ++ii)
+        workers.push_back(thread(work, ref(todo), ref(next)));
+    work(todo, next);
+    for (size_t ii = 0; ii < workers.size(); ++ii)
+        workers[ii].join();
+
+    DigitIndexWriter writer;
+    size_t failed = 0, digits = 0;
+    for (size_t ii = 0; ii < todo.size(); ++ii)
+    {
+        const Recording &r = todo[ii];
+        if (!r.ok)
+        {
+            failed++;
+            continue;
+        }
+        writer.add(r.path, r.st.st_mtime, r.st.st_size, r.samples, r.events);
+        digits += r.events.size();
+    }
+    if (writer.recordings() > 0)
+    {
+        //
+        // The new segment goes in before the old records are flagged, so a
+        // recording is never missing from the index.
+        //
+        string path = index.nextSegmentPath();
+        if (!writer.write(path))
+        {
+            cerr << path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        for (size_t ii = 0; ii < replaced.size(); ++ii)
+            if (!replaced[ii].first->markDeleted(replaced[ii].second))
+                cerr << replaced[ii].first->fileName() << ": " << strerror(errno) << endl;
+    }
+
+    if (merge)
+    {
+        DigitIndex all;
+        if (!all.open(dir))
+        {
+            cerr << dir << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        DigitIndexWriter merged;
+        const vector<DigitIndexSegment *> &old = all.segments();
+        for (size_t s = 0; s < old.size(); ++s)
+            for (UINT32 ii = 0; ii < old[s]->recordings(); ++ii)
+                if (!old[s]->deleted(ii))
+                    merged.add(*old[s], ii);
+        string path = all.nextSegmentPath();
+        if (old.size() > 1 && !merged.write(path))
+        {
+            cerr << path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        for (size_t s = 0; s < old.size() && old.size() > 1; ++s)
+            unlink(old[s]->fileName().c_str());
+    }
+
+    gettimeofday(&end, NULL);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    cerr << files.size() << " files: " << todo.size() - failed << " indexed (" << digits << " digits), "
+        << unchanged << " unchanged, " << failed << " failed in " << seconds << "s" << endl;
+    close(lock);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,536 @@
+//
+// Generate push buttons on many streams at the real-time rate, to load
+// test a detector deployment.
+//
+// Each stream runs its own DtmfGenerator, dialing random strings of push
+// buttons back to back, and emits one frame per frame period.  The streams
+// are spread over a few threads, and over a number of slots per period:
+// the streams of a thread that share a slot are generated together, in
+// one wake-up on an absolute timerfd deadline.  The frames go to a
+// DtmfShmRing (for dtmfd, whose push buttons are counted back), to one AU
+// file per stream, or nowhere.
+//
+// Each stream only dials the strings it can finish before the end of the
+// run, so that with a ring, the push buttons received back from dtmfd can
+// be checked against those dialed, stream by stream.
+//
+// At the end, the wake-up lateness and the time taken by each batch are
+// reported, with the number of batches that finished after the next
+// deadline (a load the machine cannot keep up with).
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "AuFile.hpp"
+#include "DtmfGenerator.hpp"
+#include "DtmfShmRing.hpp"
+
+#define RATE 8000
+
+//
+// Bytes of audio kept per stream before writing them to its file.
+//
+#define FILE_BUFFER 8192
+
+using namespace std;
+
+static const char DIGITS[] = "0123456789*#ABCD";
+
+struct Options
+{
+    UINT32 streams;
+    unsigned threads;
+    unsigned slots;
+    INT32 frame;
+    unsigned seconds;
+    unsigned tone_ms;
+    unsigned pause_ms;
+    unsigned seed;
+    const char *dir;
+    DtmfShmRing *ring;
+};
+
+struct Stream
+{
+    DtmfGenerator generator;
+    minstd_rand rng;
+    UINT32 channel;
+    // The AU file, if writing files.
+    int fd;
+    vector<unsigned char> pending;
+    uint64_t bytes;
+    // The push buttons of the strings dialed to the end, the length of the
+    // string being dialed, the frames left to emit before the end of the
+    // run, the samples not taken by the ring because it was full, and the
+    // push buttons received back.
+    uint64_t digits;
+    UINT32 dialing;
+    uint64_t frames_left;
+    uint64_t overruns;
+    uint64_t received;
+
+    Stream(const Options &options, UINT32 channel_)
+        : generator(options.frame, options.tone_ms, options.pause_ms), channel(channel_), fd(-1),
+          bytes(0), digits(0), dialing(0), frames_left(0), overruns(0), received(0)
+    {
+        seed_seq seq = { options.seed, channel };
+        uint32_t seed;
+        seq.generate(&seed, &seed + 1);
+        rng.seed(seed);
+    }
+};
+
+// What each thread measured.
+struct Stats
+{
+    // Wake-up lateness and batch durations, in microseconds.
+    vector<uint32_t> late_us;
+    vector<uint32_t> busy_us;
+    uint64_t batches;
+    uint64_t misses;
+    uint64_t frames;
+};
+
+static int64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool
+flush_stream(Stream &stream)
+{
+    const unsigned char *p = stream.pending.data();
+    size_t left = stream.pending.size();
+    off_t offset = sizeof(AuHeader) + stream.bytes;
+    while (left > 0)
+    {
+        ssize_t n = pwrite(stream.fd, p, left, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        left -= n;
+        offset += n;
+    }
+    stream.bytes += stream.pending.size();
+    stream.pending.clear();
+    return true;
+}
+
+//
+// Write the AU header of stream, with the size of its audio in bytes.
+//
+static bool
+write_header(Stream &stream, uint32_t bytes)
+{
+    AuHeader header;
+    header.magic = AU_MAGIC;
+    header.header_size = sizeof(AuHeader);
+    header.nsamples = bytes;
+    header.encoding = AU_ENCODING_PCM8;
+    header.sample_rate = RATE;
+    header.nchannels = 1;
+    unsigned char encoded[sizeof(AuHeader)];
+    encodeAuHeader(header, encoded);
+    return pwrite(stream.fd, encoded, sizeof(encoded), 0) == sizeof(encoded);
+}
+
+//
+// The frames DtmfGenerator takes for each push button: its tone, then its
+// pause, each rounded up to whole frames.
+//
+static uint64_t
+frames_per_digit(const Options &options)
+{
+    return (options.tone_ms * 8) / options.frame + 1 + (options.pause_ms * 8) / options.frame + 1;
+}
+
+static void
+emit(Stream &stream, const Options &options, INT16 frame[])
+{
+    //
+    // Dial another string as soon as the last one is done, so that the
+    // stream never goes quiet, up to the end of the run: the last string
+    // is cut short to what can be dialed to the end of its last pause, and
+    // then the stream is silent.
+    //
+    if (stream.generator.getReadyFlag())
+    {
+        stream.digits += stream.dialing;
+        stream.dialing = 0;
+        char buttons[20];
+        UINT32 count = 1 + stream.rng() % 20;
+        uint64_t fit = stream.frames_left / frames_per_digit(options);
+        if (count > fit)
+            count = (UINT32)fit;
+        for (UINT32 ii = 0; ii < count; ++ii)
+            buttons[ii] = DIGITS[stream.rng() % 16];
+        if (count > 0)
+        {
+            stream.generator.transmitNewDialButtonsArray(buttons, count);
+            stream.dialing = count;
+        }
+    }
+    stream.frames_left--;
+    //
+    // The generator leaves the frame alone once the string is done (and on
+    // the call that finds it done), and the frame is shared by the streams
+    // of the thread: silence, not what the last stream left in it.
+    //
+    memset(frame, 0, options.frame * sizeof(INT16));
+    stream.generator.dtmfGenerating(frame);
+    if (options.ring)
+    {
+        stream.overruns += options.frame - options.ring->write(stream.channel, frame, options.frame);
+    }
+    else if (stream.fd >= 0)
+    {
+        //
+        // 8-bit PCM, as detect-au reads.
+        //
+        for (INT32 ii = 0; ii < options.frame; ++ii)
+            stream.pending.push_back((unsigned char)(frame[ii] >> 8));
+        if (stream.pending.size() >= FILE_BUFFER && !flush_stream(stream))
+        {
+            cerr << "stream " << stream.channel << ": " << strerror(errno) << endl;
+            close(stream.fd);
+            stream.fd = -1;
+        }
+    }
+}
+
+//
+// Run the streams of one thread.  slots[s] holds the streams due in slot
+// s of each period.
+//
+static void
+work(const Options &options, vector<vector<Stream *> > &slots, int64_t start, Stats &stats)
+{
+    const int64_t period = (int64_t)options.frame * 1000000000 / RATE;
+    const int64_t tick = period / options.slots;
+    const uint64_t ticks = (uint64_t)options.seconds * 1000000000 / tick;
+    vector<INT16> frame(options.frame);
+    stats.batches = stats.misses = stats.frames = 0;
+
+    for (unsigned s = 0; s < options.slots; ++s)
+    {
+        uint64_t frames = ticks > s ? (ticks - s + options.slots - 1) / options.slots : 0;
+        for (size_t ii = 0; ii < slots[s].size(); ++ii)
+            slots[s][ii]->frames_left = frames;
+    }
+
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer < 0)
+    {
+        cerr << "timerfd_create: " << strerror(errno) << endl;
+        return;
+    }
+    for (uint64_t k = 0; k < ticks; ++k)
+    {
+        vector<Stream *> &batch = slots[k % options.slots];
+        if (batch.empty())
+            continue;
+        const int64_t deadline = start + (int64_t)k * tick;
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = deadline / 1000000000;
+        spec.it_value.tv_nsec = deadline % 1000000000;
+        uint64_t expirations;
+        //
+        // A deadline already passed expires straight away, so a thread
+        // that fell behind catches up without sleeping.
+        //
+        if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL) != 0
+            || read(timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+        {
+            cerr << "timerfd: " << strerror(errno) << endl;
+            break;
+        }
+        const int64_t woke = now_ns();
+        for (size_t ii = 0; ii < batch.size(); ++ii)
+            emit(*batch[ii], options, &frame[0]);
+        if (options.ring)
+            options.ring->publish();
+        const int64_t done = now_ns();
+
+        stats.late_us.push_back((uint32_t)min<int64_t>((woke - deadline) / 1000, UINT32_MAX));
+        stats.busy_us.push_back((uint32_t)min<int64_t>((done - woke) / 1000, UINT32_MAX));
+        stats.batches++;
+        stats.frames += batch.size();
+        if (done > deadline + tick)
+            stats.misses++;
+    }
+    close(timer);
+}
+
+//
+// Count the push buttons dtmfd has sent back, against their streams.
+//
+static UINT32
+drain_events(DtmfShmRing &ring, vector<Stream> &streams)
+{
+    DtmfEvent events[256];
+    UINT32 n = ring.drainEvents(events, 256);
+    for (UINT32 ii = 0; ii < n; ++ii)
+    {
+        if (events[ii].channel < streams.size())
+            streams[events[ii].channel].received++;
+    }
+    return n;
+}
+
+static void
+print_percentiles(const char *what, vector<uint32_t> &values)
+{
+    if (values.empty())
+        return;
+    sort(values.begin(), values.end());
+    uint64_t sum = 0;
+    for (size_t ii = 0; ii < values.size(); ++ii)
+        sum += values[ii];
+    cout << what << " (us): mean " << sum / values.size()
+        << " p50 " << values[values.size() / 2]
+        << " p99 " << values[values.size() * 99 / 100]
+        << " p99.9 " << values[values.size() * 999 / 1000]
+        << " max " << values.back() << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -s streams       Number of streams (default 1000)
+    // -j threads       Generate on this many threads (default one per CPU)
+    // -b slots         Spread the streams over this many deadlines per
+    //                  frame period (default 4).  1 batches all the
+    //                  streams of a thread together.
+    // -f samples       Frame size (default 160, a frame every 20ms)
+    // -d seconds       How long to run (default 10)
+    // -t ms            Tone duration (default 70)
+    // -p ms            Pause after each tone (default 50)
+    // -S seed          Random seed (default 1)
+    // -n name          Write the frames to this shared memory segment (see
+    //                  DtmfShmRing), one channel per stream, for dtmfd
+    // -r samples       Ring size per channel with -n (default 4096)
+    // -o directory     Write each stream to an AU file in directory
+    //
+    Options options;
+    options.streams = 1000;
+    options.threads = 0;
+    options.slots = 4;
+    options.frame = 160;
+    options.seconds = 10;
+    options.tone_ms = 70;
+    options.pause_ms = 50;
+    options.seed = 1;
+    options.dir = NULL;
+    options.ring = NULL;
+    const char *name = NULL;
+    UINT32 ring_samples = 4096;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:j:b:f:d:t:p:S:n:r:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            options.streams = atoi(optarg);
+            break;
+        case 'j':
+            options.threads = atoi(optarg);
+            break;
+        case 'b':
+            options.slots = atoi(optarg);
+            break;
+        case 'f':
+            options.frame = atoi(optarg);
+            break;
+        case 'd':
+            options.seconds = atoi(optarg);
+            break;
+        case 't':
+            options.tone_ms = atoi(optarg);
+            break;
+        case 'p':
+            options.pause_ms = atoi(optarg);
+            break;
+        case 'S':
+            options.seed = atoi(optarg);
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'r':
+            ring_samples = atoi(optarg);
+            break;
+        case 'o':
+            options.dir = optarg;
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc != optind || options.streams == 0 || options.slots == 0 || options.frame <= 0
+        || options.tone_ms == 0 || (name && options.dir))
+    {
+        cerr << "usage: " << argv[0] << " [-s streams] [-j threads] [-b slots] [-f samples] [-d seconds]"
+            " [-t ms] [-p ms] [-S seed] [-n name [-r samples] | -o directory]" << endl;
+        return 1;
+    }
+    if (options.threads == 0)
+        options.threads = max(1u, thread::hardware_concurrency());
+    options.threads = min<unsigned>(options.threads, options.streams);
+
+    if (name)
+    {
+        options.ring = DtmfShmRing::create(name, options.streams, ring_samples, 65536);
+        if (!options.ring)
+        {
+            cerr << name << ": " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+    if (options.dir && mkdir(options.dir, 0755) != 0 && errno != EEXIST)
+    {
+        cerr << options.dir << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    vector<Stream> streams;
+    streams.reserve(options.streams);
+    for (UINT32 ch = 0; ch < options.streams; ++ch)
+    {
+        streams.push_back(Stream(options, ch));
+        Stream &stream = streams.back();
+        if (options.ring)
+            options.ring->startCall(ch);
+        if (options.dir)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "/stream-%06u.au", ch);
+            string fname = string(options.dir) + path;
+            stream.fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (stream.fd < 0)
+            {
+                cerr << fname << ": " << strerror(errno) << endl;
+                return 1;
+            }
+            //
+            // The size is filled in at the end.
+            //
+            if (!write_header(stream, ~0u))
+            {
+                cerr << fname << ": " << strerror(errno) << endl;
+                return 1;
+            }
+        }
+    }
+
+    //
+    // Stream i goes to thread i % threads, and within it, to slot
+    // (i / threads) % slots.
+    //
+    vector<vector<vector<Stream *> > > slots(options.threads, vector<vector<Stream *> >(options.slots));
+    for (UINT32 ii = 0; ii < options.streams; ++ii)
+        slots[ii % options.threads][(ii / options.threads) % options.slots].push_back(&streams[ii]);
+
+    //
+    // Start on the next whole 100ms, giving the threads time to get going.
+    //
+    const int64_t start = (now_ns() / 100000000 + 2) * 100000000;
+    vector<Stats> stats(options.threads);
+    vector<thread> workers;
+    for (unsigned t = 0; t < options.threads; ++t)
+        workers.push_back(thread(work, cref(options), ref(slots[t]), start, ref(stats[t])));
+
+    //
+    // Meanwhile, count the push buttons dtmfd sends back.
+    //
+    while (options.ring && now_ns() < start + (int64_t)options.seconds * 1000000000)
+    {
+        uint32_t seq = options.ring->eventSequence();
+        if (drain_events(*options.ring, streams) == 0)
+            options.ring->waitEvents(seq, 100);
+    }
+    for (size_t ii = 0; ii < workers.size(); ++ii)
+        workers[ii].join();
+    if (options.ring)
+    {
+        options.ring->finish();
+        for (int tries = 0; tries < 50 && !options.ring->daemonDone(); ++tries)
+        {
+            uint32_t seq = options.ring->eventSequence();
+            if (drain_events(*options.ring, streams) == 0)
+                options.ring->waitEvents(seq, 100);
+        }
+        while (drain_events(*options.ring, streams) > 0)
+            ;
+    }
+
+    uint64_t digits = 0, received = 0, overruns = 0;
+    UINT32 mismatched = 0;
+    for (size_t ii = 0; ii < streams.size(); ++ii)
+    {
+        Stream &stream = streams[ii];
+        //
+        // The last string has been dialed to its end by now.
+        //
+        stream.digits += stream.dialing;
+        digits += stream.digits;
+        received += stream.received;
+        overruns += stream.overruns;
+        if (stream.received != stream.digits)
+            mismatched++;
+        if (stream.fd < 0)
+            continue;
+        if (!flush_stream(stream) || !write_header(stream, stream.bytes))
+            cerr << "stream " << stream.channel << ": " << strerror(errno) << endl;
+        close(stream.fd);
+    }
+
+    Stats all;
+    all.batches = all.misses = all.frames = 0;
+    for (size_t t = 0; t < stats.size(); ++t)
+    {
+        all.late_us.insert(all.late_us.end(), stats[t].late_us.begin(), stats[t].late_us.end());
+        all.busy_us.insert(all.busy_us.end(), stats[t].busy_us.begin(), stats[t].busy_us.end());
+        all.batches += stats[t].batches;
+        all.misses += stats[t].misses;
+        all.frames += stats[t].frames;
+    }
+    cout << options.streams << " streams on " << options.threads << " threads, " << options.slots
+        << " slots per " << options.frame * 1000.0 / RATE << "ms frame: " << all.frames << " frames in "
+        << all.batches << " batches, " << all.misses << " missed deadlines" << endl;
+    print_percentiles("wake-up lateness", all.late_us);
+    print_percentiles("batch time", all.busy_us);
+    if (options.ring)
+    {
+        cout << digits << " push buttons dialed, " << received << " received back, " << mismatched
+            << " streams with push buttons lost or extra, " << overruns
+            << " samples overrun, " << options.ring->eventsDropped() << " events dropped" << endl;
+        DtmfShmRing::unlink(name);
+        delete options.ring;
+    }
+    return 0;
+}
@@ -0,0 +1,158 @@
+//
+// Find the recordings in a digit index (see dtmf-index) containing a
+// sequence of push buttons.
+//
+// Prints a line per match: the modification time of the recording, where
+// in it the sequence starts (in seconds), the push buttons matched and the
+// path.  The number of matches and the time taken go to stderr.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "DigitIndex.hpp"
+
+#define RATE 8000
+
+using namespace std;
+
+//
+// Parse a point in time: seconds since the epoch, or a local date and time
+// as YYYY-MM-DD[THH:MM[:SS]] (a space may stand for the T).
+//
+static bool
+parse_time(const char *text, int64_t &value)
+{
+    char *end;
+    long long seconds = strtoll(text, &end, 10);
+    if (end != text && *end == 0)
+    {
+        value = seconds;
+        return true;
+    }
+    static const char *const FORMATS[] = {
+        "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d"
+    };
+    for (size_t ii = 0; ii < sizeof(FORMATS) / sizeof(FORMATS[0]); ++ii)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *rest = strptime(text, FORMATS[ii], &tm);
+        if (rest && *rest == 0)
+        {
+            tm.tm_isdst = -1;
+            value = mktime(&tm);
+            return true;
+        }
+    }
+    return false;
+}
+
+static double
+elapsed_ms(const struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_usec - start.tv_usec) / 1e3;
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -s time          Only recordings modified at or after this time
+    // -e time          Only recordings modified before this time
+    //                  (both as seconds since the epoch, or a local
+    //                  YYYY-MM-DD[THH:MM[:SS]])
+    // -w ms            Only matches spanning at most this long, from the
+    //                  start of the first push button to the start of the
+    //                  last
+    // -c               Only print the number of matching recordings
+    //
+    // The sequence is a string of push buttons, in which ? stands for any
+    // one, e.g. 4111#.
+    //
+    int64_t from = INT64_MIN, to = INT64_MAX;
+    uint64_t max_span = 0;
+    bool count_only = false;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:e:w:c")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            bad_usage = bad_usage || !parse_time(optarg, from);
+            break;
+        case 'e':
+            bad_usage = bad_usage || !parse_time(optarg, to);
+            break;
+        case 'w':
+            max_span = (uint64_t)(atof(optarg) * RATE / 1000);
+            bad_usage = bad_usage || max_span == 0;
+            break;
+        case 'c':
+            count_only = true;
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc != optind + 2)
+    {
+        cerr << "usage: " << argv[0] << " [-s time] [-e time] [-w ms] [-c] indexdir sequence" << endl;
+        return 1;
+    }
+    const char *dir = argv[optind];
+    const string pattern = argv[optind + 1];
+
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    DigitIndex index;
+    if (!index.open(dir))
+    {
+        cerr << dir << ": unable to open index" << endl;
+        return 1;
+    }
+    vector<DigitIndexMatch> matches;
+    long searched = index.search(pattern, from, to, max_span, matches);
+    if (searched < 0)
+    {
+        cerr << pattern << ": not a sequence of push buttons" << endl;
+        return 1;
+    }
+    double ms = elapsed_ms(start);
+
+    set<pair<const DigitIndexSegment *, UINT32> > recordings;
+    for (size_t ii = 0; ii < matches.size(); ++ii)
+    {
+        const DigitIndexMatch &m = matches[ii];
+        recordings.insert(make_pair(m.segment, m.record));
+        if (count_only)
+            continue;
+        const uint64_t *events = m.segment->events(m.record);
+        time_t mtime = m.segment->record(m.record).mtime;
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", localtime(&mtime));
+        string digits;
+        for (size_t jj = 0; jj < pattern.size(); ++jj)
+            digits += DigitIndexSegment::eventDigit(events[m.event + jj]);
+        printf("%s %9.3f %s %s\n", when, (double)DigitIndexSegment::eventSample(events[m.event]) / RATE,
+               digits.c_str(), m.segment->path(m.record).c_str());
+    }
+    if (count_only)
+        printf("%zu\n", recordings.size());
+    cerr << matches.size() << " matches in " << recordings.size() << " recordings (" << searched
+        << " searched) in " << ms << "ms" << endl;
+    return 0;
+}
@@ -0,0 +1,232 @@
+//
+// The C interface declared in dtmf.h.
+//
+
+#include <cstring>
+#include <memory>
+#include "dtmf.h"
+#include "DtmfDetector.hpp"
+#include "DtmfWorkerPool.hpp"
+#include "DtmfGenerator.hpp"
+
+// The block size is part of the ABI.
+static_assert(DTMF_BLOCK_SAMPLES == 102, "DTMF_BLOCK_SAMPLES out of date");
+static_assert(DTMF_MAGNITUDES == 18, "DTMF_MAGNITUDES out of date");
+static_assert(DTMF_DETECTOR_STATE_BYTES >= DtmfDetector::STATE_BYTES, "DTMF_DETECTOR_STATE_BYTES too small");
+static_assert(DTMF_GENERATOR_STATE_BYTES >= DtmfGenerator::STATE_BYTES, "DTMF_GENERATOR_STATE_BYTES too small");
+
+struct dtmf_detector : public DtmfDetector
+{
+    // Detected push buttons wait here until pulled.
+    DtmfEventQueue queue;
+    // This detector's own thresholds.
+    DtmfConfigPublisher config;
+    // Threads for feed to decide the batches on, if more than one.
+    std::unique_ptr<DtmfWorkerPool> pool;
+
+    dtmf_detector() : DtmfDetector(0), queue(DTMF_PENDING_EVENTS)
+    {
+        attach();
+    }
+
+    void attach()
+    {
+        setEventSink(&queue);
+        setConfig(&config);
+    }
+
+    void feed(const int16_t *samples, size_t count)
+    {
+        // The detector takes at most 2^32 - 1 samples at a time.
+        while(count > 0)
+        {
+            UINT32 chunk = count < 0xffffffffu ? static_cast<UINT32>(count) : 0xffffffffu;
+            if(pool)
+                dtmfDetecting(samples, chunk, *pool);
+            else
+                consume(samples, chunk);
+            // The dial buttons array is not used through this interface.
+            zerosIndexDialButton();
+            samples += chunk;
+            count -= chunk;
+        }
+    }
+
+    size_t analyze(const int16_t *samples, size_t count,
+                   char *decisions, int32_t *magnitudes)
+    {
+        Scratch &scratch = threadScratch();
+        const DtmfDetectorConfig &current = *config.get();
+        size_t blocks = count / SAMPLES;
+        for(size_t ii = 0; ii < blocks; ii++)
+        {
+            // Silent blocks are rejected before any magnitude is computed.
+            memset(scratch.T, 0, sizeof(scratch.T));
+            if(mode == MODE_DTMF)
+                decisions[ii] = DTMF_detection(&samples[ii * SAMPLES], current, scratch);
+            else
+                decisions[ii] = MF_detection(&samples[ii * SAMPLES], current, scratch);
+            if(magnitudes)
+                memcpy(&magnitudes[ii * COEFF_NUMBER], scratch.T, sizeof(scratch.T));
+        }
+        return blocks;
+    }
+};
+
+struct dtmf_generator : public DtmfGenerator
+{
+    int32_t frameSize;
+
+    dtmf_generator(int32_t frame_size, int32_t push_ms, int32_t pause_ms)
+        : DtmfGenerator(frame_size, push_ms, pause_ms), frameSize(frame_size)
+    {
+    }
+};
+
+int dtmf_abi_version(void)
+{
+    return DTMF_ABI_VERSION;
+}
+
+dtmf_detector *dtmf_detector_create(void)
+{
+    return new dtmf_detector;
+}
+
+void dtmf_detector_destroy(dtmf_detector *detector)
+{
+    delete detector;
+}
+
+void dtmf_detector_reset(dtmf_detector *detector)
+{
+    DtmfEvent event;
+    DtmfDetector::Mode mode = detector->getMode();
+    detector->reset();
+    detector->attach();
+    detector->setMode(mode);
+    while(detector->queue.drain(&event, 1))
+        ;
+}
+
+void dtmf_detector_set_mode(dtmf_detector *detector, int mode)
+{
+    detector->setMode(static_cast<DtmfDetector::Mode>(mode));
+}
+
+void dtmf_detector_set_thresholds(dtmf_detector *detector,
+        int32_t power_threshold,
+        int32_t dial_tones_to_others_tones,
+        int32_t dial_tones_to_others_dial_tones)
+{
+    DtmfDetectorConfig config;
+    config.powerThreshold = power_threshold;
+    config.dialTonesToOhersTones = dial_tones_to_others_tones;
+    config.dialTonesToOhersDialTones = dial_tones_to_others_dial_tones;
+    detector->config.publish(config);
+    // Only the calling thread uses this detector, so nothing can still be
+    // reading the old configuration.
+    detector->config.reclaim();
+}
+
+void dtmf_detector_set_threads(dtmf_detector *detector, unsigned threads)
+{
+    detector->pool.reset();
+    if(threads != 1)
+    {
+        detector->pool.reset(new DtmfWorkerPool(threads));
+        if(detector->pool->size() < 2)
+            detector->pool.reset();
+    }
+}
+
+void dtmf_detector_feed(dtmf_detector *detector,
+        const int16_t *samples, size_t count)
+{
+    detector->feed(samples, count);
+}
+
+size_t dtmf_detector_pull(dtmf_detector *detector,
+        dtmf_event *events, size_t max)
+{
+    DtmfEvent event;
+    size_t ii;
+    for(ii = 0; ii < max && detector->queue.drain(&event, 1); ii++)
+    {
+        events[ii].sample = event.sample;
+        events[ii].digit = event.digit;
+    }
+    return ii;
+}
+
+size_t dtmf_detector_analyze(dtmf_detector *detector,
+        const int16_t *samples, size_t count,
+        char *decisions, int32_t *magnitudes)
+{
+    return detector->analyze(samples, count, decisions, magnitudes);
+}
+
+size_t dtmf_detector_save_state(const dtmf_detector *detector,
+        void *state, size_t size)
+{
+    return detector->saveState(static_cast<unsigned char *>(state),
+                               size < DTMF_DETECTOR_STATE_BYTES ? size : DTMF_DETECTOR_STATE_BYTES);
+}
+
+int dtmf_detector_restore_state(dtmf_detector *detector,
+        const void *state, size_t size)
+{
+    if(size > DTMF_DETECTOR_STATE_BYTES)
+        return 0;
+    return detector->restoreState(static_cast<const unsigned char *>(state), size);
+}
+
+dtmf_generator *dtmf_generator_create(int32_t frame_size,
+        int32_t push_ms, int32_t pause_ms)
+{
+    return new dtmf_generator(frame_size, push_ms, pause_ms);
+}
+
+void dtmf_generator_destroy(dtmf_generator *generator)
+{
+    delete generator;
+}
+
+int dtmf_generator_transmit(dtmf_generator *generator,
+        const char *buttons, uint32_t count)
+{
+    // transmitNewDialButtonsArray only reads the buttons.
+    return generator->transmitNewDialButtonsArray(const_cast<char *>(buttons), count);
+}
+
+size_t dtmf_generator_render(dtmf_generator *generator,
+        int16_t *out, size_t max_frames)
+{
+    size_t ii;
+    for(ii = 0; ii < max_frames && !generator->getReadyFlag(); ii++)
+    {
+        generator->dtmfGenerating(&out[ii * generator->frameSize]);
+        // dtmfGenerating sets the ready flag when it runs out of push
+        // buttons, in which case it has not written the frame.
+        if(generator->getReadyFlag())
+            break;
+    }
+    return ii;
+}
+
+size_t dtmf_generator_save_state(const dtmf_generator *generator,
+        void *state, size_t size)
+{
+    return generator->saveState(static_cast<unsigned char *>(state),
+                                size < DTMF_GENERATOR_STATE_BYTES ? size : DTMF_GENERATOR_STATE_BYTES);
+}
+
+int dtmf_generator_restore_state(dtmf_generator *generator,
+        const void *state, size_t size)
+{
+    if(size > DTMF_GENERATOR_STATE_BYTES
+       || !generator->restoreState(static_cast<const unsigned char *>(state), size))
+        return 0;
+    generator->frameSize = generator->getFrameSize();
+    return 1;
+}
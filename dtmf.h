@@ -0,0 +1,146 @@
+/*
+ * A stable C interface to the DTMF detector and generator, for use from
+ * other languages (e.g. Python's ctypes, see scripts/dtmflib.py).
+ *
+ * All the objects are opaque.  Functions taking a detector or generator
+ * must not be called concurrently on the same object.  Samples are 16-bit
+ * linear PCM at 8KHz.
+ */
+
+#ifndef DTMF_H
+#define DTMF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DTMF_API __attribute__((visibility("default")))
+
+/* Bumped whenever an existing declaration in this file changes. */
+#define DTMF_ABI_VERSION 1
+
+/* The number of samples the detector analyses at a time. */
+#define DTMF_BLOCK_SAMPLES 102
+/* The number of Goertzel magnitudes computed for each block. */
+#define DTMF_MAGNITUDES 18
+
+/* The largest snapshots dtmf_detector_save_state and
+ * dtmf_generator_save_state write. */
+#define DTMF_DETECTOR_STATE_BYTES 288
+#define DTMF_GENERATOR_STATE_BYTES 72
+/* The number of detected push buttons a detector holds for dtmf_detector_pull */
+#define DTMF_PENDING_EVENTS 4096
+
+typedef struct dtmf_detector dtmf_detector;
+typedef struct dtmf_generator dtmf_generator;
+
+typedef struct dtmf_event
+{
+    /* Position of the start of the tone, in samples since creation/reset */
+    uint64_t sample;
+    /* The push button: 0-9, A-D, * or # */
+    char digit;
+} dtmf_event;
+
+/* Returns DTMF_ABI_VERSION of the library actually loaded. */
+DTMF_API int dtmf_abi_version(void);
+
+/*
+ * Detector
+ */
+DTMF_API dtmf_detector *dtmf_detector_create(void);
+DTMF_API void dtmf_detector_destroy(dtmf_detector *detector);
+DTMF_API void dtmf_detector_reset(dtmf_detector *detector);
+/* Replace the default thresholds. */
+DTMF_API void dtmf_detector_set_thresholds(dtmf_detector *detector,
+        int32_t power_threshold,
+        int32_t dial_tones_to_others_tones,
+        int32_t dial_tones_to_others_dial_tones);
+/* What the detector looks for. */
+enum
+{
+    DTMF_MODE_DTMF = 0,
+    /* MF R1: digits 0-9, KP as 'K', ST as 'S', ST' ST'' ST''' as 'A' 'B' 'C' */
+    DTMF_MODE_MF_R1 = 1,
+    /* MF R2 forward and backward signals, numbered 1-9 then A-F */
+    DTMF_MODE_MF_R2_FORWARD = 2,
+    DTMF_MODE_MF_R2_BACKWARD = 3
+};
+/* Look for the signals of mode (one of DTMF_MODE_*) instead of DTMF.  The
+ * mode is kept across dtmf_detector_reset. */
+DTMF_API void dtmf_detector_set_mode(dtmf_detector *detector, int mode);
+/* Decide the blocks of large inputs to dtmf_detector_feed on this many
+ * threads (0 for one per CPU, 1 to stop).  The push buttons detected are
+ * the same whatever the number of threads.  Kept across
+ * dtmf_detector_reset. */
+DTMF_API void dtmf_detector_set_threads(dtmf_detector *detector, unsigned threads);
+/* Run the detection over any number of samples. */
+DTMF_API void dtmf_detector_feed(dtmf_detector *detector,
+        const int16_t *samples, size_t count);
+/* Move up to max detected push buttons into events.  Returns the number
+ * moved.  Up to DTMF_PENDING_EVENTS push buttons are kept between pulls;
+ * any more are lost. */
+DTMF_API size_t dtmf_detector_pull(dtmf_detector *detector,
+        dtmf_event *events, size_t max);
+/*
+ * Analyse each whole block of samples on its own, in the detector's mode,
+ * without affecting the state of the detector.  For block i, decisions[i]
+ * receives the push button (or MF signal) detected in the block (' ' if
+ * none), and, unless magnitudes is NULL, magnitudes[i*DTMF_MAGNITUDES ...]
+ * receives its Goertzel magnitudes (all 0 for blocks rejected as silence).
+ * In the MF modes, only the first 6 are used, for the mode's frequencies
+ * in the order the standard numbers them; the others are 0.  Returns the
+ * number of blocks, i.e. count / DTMF_BLOCK_SAMPLES.
+ */
+DTMF_API size_t dtmf_detector_analyze(dtmf_detector *detector,
+        const int16_t *samples, size_t count,
+        char *decisions, int32_t *magnitudes);
+
+/*
+ * Snapshot the state of the channel into state, so that it can be
+ * continued by another detector, possibly in another process or on
+ * another machine.  The mode is part of it; the thresholds, threads and
+ * push buttons not pulled yet are not.  Returns the number of
+ * bytes written (at most DTMF_DETECTOR_STATE_BYTES), or 0 if size is too
+ * small.
+ */
+DTMF_API size_t dtmf_detector_save_state(const dtmf_detector *detector,
+        void *state, size_t size);
+/* Continue from a snapshot.  Returns 0, leaving the detector unchanged,
+ * if state is not a valid snapshot. */
+DTMF_API int dtmf_detector_restore_state(dtmf_detector *detector,
+        const void *state, size_t size);
+/*
+ * Generator
+ *
+ * Renders in frames of frame_size samples.  Each push button lasts
+ * push_ms, followed by pause_ms of silence, both rounded up to whole
+ * frames.
+ */
+DTMF_API dtmf_generator *dtmf_generator_create(int32_t frame_size,
+        int32_t push_ms, int32_t pause_ms);
+DTMF_API void dtmf_generator_destroy(dtmf_generator *generator);
+/* Queue up to 20 push buttons.  Returns 0 if the previous ones have not
+ * been rendered completely yet. */
+DTMF_API int dtmf_generator_transmit(dtmf_generator *generator,
+        const char *buttons, uint32_t count);
+/* Render up to max_frames frames into out.  Returns the number of frames
+ * rendered, which is less than max_frames once everything queued has been
+ * rendered. */
+DTMF_API size_t dtmf_generator_render(dtmf_generator *generator,
+        int16_t *out, size_t max_frames);
+/* Snapshot the generator into state, as dtmf_detector_save_state.  The
+ * snapshot includes the frame size. */
+DTMF_API size_t dtmf_generator_save_state(const dtmf_generator *generator,
+        void *state, size_t size);
+DTMF_API int dtmf_generator_restore_state(dtmf_generator *generator,
+        const void *state, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
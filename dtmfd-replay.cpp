@@ -0,0 +1,206 @@
+//
+// A stand-in for a media server, to try dtmfd on a single machine.
+//
+// Creates the shared memory segment, replays AU files into its channels
+// in 20ms packets (channel i plays file i modulo the number of files), and
+// prints the push buttons dtmfd sends back.  The files must be 8KHz, PCM
+// encoded, mono, as for detect-au.
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "AuFile.hpp"
+#include "DtmfShmRing.hpp"
+
+//
+// The samples in a packet.
+//
+#define PACKET 160
+
+using namespace std;
+
+static bool
+load_au(const char *fname, vector<INT16> &samples)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << fname << ": unable to open file" << endl;
+        return false;
+    }
+    AuHeader header;
+    if (!readAuHeader(fd, header) || header.encoding != AU_ENCODING_PCM8
+        || header.sample_rate != 8000 || header.nchannels != 1)
+    {
+        cerr << fname << ": unsupported AU format" << endl;
+        close(fd);
+        return false;
+    }
+    vector<signed char> data(header.nsamples);
+    ssize_t n = pread(fd, data.empty() ? NULL : &data[0], data.size(), header.header_size);
+    close(fd);
+    if (n < 0)
+    {
+        cerr << fname << ": unable to read file" << endl;
+        return false;
+    }
+    //
+    // Promote to 16 bits, as detect-au does.
+    //
+    samples.resize(n);
+    for (ssize_t ii = 0; ii < n; ++ii)
+        samples[ii] = data[ii] << 8;
+    return true;
+}
+
+static uint64_t
+now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//
+// Print the events waiting in the segment.  Returns how many there were.
+//
+static size_t
+print_events(DtmfShmRing &ring)
+{
+    DtmfEvent events[256];
+    size_t total = 0;
+    for (UINT32 n; (n = ring.drainEvents(events, 256)) > 0; total += n)
+    {
+        for (UINT32 ii = 0; ii < n; ++ii)
+            cout << events[ii].channel << ": " << events[ii].sample << " " << events[ii].digit << endl;
+    }
+    return total;
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -n name          The shared memory segment (default /dtmfd)
+    // -c channels      Number of channels (default: one per file)
+    // -r samples       Ring size per channel (default 4096)
+    // -p               Pace the packets in real time, every 20ms, instead
+    //                  of as fast as dtmfd takes them
+    //
+    const char *name = "/dtmfd";
+    UINT32 channels = 0, ring_samples = 4096;
+    bool paced = false;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:r:p")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            name = optarg;
+            break;
+        case 'c':
+            channels = atoi(optarg);
+            break;
+        case 'r':
+            ring_samples = atoi(optarg);
+            break;
+        case 'p':
+            paced = true;
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc == optind || ring_samples < PACKET)
+    {
+        cerr << "usage: " << argv[0] << " [-n name] [-c channels] [-r samples] [-p] file.au..." << endl;
+        return 1;
+    }
+    vector<vector<INT16> > files(argc - optind);
+    for (size_t ii = 0; ii < files.size(); ++ii)
+        if (!load_au(argv[optind + ii], files[ii]))
+            return 1;
+    if (channels == 0)
+        channels = files.size();
+
+    DtmfShmRing *ring = DtmfShmRing::create(name, channels, ring_samples, 65536);
+    if (!ring)
+    {
+        cerr << name << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    for (UINT32 ch = 0; ch < channels; ++ch)
+        ring->startCall(ch);
+
+    //
+    // Write a packet to every channel with audio left per round.  A packet
+    // that does not fit is retried in the next round.
+    //
+    vector<size_t> positions(channels, 0);
+    size_t events = 0;
+    uint64_t start = now_us(), round = 0;
+    for (UINT32 left = channels; left > 0; ++round)
+    {
+        bool full = false;
+        left = 0;
+        for (UINT32 ch = 0; ch < channels; ++ch)
+        {
+            const vector<INT16> &file = files[ch % files.size()];
+            size_t &pos = positions[ch];
+            if (pos >= file.size())
+                continue;
+            UINT32 count = min<size_t>(PACKET, file.size() - pos);
+            UINT32 written = ring->write(ch, &file[pos], count);
+            pos += written;
+            full = full || written < count;
+            if (pos < file.size())
+                left++;
+        }
+        ring->publish();
+        events += print_events(*ring);
+        if (paced)
+        {
+            int64_t ahead = (int64_t)(start + (round + 1) * 20000) - (int64_t)now_us();
+            if (ahead > 0)
+                usleep(ahead);
+        }
+        else if (full)
+        {
+            //
+            // Let dtmfd catch up if the rings are full.
+            //
+            ring->waitEvents(ring->eventSequence(), 1);
+        }
+    }
+    ring->finish();
+
+    //
+    // Wait for dtmfd to process everything, and print the rest of the
+    // events.
+    //
+    while (!ring->daemonDone())
+    {
+        uint32_t seq = ring->eventSequence();
+        events += print_events(*ring);
+        if (!ring->daemonDone())
+            ring->waitEvents(seq, 100);
+    }
+    events += print_events(*ring);
+    cerr << channels << " channels, " << events << " events, " << ring->eventsDropped()
+        << " dropped, " << (now_us() - start) / 1000 << "ms" << endl;
+    DtmfShmRing::unlink(name);
+    delete ring;
+    return 0;
+}
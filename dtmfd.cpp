@@ -0,0 +1,188 @@
+//
+// Detect push buttons in the channels a media server writes to a shared
+// memory segment (see DtmfShmRing), and publish them back through it.
+//
+// The detectors run straight over the samples in the segment.  The daemon
+// sleeps on a futex while there is no new audio.  It exits once the media
+// server has finished and all the audio is processed, or on SIGINT or
+// SIGTERM.
+//
+// With -c, the last few seconds of every channel are kept, and dumped as
+// AU files (see DtmfCapture) on SIGUSR2.
+//
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <unistd.h>
+
+#include "DtmfCapture.hpp"
+#include "DtmfDetectorPool.hpp"
+#include "DtmfShmRing.hpp"
+
+//
+// How long to sleep at a time, in ms: the daemon also wakes up this often
+// to check for signals.
+//
+#define WAIT_MS 100
+
+using namespace std;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void
+on_signal(int)
+{
+    stopping = 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -n name          The shared memory segment (default /dtmfd)
+    // -w seconds       Wait this long for the media server to create the
+    //                  segment (default 10)
+    // -c seconds       Keep the last seconds of each channel's audio
+    // -C directory     Where SIGUSR2 dumps them (default .)
+    //
+    const char *name = "/dtmfd";
+    int wait_seconds = 10;
+    int capture_seconds = 0;
+    const char *capture_dir = ".";
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:c:C:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            name = optarg;
+            break;
+        case 'w':
+            wait_seconds = atoi(optarg);
+            break;
+        case 'c':
+            capture_seconds = atoi(optarg);
+            bad_usage = bad_usage || capture_seconds <= 0;
+            break;
+        case 'C':
+            capture_dir = optarg;
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc != optind)
+    {
+        cerr << "usage: " << argv[0] << " [-n name] [-w seconds] [-c seconds] [-C directory]" << endl;
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    DtmfShmRing *ring = NULL;
+    for (int tries = 0; !stopping && !(ring = DtmfShmRing::attach(name)); ++tries)
+    {
+        if (tries >= wait_seconds * 1000 / WAIT_MS)
+        {
+            cerr << name << ": no usable shared memory segment" << endl;
+            return 1;
+        }
+        usleep(WAIT_MS * 1000);
+    }
+    if (!ring)
+        return 1;
+
+    //
+    // One detector per channel, publishing straight into the segment.
+    //
+    const UINT32 channels = ring->channels();
+    DtmfDetectorPool pool(channels);
+    vector<DtmfDetector *> detectors(channels);
+    vector<uint32_t> calls(channels);
+    DtmfCaptureArena *arena = NULL;
+    vector<DtmfCapture *> captures(channels);
+    if (capture_seconds)
+    {
+        arena = new DtmfCaptureArena(channels, capture_seconds);
+        arena->dumpOnSignal(SIGUSR2, capture_dir);
+    }
+    for (UINT32 ch = 0; ch < channels; ++ch)
+    {
+        detectors[ch] = pool.acquire(DtmfDetector::batchSamples());
+        detectors[ch]->setEventSink(ring, ch);
+        if (arena)
+        {
+            captures[ch] = arena->acquire();
+            detectors[ch]->setCapture(captures[ch]);
+        }
+        calls[ch] = ring->call(ch);
+    }
+    cerr << name << ": " << channels << " channels of " << ring->ringSamples() << " samples" << endl;
+    if (arena)
+        cerr << name << ": " << capture_seconds << "s captures, " << DtmfCaptureArena::bytesFor(channels, capture_seconds)
+            << " bytes, dumped to " << capture_dir << " on SIGUSR2" << endl;
+
+    while (!stopping)
+    {
+        uint32_t seq = ring->audioSequence();
+        bool worked = false;
+        for (UINT32 word = 0; word < ring->dirtyWords(); ++word)
+        {
+            for (uint64_t bits = ring->takeDirty(word); bits; bits &= bits - 1)
+            {
+                UINT32 ch = word * 64 + __builtin_ctzll(bits);
+                DtmfDetector *detector = detectors[ch];
+                uint32_t call = ring->call(ch);
+                if (call != calls[ch])
+                {
+                    calls[ch] = call;
+                    detector->reset();
+                    detector->setEventSink(ring, ch);
+                    detector->setCapture(captures[ch]);
+                    ring->skipToCall(ch);
+                }
+                //
+                // At most two runs: up to the end of the ring, then from
+                // its start.  What the media server writes meanwhile waits
+                // for the next pass, so that a busy channel does not hold
+                // up the others.  A call started since the check above
+                // ends the runs: the next pass resets the detector and
+                // skips to the new call.
+                //
+                const INT16 *samples;
+                UINT32 count;
+                for (int run = 0; run < 2 && (count = ring->peek(ch, samples, call)) > 0; ++run)
+                {
+                    detector->dtmfDetecting(samples, count);
+                    ring->consume(ch, count);
+                    worked = true;
+                }
+                if (ring->peek(ch, samples) > 0)
+                    ring->markDirty(ch);
+            }
+        }
+        if (worked)
+        {
+            ring->publishEvents();
+            continue;
+        }
+        if (ring->drained())
+        {
+            ring->setDone();
+            break;
+        }
+        ring->waitAudio(seq, WAIT_MS);
+    }
+
+    if (ring->eventsDropped())
+        cerr << name << ": " << ring->eventsDropped() << " events dropped" << endl;
+    for (UINT32 ch = 0; ch < channels; ++ch)
+        pool.release(detectors[ch]);
+    delete ring;
+    // The arena stays: the dumping thread may still use it.
+    return 0;
+}
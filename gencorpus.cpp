@@ -0,0 +1,464 @@
+//
+// Render a labeled corpus of DTMF recordings for regression and capacity
+// testing.
+//
+// Each file holds a random string of push buttons rendered by
+// DtmfGenerator, with random tone and pause durations and levels, over
+// optional white noise and a speech bed.  Next to each audio file, a label
+// file gives the sample-exact start and end of every tone.  Files are
+// rendered in parallel and written through mmap.  File i only depends on
+// the seed and i, so a corpus is the same whatever the number of threads.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "AuFile.hpp"
+#include "DtmfGenerator.hpp"
+
+#define RATE 8000
+
+using namespace std;
+
+static const char DIGITS[] = "0123456789*#ABCD";
+
+//
+// A range of values, given on the command line as lo:hi (or just a single
+// value).
+//
+struct Range
+{
+    double lo, hi;
+};
+
+struct Options
+{
+    const char *dir;
+    unsigned files;
+    unsigned seed;
+    bool wav;
+    unsigned bits;
+    Range digits;
+    Range tone_ms;
+    Range pause_ms;
+    // Attenuation of each tone from DtmfGenerator's level, in dB.
+    Range attenuation;
+    // The level of the white noise, in dBFS; none if not set.
+    bool noise;
+    double noise_dbfs;
+    // The speech bed, attenuated by bed_db from its own level.
+    vector<float> bed;
+    double bed_db;
+};
+
+// A tone in a file, in samples from the start of the file.  offset is one
+// past its last sample.
+struct Label
+{
+    uint64_t onset;
+    uint64_t offset;
+    char digit;
+};
+
+static bool
+parse_range(const char *text, Range &range)
+{
+    char *end;
+    range.lo = strtod(text, &end);
+    if (end == text)
+        return false;
+    if (*end == ':')
+    {
+        const char *hi = end + 1;
+        range.hi = strtod(hi, &end);
+        if (end == hi)
+            return false;
+    }
+    else
+    {
+        range.hi = range.lo;
+    }
+    return *end == 0 && range.lo <= range.hi;
+}
+
+static double
+pick(const Range &range, mt19937 &rng)
+{
+    return uniform_real_distribution<double>(range.lo, range.hi)(rng);
+}
+
+//
+// Load the speech bed from an 8KHz mono AU file, scaled to [-1, 1).
+//
+static bool
+load_bed(const char *fname, vector<float> &bed)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << fname << ": unable to open file" << endl;
+        return false;
+    }
+    AuHeader header;
+    vector<INT16> samples;
+    bool ok = readAuHeader(fd, header) && header.sample_rate == RATE
+        && readAuSamples(fd, header, samples);
+    close(fd);
+    if (!ok)
+    {
+        cerr << fname << ": unsupported AU format" << endl;
+        return false;
+    }
+    if (samples.empty())
+    {
+        cerr << fname << ": no samples" << endl;
+        return false;
+    }
+    size_t count = samples.size();
+    bed.resize(count);
+    for (size_t ii = 0; ii < count; ++ii)
+        bed[ii] = samples[ii] / 32768.0f;
+    return true;
+}
+
+//
+// Render tone samples of push button digit into out, at gain.
+//
+static void
+render_tone(char digit, size_t samples, float gain, float out[])
+{
+    //
+    // DtmfGenerator works in whole frames; render enough 1ms frames and
+    // keep the samples asked for.
+    //
+    const int frame = RATE / 1000;
+    DtmfGenerator generator(frame, (samples + frame - 1) / frame, 0);
+    char buttons[1] = { digit };
+    INT16 buf[frame];
+    generator.transmitNewDialButtonsArray(buttons, 1);
+    size_t done = 0;
+    while (done < samples && !generator.getReadyFlag())
+    {
+        generator.dtmfGenerating(buf);
+        for (int ii = 0; ii < frame && done < samples; ++ii)
+            out[done++] = gain * buf[ii] / 32768.0f;
+    }
+}
+
+//
+// Render file index: its samples, in [-1, 1), and its labels.
+//
+static void
+render(unsigned index, const Options &options, vector<float> &mix, vector<Label> &labels)
+{
+    seed_seq seq = { options.seed, index };
+    mt19937 rng(seq);
+    unsigned ndigits = (unsigned)lround(pick(options.digits, rng));
+
+    //
+    // The layout first: a pause before each tone, and one after the last.
+    //
+    labels.clear();
+    uint64_t pos = 0;
+    for (unsigned ii = 0; ii < ndigits; ++ii)
+    {
+        Label label;
+        pos += (uint64_t)(pick(options.pause_ms, rng) * RATE / 1000);
+        label.onset = pos;
+        pos += max<uint64_t>(1, (uint64_t)(pick(options.tone_ms, rng) * RATE / 1000));
+        label.offset = pos;
+        label.digit = DIGITS[rng() % 16];
+        labels.push_back(label);
+    }
+    pos += (uint64_t)(pick(options.pause_ms, rng) * RATE / 1000);
+
+    mix.assign(pos, 0.0f);
+    for (size_t ii = 0; ii < labels.size(); ++ii)
+    {
+        float gain = pow(10.0, -pick(options.attenuation, rng) / 20);
+        render_tone(labels[ii].digit, labels[ii].offset - labels[ii].onset, gain, &mix[labels[ii].onset]);
+    }
+    if (!options.bed.empty())
+    {
+        float gain = pow(10.0, -options.bed_db / 20);
+        size_t start = rng() % options.bed.size();
+        for (size_t ii = 0; ii < mix.size(); ++ii)
+            mix[ii] += gain * options.bed[(start + ii) % options.bed.size()];
+    }
+    if (options.noise)
+    {
+        //
+        // White noise of that RMS level.
+        //
+        normal_distribution<float> noise(0.0f, pow(10.0, options.noise_dbfs / 20));
+        for (size_t ii = 0; ii < mix.size(); ++ii)
+            mix[ii] += noise(rng);
+    }
+}
+
+static void
+put_le(unsigned char *out, uint32_t value, unsigned bytes)
+{
+    for (unsigned ii = 0; ii < bytes; ++ii, value >>= 8)
+        out[ii] = (unsigned char)value;
+}
+
+//
+// Write samples to path as an AU or WAV file, through a shared mapping of
+// the file.
+//
+static bool
+write_audio(const string &path, const Options &options, const vector<float> &samples)
+{
+    const size_t header_size = options.wav ? 44 : 24;
+    const size_t data_size = samples.size() * options.bits / 8;
+    const size_t size = header_size + data_size;
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+    unsigned char *out = (unsigned char *)mem;
+
+    if (options.wav)
+    {
+        memcpy(out, "RIFF", 4);
+        put_le(out + 4, size - 8, 4);
+        memcpy(out + 8, "WAVEfmt ", 8);
+        put_le(out + 16, 16, 4);
+        put_le(out + 20, 1, 2);
+        put_le(out + 22, 1, 2);
+        put_le(out + 24, RATE, 4);
+        put_le(out + 28, RATE * options.bits / 8, 4);
+        put_le(out + 32, options.bits / 8, 2);
+        put_le(out + 34, options.bits, 2);
+        memcpy(out + 36, "data", 4);
+        put_le(out + 40, data_size, 4);
+    }
+    else
+    {
+        AuHeader header;
+        header.magic = AU_MAGIC;
+        header.header_size = header_size;
+        header.nsamples = data_size;
+        header.encoding = options.bits == 8 ? AU_ENCODING_PCM8 : AU_ENCODING_PCM16;
+        header.sample_rate = RATE;
+        header.nchannels = 1;
+        encodeAuHeader(header, out);
+    }
+
+    unsigned char *data = out + header_size;
+    for (size_t ii = 0; ii < samples.size(); ++ii)
+    {
+        long value = lrint(samples[ii] * 32768);
+        value = max(-32768L, min(32767L, value));
+        if (options.bits == 16 && options.wav)
+        {
+            put_le(data + 2 * ii, (uint16_t)value, 2);
+        }
+        else if (options.bits == 16)
+        {
+            data[2 * ii] = (unsigned char)((uint16_t)value >> 8);
+            data[2 * ii + 1] = (unsigned char)value;
+        }
+        else
+        {
+            //
+            // 8-bit WAV is unsigned, 8-bit AU signed.
+            //
+            data[ii] = (unsigned char)((value >> 8) + (options.wav ? 128 : 0));
+        }
+    }
+    return munmap(mem, size) == 0;
+}
+
+static bool
+write_labels(const string &path, const vector<Label> &labels)
+{
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out)
+        return false;
+    fprintf(out, "# onset offset digit, in samples at %dHz; offset is one past the tone\n", RATE);
+    for (size_t ii = 0; ii < labels.size(); ++ii)
+        fprintf(out, "%llu %llu %c\n", (unsigned long long)labels[ii].onset,
+                (unsigned long long)labels[ii].offset, labels[ii].digit);
+    return fclose(out) == 0;
+}
+
+//
+// Render files, taking the next index from next, until there are none
+// left or a file can't be written.
+//
+static void
+work(const Options &options, atomic<unsigned> &next, atomic<uint64_t> &samples, atomic<bool> &failed)
+{
+    vector<float> mix;
+    vector<Label> labels;
+    char name[32];
+    for (unsigned index; !failed && (index = next++) < options.files; )
+    {
+        render(index, options, mix, labels);
+        snprintf(name, sizeof(name), "/%08u", index);
+        string base = string(options.dir) + name;
+        if (!write_audio(base + (options.wav ? ".wav" : ".au"), options, mix)
+            || !write_labels(base + ".lab", labels))
+        {
+            cerr << base << ": " << strerror(errno) << endl;
+            failed = true;
+        }
+        samples += mix.size();
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -o directory     Where to write the files (required)
+    // -n files         Number of files (default 1000)
+    // -j threads       Render on this many threads (default 1, 0 for one
+    //                  per CPU)
+    // -s seed          Random seed (default 1)
+    // -f au|wav        File format (default au)
+    // -b 8|16          Bits per sample (default 8 for AU, as detect-au
+    //                  reads, 16 for WAV)
+    // -d lo:hi         Push buttons per file (default 1:10)
+    // -t lo:hi         Tone duration in ms (default 40:100)
+    // -p lo:hi         Pause before each tone, and after the last, in ms
+    //                  (default 40:200)
+    // -a lo:hi         Tone attenuation in dB (default 0:20)
+    // -N dbfs          Add white noise of this level
+    // -S file.au       Add a speech bed from this 8KHz mono AU file,
+    //                  starting at a random point and looped
+    // -B db            Attenuate the speech bed by this much (default 10)
+    //
+    Options options;
+    options.dir = NULL;
+    options.files = 1000;
+    options.seed = 1;
+    options.wav = false;
+    options.bits = 0;
+    options.digits.lo = 1, options.digits.hi = 10;
+    options.tone_ms.lo = 40, options.tone_ms.hi = 100;
+    options.pause_ms.lo = 40, options.pause_ms.hi = 200;
+    options.attenuation.lo = 0, options.attenuation.hi = 20;
+    options.noise = false;
+    options.noise_dbfs = 0;
+    options.bed_db = 10;
+    const char *bed = NULL;
+    unsigned threads = 1;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:n:j:s:f:b:d:t:p:a:N:S:B:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            options.dir = optarg;
+            break;
+        case 'n':
+            options.files = atoi(optarg);
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 's':
+            options.seed = atoi(optarg);
+            break;
+        case 'f':
+            options.wav = strcmp(optarg, "wav") == 0;
+            bad_usage = bad_usage || (!options.wav && strcmp(optarg, "au") != 0);
+            break;
+        case 'b':
+            options.bits = atoi(optarg);
+            bad_usage = bad_usage || (options.bits != 8 && options.bits != 16);
+            break;
+        case 'd':
+            bad_usage = bad_usage || !parse_range(optarg, options.digits) || options.digits.lo < 0;
+            break;
+        case 't':
+            bad_usage = bad_usage || !parse_range(optarg, options.tone_ms) || options.tone_ms.lo <= 0;
+            break;
+        case 'p':
+            bad_usage = bad_usage || !parse_range(optarg, options.pause_ms) || options.pause_ms.lo < 0;
+            break;
+        case 'a':
+            bad_usage = bad_usage || !parse_range(optarg, options.attenuation);
+            break;
+        case 'N':
+            options.noise = true;
+            options.noise_dbfs = atof(optarg);
+            break;
+        case 'S':
+            bed = optarg;
+            break;
+        case 'B':
+            options.bed_db = atof(optarg);
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    if (bad_usage || argc != optind || !options.dir)
+    {
+        cerr << "usage: " << argv[0] << " -o directory [-n files] [-j threads] [-s seed]"
+            " [-f au|wav] [-b 8|16] [-d lo:hi] [-t lo:hi] [-p lo:hi] [-a lo:hi]"
+            " [-N dbfs] [-S bed.au] [-B db]" << endl;
+        return 1;
+    }
+    if (!options.bits)
+        options.bits = options.wav ? 16 : 8;
+    if (bed && !load_bed(bed, options.bed))
+        return 1;
+    if (mkdir(options.dir, 0755) != 0 && errno != EEXIST)
+    {
+        cerr << options.dir << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    atomic<unsigned> next(0);
+    atomic<uint64_t> samples(0);
+    atomic<bool> failed(false);
+    vector<thread> workers;
+    for (unsigned ii = 1; ii < threads; ++ii)
+        workers.push_back(thread(work, cref(options), ref(next), ref(samples), ref(failed)));
+    work(options, next, samples, failed);
+    for (size_t ii = 0; ii < workers.size(); ++ii)
+        workers[ii].join();
+    gettimeofday(&end, NULL);
+    if (failed)
+        return 1;
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    cout << options.files << " files, " << (double)samples / RATE / 3600 << " hours of audio in "
+        << seconds << "s" << endl;
+    return 0;
+}
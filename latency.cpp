@@ -0,0 +1,287 @@
+//
+// Measure the detection latency: how long after a tone starts its push
+// button becomes visible to the caller of DtmfDetector::dtmfDetecting.
+//
+// Single tones are placed at random, sample-exact offsets in silence and
+// fed to a detector in frames of each of the frame sizes given.  The
+// latency of a tone is the number of samples from its first sample to the
+// end of the frame after which the push button is in the dial buttons
+// array.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "DtmfDetector.hpp"
+#include "DtmfGenerator.hpp"
+
+#define RATE 8000
+
+using namespace std;
+
+static const char DTMF_DIGITS[] = "123A456B789C*0#D";
+
+//
+// The frequencies of each MF mode, in the order of DtmfDetector's banks.
+//
+static const double MF_HZ[3][6] =
+{
+    { 700, 900, 1100, 1300, 1500, 1700 },
+    { 1380, 1500, 1620, 1740, 1860, 1980 },
+    { 1140, 1020, 900, 780, 660, 540 }
+};
+
+//
+// How the samples are passed to the detector.
+//
+enum Hop
+{
+    // Frames of exactly the frame size, through dtmfDetecting(frame).
+    HOP_FIXED,
+    // Chunks of 1 to twice the frame size (the frame size on average),
+    // through dtmfDetecting(samples, count), as from a jitter buffer.
+    HOP_JITTER
+};
+
+static const char *const HOP_NAMES[] = { "fixed", "jitter" };
+
+struct Tone
+{
+    vector<INT16> samples;
+    char digit;
+};
+
+//
+// A DTMF tone of duration_ms, from DtmfGenerator.
+//
+static void
+dtmf_tone(char digit, int duration_ms, Tone &tone)
+{
+    const int frame = RATE / 1000;
+    DtmfGenerator generator(frame, duration_ms, 0);
+    char buttons[1] = { digit };
+    INT16 samples[frame];
+    generator.transmitNewDialButtonsArray(buttons, 1);
+    tone.samples.clear();
+    while (!generator.getReadyFlag())
+    {
+        generator.dtmfGenerating(samples);
+        tone.samples.insert(tone.samples.end(), samples, samples + frame);
+    }
+    tone.digit = digit;
+}
+
+//
+// An MF signal of duration_ms: frequencies low and high of mode at -12dB
+// each.
+//
+static void
+mf_tone(DtmfDetector::Mode mode, unsigned low, unsigned high, int duration_ms, Tone &tone)
+{
+    const double *hz = MF_HZ[mode - DtmfDetector::MODE_MF_R1];
+    tone.samples.resize(duration_ms * RATE / 1000);
+    for (size_t ii = 0; ii < tone.samples.size(); ++ii)
+    {
+        double t = 2 * M_PI * ii / RATE;
+        tone.samples[ii] = (INT16)(8192 * (sin(hz[low] * t) + sin(hz[high] * t)));
+    }
+    tone.digit = DtmfDetector::mfSignal(mode, low, high);
+}
+
+struct Stats
+{
+    unsigned trials;
+    unsigned detected;
+    unsigned wrong;
+    // Latencies of the push buttons detected, in samples.
+    vector<unsigned> latencies;
+};
+
+static void
+measure(DtmfDetector::Mode mode, unsigned frame, Hop hop, unsigned trials, int duration_ms, mt19937 &rng, Stats &stats)
+{
+    DtmfDetector detector(frame);
+    Tone tone;
+    vector<INT16> signal;
+    stats.trials = trials;
+    stats.detected = stats.wrong = 0;
+    stats.latencies.clear();
+
+    for (unsigned trial = 0; trial < trials; ++trial)
+    {
+        if (mode == DtmfDetector::MODE_DTMF)
+        {
+            dtmf_tone(DTMF_DIGITS[rng() % 16], duration_ms, tone);
+        }
+        else
+        {
+            unsigned low = rng() % 6, high = rng() % 5;
+            if (high >= low)
+                high++;
+            else
+                swap(low, high);
+            mf_tone(mode, low, high, duration_ms, tone);
+        }
+
+        //
+        // At least 100ms of silence before the tone, and an offset that
+        // takes it through every phase of both the frames and the
+        // detector's batches.
+        //
+        unsigned onset = RATE / 10 + rng() % (frame * DtmfDetector::batchSamples());
+        signal.assign(onset, 0);
+        signal.insert(signal.end(), tone.samples.begin(), tone.samples.end());
+        signal.resize(signal.size() + RATE / 4, 0);
+
+        detector.reset(frame);
+        detector.setMode(mode);
+        size_t pos = 0;
+        while (pos < signal.size())
+        {
+            size_t chunk = hop == HOP_FIXED ? frame : 1 + rng() % (2 * frame - 1);
+            if (pos + chunk > signal.size())
+                break;
+            if (hop == HOP_FIXED)
+                detector.dtmfDetecting(&signal[pos]);
+            else
+                detector.dtmfDetecting(&signal[pos], chunk);
+            pos += chunk;
+            if (detector.getIndexDialButtons() > 0)
+            {
+                stats.detected++;
+                if (detector.getDialButtonsArray()[0] != tone.digit)
+                    stats.wrong++;
+                stats.latencies.push_back(pos - onset);
+                break;
+            }
+        }
+    }
+    sort(stats.latencies.begin(), stats.latencies.end());
+}
+
+static double
+ms(double samples)
+{
+    return samples * 1000 / RATE;
+}
+
+static void
+print(unsigned frame, Hop hop, const Stats &stats)
+{
+    char line[256];
+    const vector<unsigned> &l = stats.latencies;
+    if (l.empty())
+    {
+        snprintf(line, sizeof(line), "%6u %-7s %5u/%-5u %6u", frame, HOP_NAMES[hop],
+                 stats.detected, stats.trials, stats.wrong);
+    }
+    else
+    {
+        double sum = 0;
+        for (size_t ii = 0; ii < l.size(); ++ii)
+            sum += l[ii];
+        snprintf(line, sizeof(line), "%6u %-7s %5u/%-5u %6u %8.1f %8.1f %8.1f %8.1f %8.1f", frame, HOP_NAMES[hop],
+                 stats.detected, stats.trials, stats.wrong,
+                 ms(l.front()), ms(sum / l.size()), ms(l[l.size() / 2]),
+                 ms(l[(l.size() * 99 + 99) / 100 - 1]), ms(l.back()));
+    }
+    cout << line << endl;
+}
+
+static bool
+parse_mode(const char *name, DtmfDetector::Mode &mode)
+{
+    static const char *const names[] = { "dtmf", "r1", "r2f", "r2b" };
+    for (unsigned ii = 0; ii < 4; ++ii)
+    {
+        if (strcmp(name, names[ii]) == 0)
+        {
+            mode = (DtmfDetector::Mode)ii;
+            return true;
+        }
+    }
+    return false;
+}
+
+int
+main(int argc, char **argv)
+{
+    //
+    // -m mode          dtmf (default), r1, r2f or r2b
+    // -f sizes         Comma-separated frame sizes, in samples
+    //                  (default 80,102,160,240,256,320)
+    // -n trials        Tones per frame size and hop mode (default 1000)
+    // -d ms            Tone duration (default 70)
+    // -s seed          Random seed (default 1), for repeatable runs
+    //
+    DtmfDetector::Mode mode = DtmfDetector::MODE_DTMF;
+    string sizes = "80,102,160,240,256,320";
+    unsigned trials = 1000, seed = 1;
+    int duration_ms = 70;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:f:n:d:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            bad_usage = bad_usage || !parse_mode(optarg, mode);
+            break;
+        case 'f':
+            sizes = optarg;
+            break;
+        case 'n':
+            trials = atoi(optarg);
+            break;
+        case 'd':
+            duration_ms = atoi(optarg);
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        default:
+            bad_usage = true;
+        }
+    }
+    vector<unsigned> frames;
+    for (size_t start = 0; start < sizes.size(); )
+    {
+        size_t end = sizes.find(',', start);
+        if (end == string::npos)
+            end = sizes.size();
+        int frame = atoi(sizes.substr(start, end - start).c_str());
+        if (frame <= 0)
+            bad_usage = true;
+        else
+            frames.push_back(frame);
+        start = end + 1;
+    }
+    if (bad_usage || argc != optind || frames.empty() || trials == 0 || duration_ms <= 0)
+    {
+        cerr << "usage: " << argv[0] << " [-m dtmf|r1|r2f|r2b] [-f size,...] [-n trials] [-d ms] [-s seed]" << endl;
+        return 1;
+    }
+
+    cout << "tone " << duration_ms << "ms, " << trials << " per row; latencies in ms" << endl;
+    cout << " frame hop      found/tones  wrong      min     mean      p50      p99      max" << endl;
+    mt19937 rng(seed);
+    Stats stats;
+    for (size_t ii = 0; ii < frames.size(); ++ii)
+    {
+        for (int hop = HOP_FIXED; hop <= HOP_JITTER; ++hop)
+        {
+            measure(mode, frames[ii], (Hop)hop, trials, duration_ms, rng, stats);
+            print(frames[ii], (Hop)hop, stats);
+        }
+    }
+    return 0;
+}
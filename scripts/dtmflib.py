@@ -0,0 +1,191 @@
+"""Access to the C++ detector and generator through lib/libdtmf.so.
+
+The library gives the same decisions as the production detector, at native
+speed.  Build it with make in the top-level directory.  Set DTMF_LIB to use
+a library from another location.
+
+If the library can't be loaded, available() returns False and callers
+should fall back to their pure Python implementation.
+"""
+import os
+import ctypes
+from array import array
+
+BLOCK_SAMPLES = 102
+MAGNITUDES = 18
+DETECTOR_STATE_BYTES = 288
+ABI_VERSION = 1
+
+# Detector modes
+MODE_DTMF, MODE_MF_R1, MODE_MF_R2_FORWARD, MODE_MF_R2_BACKWARD = range(4)
+
+class Event(ctypes.Structure):
+    _fields_ = [("sample", ctypes.c_uint64), ("digit", ctypes.c_char)]
+
+def _load():
+    path = os.environ.get("DTMF_LIB")
+    if not path:
+        here = os.path.dirname(os.path.abspath(__file__))
+        path = os.path.join(here, "..", "lib", "libdtmf.so")
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        return None
+    if lib.dtmf_abi_version() != ABI_VERSION:
+        return None
+
+    p, i16p, i32p = ctypes.c_void_p, ctypes.POINTER(ctypes.c_int16), ctypes.POINTER(ctypes.c_int32)
+    size, i32 = ctypes.c_size_t, ctypes.c_int32
+    lib.dtmf_detector_create.restype = p
+    lib.dtmf_detector_create.argtypes = []
+    lib.dtmf_detector_destroy.argtypes = [p]
+    lib.dtmf_detector_reset.argtypes = [p]
+    lib.dtmf_detector_set_thresholds.argtypes = [p, i32, i32, i32]
+    lib.dtmf_detector_set_mode.argtypes = [p, ctypes.c_int]
+    lib.dtmf_detector_set_threads.argtypes = [p, ctypes.c_uint]
+    lib.dtmf_detector_feed.argtypes = [p, i16p, size]
+    lib.dtmf_detector_pull.restype = size
+    lib.dtmf_detector_pull.argtypes = [p, ctypes.POINTER(Event), size]
+    lib.dtmf_detector_analyze.restype = size
+    lib.dtmf_detector_analyze.argtypes = [p, i16p, size, ctypes.c_char_p, i32p]
+    lib.dtmf_detector_save_state.restype = size
+    lib.dtmf_detector_save_state.argtypes = [p, ctypes.c_char_p, size]
+    lib.dtmf_detector_restore_state.restype = ctypes.c_int
+    lib.dtmf_detector_restore_state.argtypes = [p, ctypes.c_char_p, size]
+    lib.dtmf_generator_create.restype = p
+    lib.dtmf_generator_create.argtypes = [i32, i32, i32]
+    lib.dtmf_generator_destroy.argtypes = [p]
+    lib.dtmf_generator_transmit.restype = ctypes.c_int
+    lib.dtmf_generator_transmit.argtypes = [p, ctypes.c_char_p, ctypes.c_uint32]
+    lib.dtmf_generator_render.restype = size
+    lib.dtmf_generator_render.argtypes = [p, i16p, size]
+    return lib
+
+_lib = _load()
+
+def available():
+    """Return True if the native library could be loaded."""
+    return _lib is not None
+
+def _int16(samples):
+    """Return samples as an array('h') and a pointer to its contents."""
+    if not isinstance(samples, array) or samples.typecode != "h":
+        samples = array("h", samples)
+    ptr = ctypes.cast(samples.buffer_info()[0], ctypes.POINTER(ctypes.c_int16))
+    return samples, ptr
+
+def promote(samples8):
+    """Promote signed 8-bit samples to 16 bits, as detect-au does."""
+    return array("h", [x << 8 for x in samples8])
+
+class Detector:
+    """A DtmfDetector.  Samples are 16-bit, 8KHz."""
+    def __init__(self, thresholds=None, mode=MODE_DTMF, threads=1):
+        self.handle = _lib.dtmf_detector_create()
+        if thresholds:
+            _lib.dtmf_detector_set_thresholds(self.handle, *thresholds)
+        if mode != MODE_DTMF:
+            _lib.dtmf_detector_set_mode(self.handle, mode)
+        if threads != 1:
+            _lib.dtmf_detector_set_threads(self.handle, threads)
+
+    def __del__(self):
+        if getattr(self, "handle", None):
+            _lib.dtmf_detector_destroy(self.handle)
+
+    def reset(self):
+        _lib.dtmf_detector_reset(self.handle)
+
+    def save_state(self):
+        """Return a snapshot of the channel state, as bytes."""
+        buf = ctypes.create_string_buffer(DETECTOR_STATE_BYTES)
+        n = _lib.dtmf_detector_save_state(self.handle, buf, len(buf))
+        return buf.raw[:n]
+
+    def restore_state(self, state):
+        """Continue from a snapshot taken by save_state.  Raise ValueError
+        if state is not a valid snapshot."""
+        if not _lib.dtmf_detector_restore_state(self.handle, state, len(state)):
+            raise ValueError("not a detector snapshot")
+
+    def feed(self, samples):
+        """Detect push buttons in samples.  Return a list of
+        (sample, digit) for each push button detected."""
+        samples, ptr = _int16(samples)
+        events = []
+        buf = (Event * 256)()
+        # Pull in between chunks so that the detector never holds more
+        # than it can keep.
+        chunk = BLOCK_SAMPLES * 1024
+        for start in range(0, len(samples), chunk):
+            count = min(chunk, len(samples) - start)
+            _lib.dtmf_detector_feed(self.handle, ctypes.cast(
+                ctypes.addressof(ptr.contents) + 2*start,
+                ctypes.POINTER(ctypes.c_int16)), count)
+            while True:
+                n = _lib.dtmf_detector_pull(self.handle, buf, len(buf))
+                events += [(e.sample, e.digit.decode("ascii")) for e in buf[:n]]
+                if n < len(buf):
+                    break
+        return events
+
+    def analyze(self, samples):
+        """Analyse each block of BLOCK_SAMPLES samples on its own, in the
+        detector's mode.  Return a list of (decision, magnitudes) per block,
+        where decision is the push button (or MF signal) detected in the
+        block (" " if none) and magnitudes the MAGNITUDES Goertzel
+        magnitudes (all 0 for silent blocks, and only the first 6 used in
+        the MF modes)."""
+        samples, ptr = _int16(samples)
+        nblocks = len(samples) // BLOCK_SAMPLES
+        decisions = ctypes.create_string_buffer(nblocks + 1)
+        mags = array("i", [0]) * (nblocks * MAGNITUDES)
+        mptr = ctypes.cast(mags.buffer_info()[0], ctypes.POINTER(ctypes.c_int32))
+        _lib.dtmf_detector_analyze(self.handle, ptr, len(samples), decisions, mptr)
+        raw = decisions.raw[:nblocks].decode("ascii")
+        return [(raw[i], mags[i*MAGNITUDES:(i+1)*MAGNITUDES]) for i in range(nblocks)]
+
+def generate(buttons, push_ms, pause_ms, frame_size=8):
+    """Render push buttons with the DtmfGenerator.  Return 16-bit samples in
+    an array('h').  Durations are rounded up to whole frames."""
+    gen = _lib.dtmf_generator_create(frame_size, push_ms, pause_ms)
+    out = array("h")
+    frames = 1024
+    buf = (ctypes.c_int16 * (frames * frame_size))()
+    try:
+        for start in range(0, len(buttons), 20):
+            chunk = buttons[start:start+20].encode("ascii")
+            _lib.dtmf_generator_transmit(gen, chunk, len(chunk))
+            while True:
+                n = _lib.dtmf_generator_render(gen, buf, frames)
+                out.extend(buf[:n * frame_size])
+                if n < frames:
+                    break
+    finally:
+        _lib.dtmf_generator_destroy(gen)
+    return out
+
+def _check_state_round_trip():
+    """Detect push buttons split across a save_state/restore_state into a
+    fresh detector, and compare with detecting them in one go."""
+    samples = generate("123456789*0#", 50, 50)
+    expected = Detector().feed(samples)
+    # Split inside a block, so that the snapshot carries pending samples.
+    split = len(samples) // 2 + BLOCK_SAMPLES // 3
+    first = Detector()
+    events = first.feed(samples[:split])
+    second = Detector()
+    second.restore_state(first.save_state())
+    events += second.feed(samples[split:])
+    if events != expected:
+        raise AssertionError("restored detector found %r, expected %r"
+                             % (events, expected))
+
+# Check the library: python dtmflib.py
+if __name__ == "__main__":
+    import sys
+    if not available():
+        sys.stderr.write("cannot load the native library\n")
+        sys.exit(1)
+    _check_state_round_trip()
+    sys.stdout.write("ok\n")
@@ -9,6 +9,7 @@ from math import pi, cos
 
 from plot_au import read_au
 from tonegen import ROW_FREQ, COL_FREQ
+import dtmflib
 
 #
 # Mapping of dual tones (lo, hi) to their symbols.
@@ -50,6 +51,12 @@ def create_parser():
             default=120,
             type="int",
             help="Specify the detection buffer length")
+    parser.add_option(
+            "--python",
+            dest="python",
+            default=False,
+            action="store_true",
+            help="Use this implementation even if the native library is available")
     return parser
 
 class Goertzel:
@@ -108,6 +115,17 @@ class Goertzel:
 
         return tone, mag1, mag2
 
+def native(samples):
+    """Run the production detector over samples through the native library.
+    It works on blocks of dtmflib.BLOCK_SAMPLES; the threshold and buflen
+    options don't apply."""
+    detector = dtmflib.Detector()
+    blocks = detector.analyze(dtmflib.promote(samples))
+    for i, (tone, mag) in enumerate(blocks):
+        if tone == " ":
+            tone = "."
+        print "%8d %s %.2f %.2f" % (i*dtmflib.BLOCK_SAMPLES, tone, max(mag[:4]), max(mag[4:8]))
+
 def main():
     parser = create_parser()
     options, args = parser.parse_args()
@@ -115,6 +133,9 @@ def main():
         parser.error("invalid number of arguments")
     sample_rate, samples = read_au(args[0])
     print "%s: %dHz" % (args[0], sample_rate)
+    if dtmflib.available() and sample_rate == 8000 and not options.python:
+        native(samples)
+        return
     goertzel = Goertzel(sample_rate, options.threshold)
     for i in range(0, len(samples) - options.buflen, options.buflen): 
         tone, mag1, mag2 = goertzel.process(samples[i:i+options.buflen])
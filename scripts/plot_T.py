@@ -1,26 +1,68 @@
 """Plot the magnitudes of each frequency detected at each frame.
 
-usage: detect-au.out file.au | python plot_T.py
+usage: python plot_T.py dtmf-trace-NNN.bin [channel]
+       python plot_T.py file.au
 
-Requires that the detector was built with make debug.
+The first form reads a trace file written by the detector, e.g. by:
+
+    detect-au.out -t /tmp file.au
+
+and plots the frames of the specified channel (0 by default).  The second
+requires the native library (lib/libdtmf.so).
 """
 import sys
-import csv
 import matplotlib.pyplot as plt
+from struct import unpack_from, calcsize
+import dtmflib
+from plot_au import read_au
 
 def from_fp(fp):
     """Convert from fixed-point to float."""
     return float(fp)/2**15
 
 #
-# ignore the first and second columns -- the frame number and the tone, 
-# respectively.
+# See DtmfTraceFile in DtmfTrace.hpp for the format.
 #
-coeff = list()
-for row in csv.reader(sys.stdin, delimiter=" "):
-    if len(row) != 18+1: # last column is empty string, ignore it
-        continue
-    coeff.append(map(from_fp, row[:-1])) 
+TRACE_MAGIC = "DTMFTRC1"
+TRACE_HEADER = 64
+TRACE_RECORD = "=QI18ibbcB"
+
+def read_trace(fname, channel):
+    """Read the magnitudes of the non-silent frames of a channel from a
+    trace file, oldest first."""
+    payload = open(fname, "rb").read()
+    record_size, capacity, written = unpack_from("=IIQ", payload, 8)
+    assert record_size == calcsize(TRACE_RECORD)
+    first = max(0, written - capacity)
+    coeff = list()
+    for n in range(first, written):
+        record = unpack_from(TRACE_RECORD, payload, TRACE_HEADER + (n % capacity)*record_size)
+        T, reason = record[2:20], record[-1]
+        if record[1] != channel or reason == 1: # silence: magnitudes not computed
+            continue
+        coeff.append(map(from_fp, T))
+    return coeff
+
+def analyze_au(fname):
+    """Compute the magnitudes of the non-silent frames of an AU file."""
+    if not dtmflib.available():
+        print >> sys.stderr, "the native library is required to read %s" % fname
+        sys.exit(1)
+    _, samples = read_au(fname)
+    coeff = list()
+    for tone, mag in dtmflib.Detector().analyze(dtmflib.promote(samples)):
+        if tone == " " and not any(mag): # silence: magnitudes not computed
+            continue
+        coeff.append(map(from_fp, mag))
+    return coeff
+
+if len(sys.argv) < 2:
+    print >> sys.stderr, __doc__
+    sys.exit(1)
+if open(sys.argv[1], "rb").read(8) == TRACE_MAGIC:
+    coeff = read_trace(sys.argv[1], int(sys.argv[2]) if len(sys.argv) > 2 else 0)
+else:
+    coeff = analyze_au(sys.argv[1])
 xval = range(len(coeff))
 
 leg = { 0: ("r",        "o", "706Hz"),  # row freq
@@ -5,6 +5,7 @@
 #
 from struct import pack
 from math import sin, pi
+import dtmflib
 
 ROW_FREQ = (697, 770, 852, 941)
 COL_FREQ = (1209, 1336, 1477, 1633)
@@ -35,6 +36,12 @@ def create_parser():
             default=40,
             type="int",
             help="Specify the tone duration in ms")
+    parser.add_option(
+            "--python",
+            dest="python",
+            default=False,
+            action="store_true",
+            help="Don't use the native DtmfGenerator even if it is available")
     return parser
 
 def tone2(f1, f2, sample_rate, dur):
@@ -52,6 +59,18 @@ def tone2(f1, f2, sample_rate, dur):
     factor2 = 2*pi*f2/sample_rate
     return [ (sin(x*factor1) + sin(x*factor2))/2 for x in range(nsamples) ]
 
+def native_tone2(button, dur):
+    """
+    Generate the tone for a button with the DtmfGenerator, at 8KHz.  Scaled
+    to the same range as tone2.
+    """
+    nsamples = 8000*dur/1000
+    #
+    # The generator appends at least one frame of silence; drop it.
+    #
+    samples = dtmflib.generate(button, dur, 0)[:nsamples]
+    return [ float(y)/32768 for y in samples ]
+
 def silence(sample_rate, dur):
     """Generate silence of the specified duration, in ms."""
     return [ 0 for i in range(sample_rate*dur/1000) ]
@@ -103,6 +122,11 @@ def main():
     tones["S"] = tones["*"]
     tones["H"] = tones["#"]
 
+    if dtmflib.available() and options.sample_rate == 8000 and not options.python:
+        for ch in tones:
+            if ch.strip():
+                tones[ch] = native_tone2({"S" : "*", "H" : "#"}.get(ch, ch), options.duration)
+
     samples = list()
     for ch in args[0]:
         samples += tones[ch]